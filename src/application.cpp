@@ -41,10 +41,15 @@ Application::Application(int & argc, char ** argv)
 : QApplication(argc, argv),
   m_scanProfiles(),
   m_clamavInit(0),
+  m_engineLock(),
   m_scanEngine(nullptr),
+  m_engineDatabaseVersion(),
   m_engineLockCount(0),
   m_engineDisposeTimer(0),
-  m_settings(nullptr) {
+  m_isEngineStale(false),
+  m_settings(nullptr),
+  m_changeJournal(),
+  m_onAccessScanner() {
 	qRegisterMetaType<Qlam::DatabaseInfo>("DatabaseInfo");
 
 	if(s_instance) {
@@ -74,9 +79,12 @@ Application::Application(int & argc, char ** argv)
 }
 
 Application::~Application() {
+	// it holds a lock on the engine, which is disposed of below
+	m_onAccessScanner.stop();
 	writeScanProfiles();
 	qDeleteAll(m_scanProfiles);
 	m_scanProfiles.clear();
+	std::lock_guard<std::mutex> lock(m_engineLock);
 
 	if(m_engineDisposeTimer) {
 		killTimer(m_engineDisposeTimer);
@@ -93,14 +101,116 @@ Application::~Application() {
 
 int Application::exec() {
 	readScanProfiles();
+	updateChangeJournal();
+	connect(this, qOverload<int>(&Application::scanProfileAdded), this, &Application::updateChangeJournal);
+	connect(m_settings, &Settings::watchChangesChanged, this, &Application::updateChangeJournal);
+	updateOnAccessScanner();
+	connect(m_settings, &Settings::onAccessScanningChanged, this, &Application::updateOnAccessScanner);
+	connect(m_settings, &Settings::onAccessPathsChanged, this, &Application::updateOnAccessScanner);
+	connect(m_settings, &Settings::databasePathChanged, this, &Application::databasesUpdated);
 	return QApplication::exec();
 }
 
+void Application::updateOnAccessScanner() {
+	m_onAccessScanner.stop();
+
+	if(!settings()->onAccessScanning()) {
+		return;
+	}
+
+	QStringList paths = settings()->onAccessPaths();
+
+	if(paths.isEmpty()) {
+		paths.append(QDir::homePath());
+	}
+
+	if(!m_onAccessScanner.start(paths)) {
+		qDebug() << "on-access scanning could not be started";
+	}
+}
+
+void Application::updateChangeJournal() {
+	m_changeJournal.stop();
+
+	if(!settings()->watchChanges()) {
+		return;
+	}
+
+	QList<ScanProfile> profiles;
+
+	// the first profile is the custom scan, whose paths change from one scan to the next
+	for(int idx = 1; idx < m_scanProfiles.count(); ++idx) {
+		profiles.append(*m_scanProfiles.at(idx));
+	}
+
+	m_changeJournal.start(profiles);
+}
+
+void Application::databasesUpdated() {
+	{
+		std::lock_guard<std::mutex> lock(m_engineLock);
+
+		if(!m_scanEngine) {
+			return;
+		}
+
+		m_isEngineStale = true;
+	}
+
+	reloadEngine();
+}
+
+/**
+ * Replace a stale engine, unless a scan other than the on-access scanner is using it.
+ *
+ * The on-access scanner holds its lock for as long as it runs, so it's stopped to let the engine go and started again
+ * with the new one. A scan that still has the old engine keeps it to the end; the release of its lock calls this again.
+ */
+void Application::reloadEngine() {
+	const bool isOnAccessRunning = m_onAccessScanner.isRunning();
+
+	{
+		std::lock_guard<std::mutex> lock(m_engineLock);
+
+		if(!m_isEngineStale || m_engineLockCount > (isOnAccessRunning ? 1 : 0)) {
+			return;
+		}
+	}
+
+qDebug() << "signature databases have changed - replacing the scan engine";
+	m_onAccessScanner.stop();
+
+	{
+		std::lock_guard<std::mutex> lock(m_engineLock);
+
+		// a scan may have taken the old engine in the meantime
+		if(0 == m_engineLockCount) {
+			disposeEngine();
+		}
+	}
+
+	if(isOnAccessRunning) {
+		updateOnAccessScanner();
+	}
+}
+
+QByteArray Application::engineDatabaseVersion() const {
+	std::lock_guard<std::mutex> lock(m_engineLock);
+	return m_engineDatabaseVersion;
+}
+
 struct cl_engine * Application::acquireEngine() {
 	if(!clamAvInitialised()) {
 		return nullptr;
 	}
 
+	std::lock_guard<std::mutex> lock(m_engineLock);
+
+	// no one is using the stale engine, so there's no need to wait for the timer
+	if(m_isEngineStale && 0 == m_engineLockCount) {
+		disposeEngine();
+	}
+
 	if(m_engineDisposeTimer) {
 qDebug() << "engine lock requested, stopping dispose timer";
 		killTimer(m_engineDisposeTimer);
@@ -120,6 +230,9 @@ qDebug() << "engine lock requested, stopping dispose timer";
 			path = QDir::toNativeSeparators(settings()->databasePath()).toLocal8Bit();
 		}
 
+		// read before the databases are loaded, so that an update part way through the load leaves the engine looking
+		// older than it is rather than newer - the cache and stamps then only miss out, rather than trust old verdicts
+		m_engineDatabaseVersion = databaseVersion();
 		int ret = cl_load(path.data(), m_scanEngine, &sigs, CL_DB_STDOPT); // NOLINT(hicpp-signed-bitwise)
 
 		if(CL_SUCCESS != ret) {
@@ -146,6 +259,7 @@ qDebug() << "scan engine dispose timer is" << (0 == m_engineDisposeTimer ? "not"
 }
 
 void Application::releaseEngine() {
+	std::lock_guard<std::mutex> lock(m_engineLock);
 	Q_ASSERT(0 < m_engineLockCount);
 qDebug() << "releasing one lock on scan engine" << ((void *) m_scanEngine);
 	--m_engineLockCount;
@@ -158,14 +272,24 @@ qDebug() << "scan engine dispose timer is" << (0 == m_engineDisposeTimer ? "not"
 qDebug() << "no remaining engine locks, starting dispose timer";
 		m_engineDisposeTimer = startTimer(QLAM_APPLICATION_SCAN_ENGINE_DISPOSE_TIMEOUT);
 	}
+
+	// at most the on-access scanner is left holding a stale engine. released from scan threads too, so the engine is
+	// replaced on the application's thread
+	if(m_isEngineStale && 1 >= m_engineLockCount) {
+		QMetaObject::invokeMethod(this, &Application::reloadEngine, Qt::QueuedConnection);
+	}
 }
 
 void Application::timerEvent(QTimerEvent * ev) {
 	if(0 != m_engineDisposeTimer && ev->timerId() == m_engineDisposeTimer) {
+		std::lock_guard<std::mutex> lock(m_engineLock);
 		disposeEngine();
 	}
 }
 
+/**
+ * m_engineLock must be held.
+ */
 void Application::disposeEngine() {
 	Q_ASSERT(0 == m_engineLockCount);
 
@@ -180,6 +304,8 @@ qDebug() << "disposing scan engine" << ((void *) m_scanEngine);
 	}
 
 	m_scanEngine = nullptr;
+	m_engineDatabaseVersion.clear();
+	m_isEngineStale = false;
 }
 
 void Application::addScanProfile(ScanProfile * profile) {
@@ -250,6 +376,27 @@ QList<DatabaseInfo> Application::databases() {
 	return ret;
 }
 
+/**
+ * Identify the signatures in the current databases.
+ *
+ * The scan cache, scan stamps and signature deltas are all tied to this, so it changes whenever any of the
+ * databases, or libclamav itself, does.
+ */
+QByteArray Application::databaseVersion() {
+	QStringList versions;
+
+	for(const auto & db : databases()) {
+		versions.append(db.fileName() + ':' + db.version());
+	}
+
+	if(versions.isEmpty()) {
+		return {};
+	}
+
+	versions.sort();
+	return "libclamav:" + QByteArray(cl_retver()) + ';' + versions.join(';').toUtf8();
+}
+
 void Application::readScanProfiles() {
 	QSettings settings;
 
@@ -268,6 +415,11 @@ void Application::readScanProfiles() {
 			settings.setArrayIndex(idx);
 			auto * profile = new ScanProfile(settings.value("name").toString());
 			profile->setPaths(settings.value("paths").toStringList());
+			profile->setScanMode(ScanProfile::stringToScanMode(settings.value("mode").toString()));
+			profile->setScrubPeriod(settings.value("scrub.period", ScanProfile::DefaultScrubPeriod).toInt());
+			profile->setSliceDuration(settings.value("scrub.sliceduration", ScanProfile::DefaultSliceDuration).toInt());
+			profile->setSliceSize(settings.value("scrub.slicesize", 0).toInt());
+			profile->setDeadline(settings.value("deadline", ScanProfile::DefaultDeadline).toInt());
 			addScanProfile(profile);
 		}
 
@@ -285,6 +437,11 @@ void Application::writeScanProfiles() {
 		ScanProfile * profile = m_scanProfiles.at(idx);
 		settings.setValue("name", profile->name());
 		settings.setValue("paths", profile->paths());
+		settings.setValue("mode", ScanProfile::scanModeToString(profile->scanMode()));
+		settings.setValue("scrub.period", profile->scrubPeriod());
+		settings.setValue("scrub.sliceduration", profile->sliceDuration());
+		settings.setValue("scrub.slicesize", profile->sliceSize());
+		settings.setValue("deadline", profile->deadline());
 	}
 
 	settings.endArray();
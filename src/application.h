@@ -9,10 +9,15 @@
 #include <QtGui/QApplication>
 #endif
 
+#include <mutex>
+
+#include <QtCore/QByteArray>
 #include <QtCore/QList>
 
 struct cl_engine;
 
+#include "changejournal.h"
+#include "onaccessscanner.h"
 #include "settings.h"
 #include "scanprofile.h"
 #include "databaseinfo.h"
@@ -39,6 +44,13 @@ namespace Qlam {
 			static QString systemDatabasePath();
 			QList<DatabaseInfo> databases();
 
+			/* identifies the signatures an engine loaded now would have - empty if the databases can't be read */
+			QByteArray databaseVersion();
+
+			/* identifies the signatures the shared engine was loaded with - empty if there is no engine, or the
+			 * databases couldn't be read when it was loaded. only stable while the caller holds a lock on the engine */
+			QByteArray engineDatabaseVersion() const;
+
 			/* discard the cache of database information so that the next call
 			 * to databases() rescans the databases files */
 //			void discardDatabaseInfoCache();
@@ -63,11 +75,24 @@ namespace Qlam {
 				return m_settings;
 			}
 
+			OnAccessScanner * onAccessScanner() {
+				return &m_onAccessScanner;
+			}
+
 		Q_SIGNALS:
 			void scanProfileAdded(const QString &);
 			void scanProfileAdded(int);
 
 		public Q_SLOTS:
+			/* restart the change journal watcher with the current profiles, if it's enabled */
+			void updateChangeJournal();
+
+			/* start or stop on-access scanning to match the settings */
+			void updateOnAccessScanner();
+
+			/* the databases on disk have changed, so the shared engine is replaced as soon as no scan is using it, and the
+			 * on-access scanner restarted with the new one */
+			void databasesUpdated();
 
 		protected:
 			void timerEvent(QTimerEvent *) override;
@@ -75,6 +100,7 @@ namespace Qlam {
 		private Q_SLOTS:
 			void readScanProfiles();
 			void writeScanProfiles();
+			void reloadEngine();
 
 		private:
 			void disposeEngine();
@@ -83,11 +109,19 @@ namespace Qlam {
 			QList<ScanProfile *> m_scanProfiles;
 			int m_clamavInit;
 
+			// guards the engine, its lock count and its version - scans acquire and release it from their own threads
+			mutable std::mutex m_engineLock;
 			struct cl_engine * m_scanEngine;
+			QByteArray m_engineDatabaseVersion;
 			int m_engineLockCount;
 			int m_engineDisposeTimer;
 
+			// the databases have changed since the engine was loaded
+			bool m_isEngineStale;
+
 			Settings * m_settings;
+			ChangeJournal m_changeJournal;
+			OnAccessScanner m_onAccessScanner;
 	};
 }
 
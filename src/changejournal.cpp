@@ -0,0 +1,796 @@
+#include "changejournal.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <ctime>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/fanotify.h>
+#include <sys/file.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QDebug>
+#include <QtCore/QDir>
+#include <QtCore/QDirIterator>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QSaveFile>
+#include <QtCore/QStandardPaths>
+
+using namespace Qlam;
+
+// how often, in ms, the changes seen are appended to the journals
+static constexpr const int FlushInterval = 1000;
+
+// a profile with this many changes waiting has them appended straight away, so that memory use stays bounded
+static constexpr const int MaxPendingChanges = 4096;
+
+// a journal listing this many paths is marked as overflowed instead, so that it doesn't grow without bound between
+// scans - a scan that has to look at that many files may as well walk everything
+static constexpr const int MaxJournalPaths = 65536;
+
+// the events that mean a file's content may be new: written, created (including hard links) or moved in
+static constexpr const quint64 FanotifyMask = FAN_CLOSE_WRITE | FAN_CREATE | FAN_MOVED_TO | FAN_ONDIR;
+static constexpr const quint32 InotifyMask = IN_CLOSE_WRITE | IN_CREATE | IN_MOVED_TO | IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK;
+
+namespace {
+	// the key for a profile's files in the journal directory
+	QString profileKey(const QString & profileName) {
+		return QString::fromLatin1(QCryptographicHash::hash(profileName.toUtf8(), QCryptographicHash::Sha256).toHex().left(32));
+	}
+
+	// ms
+	qint64 monotonicTime() {
+		struct timespec now{};
+		::clock_gettime(CLOCK_MONOTONIC, &now);
+		return static_cast<qint64>(now.tv_sec) * 1000 + now.tv_nsec / 1000000;
+	}
+
+	QByteArray childPath(const QByteArray & directory, const char * name) {
+		return (directory.endsWith('/') ? directory : directory + '/') + name;
+	}
+
+	bool isWithin(const QByteArray & path, const QByteArray & directory) {
+		return path == directory || "/" == directory || path.startsWith(directory + '/');
+	}
+
+	// the canonical form of a set of paths, as the kernel reports them, skipping any that don't exist
+	QList<QByteArray> canonicalPaths(const QStringList & paths) {
+		QList<QByteArray> ret;
+
+		for(const auto & path : paths) {
+			const QString canonicalPath = QFileInfo(path).canonicalFilePath();
+
+			if(!canonicalPath.isEmpty()) {
+				ret.append(QFile::encodeName(canonicalPath));
+			}
+		}
+
+		return ret;
+	}
+
+	QByteArray readAll(const QString & fileName) {
+		QFile file(fileName);
+
+		if(!file.open(QIODevice::ReadOnly)) {
+			return {};
+		}
+
+		return file.readAll();
+	}
+
+	bool writeAll(const QString & fileName, const QByteArray & data) {
+		QSaveFile file(fileName);
+		return file.open(QIODevice::WriteOnly) && data.size() == file.write(data) && file.commit();
+	}
+
+	/**
+	 * Append records to a journal, returning its size afterwards or -1 if it couldn't be written.
+	 *
+	 * take() renames the journal while holding a lock on it, so a journal that changes identity while we wait for
+	 * the lock has been taken and a new one is started. records is called with the lock held and the journal's
+	 * metadata, and returns what to append.
+	 */
+	template<class Fn>
+	qint64 appendRecords(const QString & fileName, Fn records) {
+		const QByteArray rawName = QFile::encodeName(fileName);
+
+		while(true) {
+			int fd = ::open(rawName.constData(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+
+			if(-1 == fd) {
+qDebug() << "failed to open change journal" << fileName << ":" << std::strerror(errno);
+				return -1;
+			}
+
+			struct stat opened{};
+			struct stat current{};
+			::flock(fd, LOCK_EX);
+
+			if(0 == ::fstat(fd, &opened) && 0 == ::stat(rawName.constData(), &current) && opened.st_dev == current.st_dev && opened.st_ino == current.st_ino) {
+				const QByteArray toAppend = records(opened);
+				const char * data = toAppend.constData();
+				std::size_t remaining = static_cast<std::size_t>(toAppend.size());
+				qint64 size = static_cast<qint64>(opened.st_size);
+
+				while(0 < remaining) {
+					ssize_t written = ::write(fd, data, remaining);
+
+					if(0 > written) {
+						if(EINTR == errno) {
+							continue;
+						}
+
+qDebug() << "failed to write change journal" << fileName << ":" << std::strerror(errno);
+						size = -1;
+						break;
+					}
+
+					data += written;
+					size += written;
+					remaining -= static_cast<std::size_t>(written);
+				}
+
+				::close(fd);
+				return size;
+			}
+
+			::close(fd);
+		}
+	}
+
+	/**
+	 * The epoch of the running watcher, or an empty array if no watcher is running.
+	 */
+	QByteArray liveEpoch(const QString & directory) {
+		const QByteArray leaseName = QFile::encodeName(directory + QStringLiteral("/watcher.lease"));
+		int fd = ::open(leaseName.constData(), O_RDONLY | O_CLOEXEC);
+
+		if(-1 == fd) {
+			return {};
+		}
+
+		QByteArray epoch;
+
+		// the watcher holds an exclusive lock for as long as it runs
+		if(0 != ::flock(fd, LOCK_SH | LOCK_NB)) {
+			char buffer[64];
+			ssize_t bytesRead = ::pread(fd, buffer, sizeof(buffer), 0);
+
+			if(0 < bytesRead) {
+				epoch = QByteArray(buffer, static_cast<int>(bytesRead));
+			}
+		}
+
+		::close(fd);
+		return epoch;
+	}
+}
+
+ChangeJournal::ChangeJournal()
+: m_directory(defaultDirectory()),
+  m_epoch(),
+  m_leaseFd(-1),
+  m_stopFd(-1),
+  m_notifyFd(-1),
+  m_isFanotify(false),
+  m_thread(),
+  m_profiles(),
+  m_mountFds(),
+  m_watchPaths() {
+}
+
+ChangeJournal::~ChangeJournal() {
+	stop();
+}
+
+QString ChangeJournal::defaultDirectory() {
+	return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + QStringLiteral("/journal");
+}
+
+/**
+ * Take the changes recorded for a profile, leaving an empty journal.
+ *
+ * The journal is taken for every scan of the profile, incremental or not, so that the next scan only needs the
+ * changes made from now on. scanPaths are the paths about to be scanned; changes elsewhere are dropped, and the
+ * journal is only complete if the watcher covers all of them.
+ */
+ChangeJournal::Changes ChangeJournal::take(const QString & profileName, const QStringList & scanPaths) {
+	Changes changes{false, {}};
+	const QString directory = defaultDirectory();
+	const QString key = directory + '/' + profileKey(profileName);
+	const QByteArray epoch = liveEpoch(directory);
+	const QByteArray lastEpoch = readAll(key + QStringLiteral(".state"));
+	QList<QByteArray> watching = readAll(key + QStringLiteral(".watching")).split('\n');
+	QByteArray records;
+	const QByteArray journalName = QFile::encodeName(key + QStringLiteral(".journal"));
+	int fd = ::open(journalName.constData(), O_RDONLY | O_CLOEXEC);
+
+	if(-1 != fd) {
+		// the lock keeps the watcher from appending while the journal is moved out of the way
+		::flock(fd, LOCK_EX);
+		const QByteArray takenName = journalName + ".taken";
+		::rename(journalName.constData(), takenName.constData());
+		char buffer[64 * 1024];
+		ssize_t bytesRead;
+
+		while(0 < (bytesRead = ::read(fd, buffer, sizeof(buffer))) || (0 > bytesRead && EINTR == errno)) {
+			if(0 < bytesRead) {
+				records.append(buffer, static_cast<int>(bytesRead));
+			}
+		}
+
+		::unlink(takenName.constData());
+		::close(fd);
+	}
+
+	QDir().mkpath(directory);
+	writeAll(key + QStringLiteral(".state"), epoch);
+
+	if(epoch.isEmpty() || epoch != lastEpoch || watching.isEmpty() || watching.takeFirst() != epoch) {
+		return changes;
+	}
+
+	const QList<QByteArray> roots = canonicalPaths(scanPaths);
+
+	for(const auto & root : roots) {
+		if(std::none_of(watching.cbegin(), watching.cend(), [&root](const QByteArray & watched) {
+			return isWithin(root, watched);
+		})) {
+			return changes;
+		}
+	}
+
+	// each record is a path followed by a NUL; an empty record marks lost events
+	QList<QByteArray> paths = records.split('\0');
+
+	if(!paths.isEmpty()) {
+		paths.removeLast();
+	}
+
+	if(paths.contains(QByteArray())) {
+		return changes;
+	}
+
+	std::sort(paths.begin(), paths.end());
+	paths.erase(std::unique(paths.begin(), paths.end()), paths.end());
+	changes.isComplete = true;
+	QByteArray lastKept;
+
+	for(const auto & path : paths) {
+		// sorted, so anything inside a directory that's already listed follows it directly
+		if(!lastKept.isEmpty() && isWithin(path, lastKept)) {
+			continue;
+		}
+
+		if(std::any_of(roots.cbegin(), roots.cend(), [&path](const QByteArray & root) {
+			return isWithin(path, root);
+		})) {
+			changes.paths.append(QFile::decodeName(path));
+			lastKept = path;
+		}
+	}
+
+	return changes;
+}
+
+/**
+ * Make the next take() for a profile report its journal as incomplete.
+ *
+ * For use when a scan that has taken the journal doesn't finish, so that the changes it didn't get to are not lost.
+ */
+void ChangeJournal::invalidate(const QString & profileName) {
+	QFile::remove(defaultDirectory() + '/' + profileKey(profileName) + QStringLiteral(".state"));
+}
+
+/**
+ * Start recording the changes to the given profiles' paths.
+ *
+ * Returns false if another watcher is already running. The watches themselves are set up on the watcher's thread,
+ * since adding an inotify watch for every directory can take a while.
+ */
+bool ChangeJournal::start(const QList<ScanProfile> & profiles) {
+	stop();
+	QDir().mkpath(m_directory);
+	const QByteArray leaseName = QFile::encodeName(m_directory + QStringLiteral("/watcher.lease"));
+	m_leaseFd = ::open(leaseName.constData(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+
+	if(-1 == m_leaseFd || 0 != ::flock(m_leaseFd, LOCK_EX | LOCK_NB)) {
+qDebug() << "another change journal watcher is running";
+
+		if(-1 != m_leaseFd) {
+			::close(m_leaseFd);
+			m_leaseFd = -1;
+		}
+
+		return false;
+	}
+
+	struct timespec now{};
+	::clock_gettime(CLOCK_REALTIME, &now);
+	m_epoch = QByteArray::number(static_cast<qint64>(now.tv_sec) * 1000000000 + now.tv_nsec) + '.' + QByteArray::number(::getpid());
+
+	if(0 != ::ftruncate(m_leaseFd, 0) || m_epoch.size() != ::pwrite(m_leaseFd, m_epoch.constData(), static_cast<std::size_t>(m_epoch.size()), 0)) {
+qDebug() << "failed to write change journal lease:" << std::strerror(errno);
+	}
+
+	for(const auto & profile : profiles) {
+		QList<QByteArray> paths = canonicalPaths(profile.paths());
+
+		if(!paths.isEmpty()) {
+			m_profiles.push_back({profileKey(profile.name()), paths, true, false, {}, {}, false, 0, 0, -1});
+		}
+	}
+
+	m_stopFd = ::eventfd(0, EFD_CLOEXEC);
+	m_thread = std::thread(&ChangeJournal::watch, this);
+	return true;
+}
+
+void ChangeJournal::stop() {
+	if(!m_thread.joinable()) {
+		return;
+	}
+
+	const quint64 stop = 1;
+
+	if(sizeof(stop) != ::write(m_stopFd, &stop, sizeof(stop))) {
+qDebug() << "failed to signal the change journal watcher to stop:" << std::strerror(errno);
+	}
+
+	m_thread.join();
+	::close(m_stopFd);
+	m_stopFd = -1;
+
+	// releasing the lease tells take() that nothing is recording any more
+	::close(m_leaseFd);
+	m_leaseFd = -1;
+	m_epoch.clear();
+	m_profiles.clear();
+}
+
+/**
+ * The watcher thread.
+ */
+void ChangeJournal::watch() {
+	m_isFanotify = startFanotify();
+
+	if(!m_isFanotify && !startInotify()) {
+qDebug() << "failed to start watching for changes";
+		return;
+	}
+
+qDebug() << "watching for changes using" << (m_isFanotify ? "fanotify" : "inotify") << "with" << m_watchPaths.size() << "inotify watches";
+
+	for(const auto & profile : m_profiles) {
+		writeWatching(profile);
+	}
+
+	struct pollfd fds[2] = {
+		{m_notifyFd, POLLIN, 0},
+		{m_stopFd, POLLIN, 0},
+	};
+
+	qint64 lastFlush = monotonicTime();
+
+	while(true) {
+		int ret = ::poll(fds, 2, FlushInterval);
+
+		if(0 > ret && EINTR != errno) {
+qDebug() << "failed waiting for changes:" << std::strerror(errno);
+			break;
+		}
+
+		if(0 < ret && (fds[1].revents & POLLIN)) {
+			break;
+		}
+
+		if(0 < ret && (fds[0].revents & POLLIN)) {
+			if(m_isFanotify) {
+				readFanotify();
+			}
+			else {
+				readInotify();
+			}
+		}
+
+		// flushing after every read would record the same files again and again while something is busy writing
+		// them, so changes are collected for up to FlushInterval
+		const qint64 now = monotonicTime();
+
+		if(now - lastFlush >= FlushInterval || std::any_of(m_profiles.cbegin(), m_profiles.cend(), [](const Profile & profile) {
+			return MaxPendingChanges <= profile.changed.size();
+		})) {
+			flush();
+			lastFlush = now;
+		}
+	}
+
+	flush();
+
+	for(auto fd : m_mountFds) {
+		::close(fd);
+	}
+
+	m_mountFds.clear();
+	m_watchPaths.clear();
+	::close(m_notifyFd);
+	m_notifyFd = -1;
+}
+
+/**
+ * Mark the filesystems containing the profiles' paths with fanotify.
+ *
+ * Needs CAP_SYS_ADMIN for the marks and CAP_DAC_READ_SEARCH to turn the file handles in the events back into paths.
+ */
+bool ChangeJournal::startFanotify() {
+	m_notifyFd = ::fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_NONBLOCK | FAN_REPORT_DFID_NAME, O_RDONLY | O_CLOEXEC | O_LARGEFILE);
+
+	if(-1 == m_notifyFd) {
+		return false;
+	}
+
+	for(const auto & profile : m_profiles) {
+		for(const auto & path : profile.paths) {
+			struct statfs fs{};
+			int mountFd = ::open(path.constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+			if(-1 == mountFd || 0 != ::fstatfs(mountFd, &fs) || 0 != ::fanotify_mark(m_notifyFd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, FanotifyMask, mountFd, nullptr)) {
+				if(-1 != mountFd) {
+					::close(mountFd);
+				}
+
+				for(auto fd : m_mountFds) {
+					::close(fd);
+				}
+
+				m_mountFds.clear();
+				::close(m_notifyFd);
+				m_notifyFd = -1;
+				return false;
+			}
+
+			quint64 fsid;
+			static_assert(sizeof(fsid) == sizeof(fs.f_fsid), "fsid must fit in 64 bits");
+			std::memcpy(&fsid, &fs.f_fsid, sizeof(fsid));
+
+			if(m_mountFds.contains(fsid)) {
+				::close(mountFd);
+			}
+			else {
+				m_mountFds.insert(fsid, mountFd);
+			}
+		}
+	}
+
+	// check that the handles can be opened before relying on them
+	for(auto fd : m_mountFds) {
+		alignas(struct file_handle) char buffer[sizeof(struct file_handle) + MAX_HANDLE_SZ];
+		auto * handle = reinterpret_cast<struct file_handle *>(buffer);
+		handle->handle_bytes = MAX_HANDLE_SZ;
+		int mountId;
+
+		if(0 != ::name_to_handle_at(fd, "", handle, &mountId, AT_EMPTY_PATH)) {
+			continue;
+		}
+
+		int dirFd = ::open_by_handle_at(fd, handle, O_PATH | O_CLOEXEC);
+
+		if(-1 == dirFd) {
+			for(auto mountFd : m_mountFds) {
+				::close(mountFd);
+			}
+
+			m_mountFds.clear();
+			::close(m_notifyFd);
+			m_notifyFd = -1;
+			return false;
+		}
+
+		::close(dirFd);
+	}
+
+	return true;
+}
+
+bool ChangeJournal::startInotify() {
+	m_notifyFd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+	if(-1 == m_notifyFd) {
+		return false;
+	}
+
+	for(auto & profile : m_profiles) {
+		for(const auto & path : profile.paths) {
+			if(!watchTree(path)) {
+qDebug() << "failed to watch all the directories in" << path << "- scans of the profile can't be incremental";
+				profile.isWatched = false;
+			}
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Add inotify watches to a directory and all the directories in it, or to the directory containing a file.
+ *
+ * Returns false if not everything could be watched, usually because the limit on inotify watches was reached.
+ */
+bool ChangeJournal::watchTree(const QByteArray & path) {
+	int wd = ::inotify_add_watch(m_notifyFd, path.constData(), InotifyMask);
+
+	if(-1 == wd) {
+		if(ENOTDIR == errno) {
+			return watchParent(path);
+		}
+
+		return ENOENT == errno;
+	}
+
+	// a directory that has been moved keeps its watch, which is updated with the new path
+	m_watchPaths.insert(wd, path);
+	bool ret = true;
+	QDirIterator it(QFile::decodeName(path), QDir::Dirs | QDir::NoDotAndDotDot | QDir::Hidden | QDir::System | QDir::NoSymLinks, QDirIterator::Subdirectories);
+
+	while(it.hasNext()) {
+		const QByteArray directory = QFile::encodeName(it.next());
+		wd = ::inotify_add_watch(m_notifyFd, directory.constData(), InotifyMask);
+
+		if(-1 != wd) {
+			m_watchPaths.insert(wd, directory);
+		}
+		else if(ENOENT != errno && ENOTDIR != errno) {
+			ret = false;
+		}
+	}
+
+	return ret;
+}
+
+/**
+ * Add an inotify watch to the directory containing a file, whose events name the file.
+ *
+ * Returns false if the directory couldn't be watched.
+ */
+bool ChangeJournal::watchParent(const QByteArray & path) {
+	const QByteArray directory = QFile::encodeName(QFileInfo(QFile::decodeName(path)).absolutePath());
+	int wd = ::inotify_add_watch(m_notifyFd, directory.constData(), InotifyMask);
+
+	if(-1 == wd) {
+		return ENOENT == errno;
+	}
+
+	m_watchPaths.insert(wd, directory);
+	return true;
+}
+
+void ChangeJournal::readFanotify() {
+	alignas(struct fanotify_event_metadata) char buffer[64 * 1024];
+
+	while(true) {
+		ssize_t length = ::read(m_notifyFd, buffer, sizeof(buffer));
+
+		if(0 >= length) {
+			if(0 > length && EINTR == errno) {
+				continue;
+			}
+
+			return;
+		}
+
+		for(auto * event = reinterpret_cast<struct fanotify_event_metadata *>(buffer); FAN_EVENT_OK(event, length); event = FAN_EVENT_NEXT(event, length)) {
+			if(event->mask & FAN_Q_OVERFLOW) {
+				recordOverflow();
+				continue;
+			}
+
+			auto * info = reinterpret_cast<struct fanotify_event_info_fid *>(reinterpret_cast<char *>(event) + event->metadata_len);
+
+			if(FAN_EVENT_INFO_TYPE_DFID_NAME != info->hdr.info_type) {
+				continue;
+			}
+
+			quint64 fsid;
+			std::memcpy(&fsid, &info->fsid, sizeof(fsid));
+			int mountFd = m_mountFds.value(fsid, -1);
+
+			if(-1 == mountFd) {
+				continue;
+			}
+
+			auto * handle = reinterpret_cast<struct file_handle *>(info->handle);
+			const char * name = reinterpret_cast<const char *>(handle->f_handle + handle->handle_bytes);
+
+			// the directory may have gone since the event
+			int dirFd = ::open_by_handle_at(mountFd, handle, O_PATH | O_CLOEXEC);
+
+			if(-1 == dirFd) {
+				continue;
+			}
+
+			char directory[PATH_MAX];
+			ssize_t directoryLength = ::readlink(("/proc/self/fd/" + QByteArray::number(dirFd)).constData(), directory, sizeof(directory));
+			::close(dirFd);
+
+			if(0 >= directoryLength || static_cast<ssize_t>(sizeof(directory)) == directoryLength) {
+				continue;
+			}
+
+			const QByteArray directoryPath(directory, static_cast<int>(directoryLength));
+			recordChange(0 == std::strcmp(name, ".") ? directoryPath : childPath(directoryPath, name));
+		}
+	}
+}
+
+void ChangeJournal::readInotify() {
+	alignas(struct inotify_event) char buffer[64 * 1024];
+
+	while(true) {
+		ssize_t length = ::read(m_notifyFd, buffer, sizeof(buffer));
+
+		if(0 >= length) {
+			if(0 > length && EINTR == errno) {
+				continue;
+			}
+
+			return;
+		}
+
+		for(char * next = buffer; next < buffer + length; ) {
+			const auto * event = reinterpret_cast<const struct inotify_event *>(next);
+			next += sizeof(struct inotify_event) + event->len;
+
+			if(event->mask & IN_Q_OVERFLOW) {
+				recordOverflow();
+				continue;
+			}
+
+			if(event->mask & IN_IGNORED) {
+				m_watchPaths.remove(event->wd);
+				continue;
+			}
+
+			const auto directory = m_watchPaths.constFind(event->wd);
+
+			if(directory == m_watchPaths.cend() || 0 == event->len) {
+				continue;
+			}
+
+			const QByteArray path = childPath(*directory, event->name);
+
+			// files may have been written to a new directory before its watch was added, so the whole directory is
+			// recorded. the directory containing a file in a profile's paths is watched for the file's sake, so its
+			// other subdirectories are left alone
+			if((event->mask & IN_ISDIR) && isProfilePath(path) && !watchTree(path)) {
+				lostWatch(path);
+			}
+
+			recordChange(path);
+		}
+	}
+}
+
+bool ChangeJournal::isProfilePath(const QByteArray & path) const {
+	return std::any_of(m_profiles.cbegin(), m_profiles.cend(), [&path](const Profile & profile) {
+		return std::any_of(profile.paths.cbegin(), profile.paths.cend(), [&path](const QByteArray & root) {
+			return isWithin(path, root);
+		});
+	});
+}
+
+void ChangeJournal::recordChange(const QByteArray & path) {
+	for(auto & profile : m_profiles) {
+		if(std::any_of(profile.paths.cbegin(), profile.paths.cend(), [&path](const QByteArray & root) {
+			return isWithin(path, root);
+		})) {
+			profile.changed.insert(path);
+		}
+	}
+}
+
+void ChangeJournal::recordOverflow() {
+qDebug() << "change events were lost - the next scan of each profile walks all its paths";
+
+	for(auto & profile : m_profiles) {
+		profile.isOverflowed = true;
+	}
+}
+
+/**
+ * Stop trusting the journals of the profiles covering a directory that couldn't be watched.
+ */
+void ChangeJournal::lostWatch(const QByteArray & path) {
+qDebug() << "failed to watch all the directories in" << path;
+
+	for(auto & profile : m_profiles) {
+		if(profile.isWatched && std::any_of(profile.paths.cbegin(), profile.paths.cend(), [&path](const QByteArray & root) {
+			return isWithin(path, root);
+		})) {
+			profile.isWatched = false;
+			profile.isOverflowed = true;
+			writeWatching(profile);
+		}
+	}
+}
+
+/**
+ * Publish which paths the watcher is recording a profile's changes for.
+ */
+void ChangeJournal::writeWatching(const Profile & profile) const {
+	const QString fileName = m_directory + '/' + profile.key + QStringLiteral(".watching");
+
+	if(!profile.isWatched) {
+		QFile::remove(fileName);
+		return;
+	}
+
+	QByteArray watching = m_epoch;
+
+	for(const auto & path : profile.paths) {
+		watching += '\n' + path;
+	}
+
+	writeAll(fileName, watching);
+}
+
+/**
+ * Append the changes seen since the last flush to the profiles' journals.
+ *
+ * Paths already in a journal aren't appended again, so a file that keeps changing between scans is only listed
+ * once.
+ */
+void ChangeJournal::flush() {
+	for(auto & profile : m_profiles) {
+		if(profile.changed.isEmpty() && !profile.isOverflowed) {
+			continue;
+		}
+
+		profile.journalSize = appendRecords(m_directory + '/' + profile.key + QStringLiteral(".journal"), [&profile](const struct stat & journal) {
+			// the journal has been taken since the last append unless it's the file that append left behind, in which
+			// case none of the paths appended so far are in it
+			if(journal.st_dev != profile.journalDevice || journal.st_ino != profile.journalInode || static_cast<qint64>(journal.st_size) != profile.journalSize) {
+				profile.journalDevice = journal.st_dev;
+				profile.journalInode = journal.st_ino;
+				profile.journaled.clear();
+				profile.isJournalFull = false;
+			}
+
+			QByteArray records;
+
+			// a journal with lost events is walked in full by the next scan, so there's no point adding to it
+			if(profile.isJournalFull) {
+				return records;
+			}
+
+			if(!profile.isOverflowed) {
+				for(const auto & path : profile.changed) {
+					if(!profile.journaled.contains(path)) {
+						profile.journaled.insert(path);
+						records.append(path);
+						records.append('\0');
+					}
+				}
+			}
+
+			if(profile.isOverflowed || MaxJournalPaths < profile.journaled.size()) {
+				records.append('\0');
+				profile.journaled.clear();
+				profile.isJournalFull = true;
+			}
+
+			return records;
+		});
+
+		profile.changed.clear();
+		profile.isOverflowed = false;
+	}
+}
@@ -0,0 +1,109 @@
+#ifndef QLAM_CHANGEJOURNAL_H
+#define QLAM_CHANGEJOURNAL_H
+
+#include <thread>
+#include <vector>
+
+#include <sys/types.h>
+
+#include <QtCore/QByteArray>
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QSet>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+
+#include "scanprofile.h"
+
+namespace Qlam {
+	/**
+	 * Records which files under each scan profile's paths change between scans.
+	 *
+	 * While the watcher is running it notes every file that is written, created or moved into the profiles' paths
+	 * and appends them, a batch at a time, to a journal on disk for each profile. A scan takes the profile's journal,
+	 * leaving an empty one behind, so an incremental scan only needs to look at what has changed since the last scan.
+	 *
+	 * fanotify is used where the process has the privileges for whole-filesystem marks (FAN_MARK_FILESYSTEM); it
+	 * sees every change on the filesystems concerned without a watch per directory. Otherwise each directory gets an
+	 * inotify watch.
+	 *
+	 * A journal can only be trusted if the same watcher has been recording since the journal was last taken, every
+	 * directory is watched and no events were lost. The watcher holds a lock on a lease file for as long as it runs,
+	 * with an epoch that identifies it, and take() checks all of this before reporting the journal as complete.
+	 */
+	class ChangeJournal {
+		public:
+			struct Changes {
+				// false if changes may have been missed, in which case the whole of the scan paths must be walked
+				bool isComplete;
+
+				// files and directories under the scan paths that have changed, with no path inside another
+				QStringList paths;
+			};
+
+			ChangeJournal();
+			~ChangeJournal();
+
+			ChangeJournal(const ChangeJournal &) = delete;
+			ChangeJournal & operator=(const ChangeJournal &) = delete;
+
+			static QString defaultDirectory();
+			static Changes take(const QString & profileName, const QStringList & scanPaths);
+			static void invalidate(const QString & profileName);
+
+			bool isRunning() const {
+				return m_thread.joinable();
+			}
+
+			bool start(const QList<ScanProfile> &);
+			void stop();
+
+		private:
+			struct Profile {
+				QString key;
+				QList<QByteArray> paths;
+				bool isWatched;
+				bool isOverflowed;
+				QSet<QByteArray> changed;
+
+				// the paths in the journal file, which is identified by its device, inode and size after the last
+				// append. a full journal has been marked as overflowed and isn't added to until it's taken
+				QSet<QByteArray> journaled;
+				bool isJournalFull;
+				dev_t journalDevice;
+				ino_t journalInode;
+				qint64 journalSize;
+			};
+
+			void watch();
+			bool startFanotify();
+			bool startInotify();
+			bool watchTree(const QByteArray &);
+			bool watchParent(const QByteArray &);
+			void readFanotify();
+			void readInotify();
+			bool isProfilePath(const QByteArray &) const;
+			void recordChange(const QByteArray &);
+			void recordOverflow();
+			void lostWatch(const QByteArray &);
+			void writeWatching(const Profile &) const;
+			void flush();
+
+			QString m_directory;
+			QByteArray m_epoch;
+			int m_leaseFd;
+			int m_stopFd;
+			int m_notifyFd;
+			bool m_isFanotify;
+			std::thread m_thread;
+			std::vector<Profile> m_profiles;
+
+			// fanotify: a descriptor on each marked filesystem, by fsid, to resolve the file handles in its events
+			QHash<quint64, int> m_mountFds;
+
+			// inotify: the directory each watch is on
+			QHash<int, QByteArray> m_watchPaths;
+	};
+}
+
+#endif // QLAM_CHANGEJOURNAL_H
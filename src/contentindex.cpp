@@ -0,0 +1,201 @@
+#include "contentindex.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <vector>
+
+#include <unistd.h>
+
+#include <QtCore/QCryptographicHash>
+
+#include <clamav.h>
+
+#include "disklayout.h"
+#include "sparsefile.h"
+
+using namespace Qlam;
+
+// how much of a file is read at a time while hashing it
+static constexpr const std::size_t HashBlockSize = 1024 * 1024;
+
+namespace {
+	void appendInteger(QByteArray & key, quint64 value) {
+		key.append(reinterpret_cast<const char *>(&value), sizeof(value));
+	}
+
+	// hashes [offset, end) of the file, returning false if it can't be read
+	bool hashRange(QCryptographicHash & hash, int fd, quint64 offset, quint64 end) {
+		thread_local std::vector<char> buffer(HashBlockSize);
+
+		while(offset < end) {
+			ssize_t bytesRead = ::pread(fd, buffer.data(), std::min<quint64>(buffer.size(), end - offset), static_cast<off_t>(offset));
+
+			if(0 > bytesRead) {
+				if(EINTR == errno) {
+					continue;
+				}
+
+				return false;
+			}
+
+			if(0 == bytesRead) {
+				break;
+			}
+
+			hash.addData(buffer.data(), static_cast<int>(bytesRead));
+			offset += static_cast<quint64>(bytesRead);
+		}
+
+		return true;
+	}
+}
+
+/**
+ * Work out the content key of a regular file.
+ *
+ * A file whose data is all shared is keyed on its device, size and extent map, which costs no I/O. A sparse file is
+ * keyed on its size and a digest of its data and where the data lies. Anything else is keyed on its size and a
+ * digest of its content, read through fd. Returns an empty array if the file can't be read.
+ */
+QByteArray ContentIndex::key(int fd, const struct stat & st) {
+	QByteArray key;
+	QByteArray extents = DiskLayout::sharedExtentMap(fd);
+
+	if(!extents.isEmpty()) {
+		key.append('x');
+		appendInteger(key, static_cast<quint64>(st.st_dev));
+		appendInteger(key, static_cast<quint64>(st.st_size));
+		key.append(QCryptographicHash::hash(extents, QCryptographicHash::Blake2b_256));
+		return key;
+	}
+
+	// a sparse file is keyed on where its data is as well as what it is, so that its holes needn't be read. a copy with
+	// its zeros written out won't match it, which only costs the chance to reuse the result
+	if(SparseFile::isSparse(st)) {
+		SparseFile sparse(fd, static_cast<quint64>(st.st_size));
+		QCryptographicHash hash(QCryptographicHash::Blake2b_256);
+		quint64 start = 0;
+		quint64 end = 0;
+
+		for(quint64 offset = 0; sparse.findData(offset, start, end); offset = end) {
+			QByteArray extent;
+			appendInteger(extent, start);
+			appendInteger(extent, end);
+			hash.addData(extent);
+
+			if(!hashRange(hash, fd, start, end)) {
+				return {};
+			}
+		}
+
+		key.append('s');
+		appendInteger(key, static_cast<quint64>(st.st_size));
+		key.append(hash.result());
+		return key;
+	}
+
+	thread_local std::vector<char> buffer(HashBlockSize);
+	QCryptographicHash hash(QCryptographicHash::Blake2b_256);
+	off_t offset = 0;
+
+	while(true) {
+		ssize_t bytesRead = ::pread(fd, buffer.data(), buffer.size(), offset);
+
+		if(0 > bytesRead) {
+			if(EINTR == errno) {
+				continue;
+			}
+
+			return {};
+		}
+
+		if(0 == bytesRead) {
+			break;
+		}
+
+		hash.addData(buffer.data(), static_cast<int>(bytesRead));
+		offset += bytesRead;
+	}
+
+	key.append('c');
+	appendInteger(key, static_cast<quint64>(offset));
+	key.append(hash.result());
+	return key;
+}
+
+/**
+ * Claim a content for scanning.
+ *
+ * If the content is being scanned by another worker, item is kept and returned by that worker's complete(). If it
+ * has already been scanned, result receives the outcome.
+ */
+ContentIndex::Claim ContentIndex::claim(const QByteArray & key, const ScanQueue::Item & item, Result & result) {
+	std::lock_guard<std::mutex> lock(m_lock);
+	auto entry = m_entries.find(key);
+
+	if(entry == m_entries.end()) {
+		m_entries.insert(key, {false, {CL_CLEAN, {}}, {}});
+		return Claim::First;
+	}
+
+	if(!entry->isComplete) {
+		entry->waiting.push_back(item);
+		return Claim::Pending;
+	}
+
+	result = entry->result;
+	return Claim::Known;
+}
+
+/**
+ * Record the outcome of scanning a claimed content, returning the files that were waiting for it.
+ *
+ * Only clean and infected outcomes are kept. If the scan failed the content is forgotten, and the caller should scan
+ * the returned files itself - the failure might have been down to the particular file rather than its content.
+ */
+std::vector<ScanQueue::Item> ContentIndex::complete(const QByteArray & key, const Result & result) {
+	std::lock_guard<std::mutex> lock(m_lock);
+	auto entry = m_entries.find(key);
+
+	if(entry == m_entries.end()) {
+		return {};
+	}
+
+	std::vector<ScanQueue::Item> waiting;
+	waiting.swap(entry->waiting);
+
+	if(CL_CLEAN == result.ret || CL_VIRUS == result.ret) {
+		entry->isComplete = true;
+		entry->result = result;
+	}
+	else {
+		m_entries.erase(entry);
+	}
+
+	return waiting;
+}
+
+/**
+ * Forget a claimed content without recording an outcome, returning the files that were waiting for it.
+ *
+ * For when the file that was scanned may not have had the content it was claimed for. The caller should scan the
+ * returned files itself.
+ */
+std::vector<ScanQueue::Item> ContentIndex::abandon(const QByteArray & key) {
+	std::lock_guard<std::mutex> lock(m_lock);
+	auto entry = m_entries.find(key);
+
+	if(entry == m_entries.end()) {
+		return {};
+	}
+
+	std::vector<ScanQueue::Item> waiting;
+	waiting.swap(entry->waiting);
+	m_entries.erase(entry);
+	return waiting;
+}
+
+void ContentIndex::clear() {
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_entries.clear();
+}
@@ -0,0 +1,69 @@
+#ifndef QLAM_CONTENTINDEX_H
+#define QLAM_CONTENTINDEX_H
+
+#include <mutex>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include <QtCore/QByteArray>
+#include <QtCore/QHash>
+#include <QtCore/QString>
+
+#include "scanqueue.h"
+
+namespace Qlam {
+	/**
+	 * The file contents seen so far in a scan, so that each distinct content is only scanned once.
+	 *
+	 * The first worker to claim a content scans it; files with the same content that turn up while it's being scanned
+	 * wait in the index and are handed back with the result, and files that turn up afterwards get the result
+	 * straight away.
+	 *
+	 * Content is identified by a BLAKE2b digest. A fast non-cryptographic hash would be quicker, but anyone who can
+	 * write a file to the scanned tree could then craft one that collides with a clean file and so is never scanned.
+	 * Files whose data is entirely shared with other files (reflinks) are identified by their extent map instead, and
+	 * aren't read at all.
+	 */
+	class ContentIndex {
+		public:
+			enum class Claim {
+				// the caller must scan the file and call complete()
+				First = 0,
+
+				// another worker is scanning the same content - the file will be returned by that worker's complete()
+				Pending,
+
+				// the content has already been scanned, and the result is available
+				Known,
+			};
+
+			struct Result {
+				int ret;
+				QString virusName;
+			};
+
+			ContentIndex() = default;
+			ContentIndex(const ContentIndex &) = delete;
+			ContentIndex & operator=(const ContentIndex &) = delete;
+
+			static QByteArray key(int fd, const struct stat &);
+
+			Claim claim(const QByteArray & key, const ScanQueue::Item &, Result &);
+			std::vector<ScanQueue::Item> complete(const QByteArray & key, const Result &);
+			std::vector<ScanQueue::Item> abandon(const QByteArray & key);
+			void clear();
+
+		private:
+			struct Entry {
+				bool isComplete;
+				Result result;
+				std::vector<ScanQueue::Item> waiting;
+			};
+
+			std::mutex m_lock;
+			QHash<QByteArray, Entry> m_entries;
+	};
+}
+
+#endif // QLAM_CONTENTINDEX_H
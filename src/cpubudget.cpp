@@ -0,0 +1,111 @@
+#include "cpubudget.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <QtGlobal>
+#include <QtCore/QByteArray>
+#include <QtCore/QFile>
+#include <QtCore/QList>
+#include <QtCore/QThread>
+
+#if defined(Q_OS_LINUX)
+#include <sched.h>
+#endif
+
+using namespace Qlam;
+
+// where the unified cgroup hierarchy is mounted
+static constexpr const char * CgroupRoot = "/sys/fs/cgroup";
+
+/**
+ * The number of CPUs the process can use, at least 1.
+ */
+int CpuBudget::available() {
+	int count = affinityCount();
+
+	if(auto quota = cgroupQuota()) {
+		count = std::min(count, static_cast<int>(std::ceil(*quota)));
+	}
+
+	return std::max(1, count);
+}
+
+/**
+ * The number of CPUs in the process's affinity mask.
+ */
+int CpuBudget::affinityCount() {
+#if defined(Q_OS_LINUX)
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+
+	if(0 == ::sched_getaffinity(0, sizeof(cpus), &cpus)) {
+		return std::max(1, CPU_COUNT(&cpus));
+	}
+#endif
+
+	return std::max(1, QThread::idealThreadCount());
+}
+
+/**
+ * The CPU quota, in CPUs, imposed by cgroup v2 on the process.
+ *
+ * The quota of a cgroup is bounded by the quotas of its ancestors, so every level from the process's cgroup up to the
+ * root is checked and the tightest one wins. Returns nothing if there is no cgroup v2 hierarchy or no level sets a
+ * quota.
+ */
+std::optional<double> CpuBudget::cgroupQuota() {
+#if defined(Q_OS_LINUX)
+	QFile cgroupFile(QStringLiteral("/proc/self/cgroup"));
+
+	if(!cgroupFile.open(QIODevice::ReadOnly)) {
+		return {};
+	}
+
+	// under cgroup v2 the process is in exactly one cgroup, listed as "0::<path>"
+	QByteArray cgroup;
+
+	for(const auto & line : cgroupFile.readAll().split('\n')) {
+		if(line.startsWith("0::")) {
+			cgroup = line.mid(3).trimmed();
+			break;
+		}
+	}
+
+	if(cgroup.isEmpty()) {
+		return {};
+	}
+
+	std::optional<double> quota;
+
+	while(true) {
+		QFile maxFile(QFile::decodeName(CgroupRoot + cgroup + "/cpu.max"));
+
+		// "<quota> <period>" in microseconds, or "max <period>" when this level doesn't limit the CPU
+		if(maxFile.open(QIODevice::ReadOnly)) {
+			QList<QByteArray> fields = maxFile.readAll().simplified().split(' ');
+
+			if(2 == fields.size() && "max" != fields[0]) {
+				bool quotaOk;
+				bool periodOk;
+				double levelQuota = fields[0].toDouble(&quotaOk);
+				double period = fields[1].toDouble(&periodOk);
+
+				if(quotaOk && periodOk && 0 < levelQuota && 0 < period) {
+					quota = std::min(quota.value_or(levelQuota / period), levelQuota / period);
+				}
+			}
+		}
+
+		if(cgroup.isEmpty() || "/" == cgroup) {
+			break;
+		}
+
+		cgroup.truncate(std::max(0, cgroup.lastIndexOf('/')));
+	}
+
+	return quota;
+#else
+	return {};
+#endif
+}
@@ -0,0 +1,24 @@
+#ifndef QLAM_CPUBUDGET_H
+#define QLAM_CPUBUDGET_H
+
+#include <optional>
+
+namespace Qlam {
+	/**
+	 * How much CPU this process may actually use.
+	 *
+	 * QThread::idealThreadCount() reports the CPUs in the machine, which is the wrong number inside a container or
+	 * when the process has been pinned to a few cores. The budget here is the number of CPUs in the process's affinity
+	 * mask, further limited by any cgroup v2 cpu.max quota on the process's cgroup or its ancestors.
+	 */
+	class CpuBudget {
+		public:
+			CpuBudget() = delete;
+
+			static int available();
+			static int affinityCount();
+			static std::optional<double> cgroupQuota();
+	};
+}
+
+#endif // QLAM_CPUBUDGET_H
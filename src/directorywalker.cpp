@@ -0,0 +1,636 @@
+#include "directorywalker.h"
+
+#include <QtGlobal>
+#include <QtCore/QDebug>
+#include <QtCore/QFile>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <limits>
+#include <thread>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(Q_OS_LINUX)
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#endif
+
+#include "disklayout.h"
+
+using namespace Qlam;
+
+// the most directories a walker thread will queue before it starts reading subdirectories inline. this keeps memory
+// use bounded when the tree is very wide
+static constexpr const std::size_t MaxQueuedDirectories = 256;
+
+// how long an idle walker thread waits for work before checking again whether the walk is over or has been aborted
+static constexpr const std::chrono::milliseconds IdleWait(2);
+
+// size of the buffer each getdents64() call fills. large enough to read most directories in one call
+static constexpr const std::size_t DirentBufferSize = 64 * 1024;
+
+#if defined(Q_OS_LINUX) && defined(STATX_TYPE)
+// the metadata the scan uses - the type, the scan cache key and what the deadline scores files by
+static constexpr const unsigned int RelaxedStatMask = STATX_TYPE | STATX_MODE | STATX_INO | STATX_SIZE | STATX_MTIME | STATX_CTIME;
+#endif
+
+namespace {
+	enum class EntryType {
+		Other = 0,
+		File,
+		FileLink,
+		Directory,
+		DirectoryLink,
+	};
+
+	struct Entry {
+		QByteArray name;
+		EntryType type;
+		quint64 inode;
+	};
+
+	// a file held back so that the files in a directory can be put into disk layout order before they're scanned
+	struct LayoutEntry {
+		QByteArray name;
+		bool isSymLink;
+		bool isCached;
+		quint64 position;
+	};
+
+#if defined(Q_OS_LINUX)
+	// glibc doesn't declare this, see getdents(2)
+	struct LinuxDirent64 {
+		ino64_t d_ino;
+		off64_t d_off;
+		unsigned short d_reclen;
+		unsigned char d_type;
+		char d_name[];
+	};
+#endif
+
+	/**
+	 * Hidden entries (including . and ..) are skipped. This matches the QDir filter the scanner has always used, which
+	 * does not include QDir::Hidden.
+	 */
+	inline bool isSkipped(const char * name) {
+		return '.' == name[0];
+	}
+
+	/**
+	 * fstatat(), or if relaxed, statx() for only the metadata the scan uses, taking what the filesystem has cached
+	 * rather than having it revalidate. On a network filesystem revalidating is a round trip for each file.
+	 *
+	 * Fields that weren't asked for are left zeroed.
+	 */
+	bool statEntry(int dirFd, const char * name, int flags, struct stat & st, bool relaxed) {
+#if defined(Q_OS_LINUX) && defined(STATX_TYPE)
+		if(relaxed) {
+			struct statx stx{};
+
+			if(0 != ::statx(dirFd, name, flags | AT_STATX_DONT_SYNC, RelaxedStatMask, &stx)) {
+				return false;
+			}
+
+			st = {};
+			st.st_dev = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+			st.st_ino = stx.stx_ino;
+			st.st_mode = stx.stx_mode;
+			st.st_nlink = stx.stx_nlink;
+			st.st_size = static_cast<off_t>(stx.stx_size);
+			st.st_mtim.tv_sec = stx.stx_mtime.tv_sec;
+			st.st_mtim.tv_nsec = stx.stx_mtime.tv_nsec;
+			st.st_ctim.tv_sec = stx.stx_ctime.tv_sec;
+			st.st_ctim.tv_nsec = stx.stx_ctime.tv_nsec;
+			return true;
+		}
+#else
+		Q_UNUSED(relaxed);
+#endif
+
+		return 0 == ::fstatat(dirFd, name, &st, flags);
+	}
+
+	/**
+	 * Work out what a directory entry is, stat()ing it only when d_type doesn't say or the entry is a symlink.
+	 *
+	 * Symlinks are classified by their target, which is what QFileInfo::isFile() and isDir() do.
+	 */
+	EntryType entryType(int dirFd, const char * name, unsigned char dType, bool relaxedStat) {
+		struct stat st{};
+
+		switch(dType) {
+			case DT_REG:
+				return EntryType::File;
+
+			case DT_DIR:
+				return EntryType::Directory;
+
+			case DT_LNK:
+				break;
+
+			case DT_UNKNOWN:
+				if(!statEntry(dirFd, name, AT_SYMLINK_NOFOLLOW, st, relaxedStat)) {
+					return EntryType::Other;
+				}
+
+				if(S_ISREG(st.st_mode)) {
+					return EntryType::File;
+				}
+
+				if(S_ISDIR(st.st_mode)) {
+					return EntryType::Directory;
+				}
+
+				if(!S_ISLNK(st.st_mode)) {
+					return EntryType::Other;
+				}
+
+				break;
+
+			default:
+				return EntryType::Other;
+		}
+
+		if(!statEntry(dirFd, name, 0, st, relaxedStat)) {
+			// dangling symlink
+			return EntryType::Other;
+		}
+
+		if(S_ISREG(st.st_mode)) {
+			return EntryType::FileLink;
+		}
+
+		if(S_ISDIR(st.st_mode)) {
+			return EntryType::DirectoryLink;
+		}
+
+		return EntryType::Other;
+	}
+
+	/**
+	 * Call fn(name, d_type, d_ino) for each entry in the open directory, stopping early if fn returns false.
+	 *
+	 * Returns false if the entries couldn't be read in full.
+	 */
+	template<class Fn>
+	bool readEntries(int dirFd, std::vector<char> & buffer, Fn fn) {
+#if defined(Q_OS_LINUX)
+		for(;;) {
+			long count = ::syscall(SYS_getdents64, dirFd, buffer.data(), buffer.size());
+
+			if(0 > count) {
+				qDebug() << "failed to read directory entries:" << std::strerror(errno);
+				return false;
+			}
+
+			if(0 == count) {
+				return true;
+			}
+
+			for(long offset = 0; offset < count;) {
+				const auto * entry = reinterpret_cast<const LinuxDirent64 *>(buffer.data() + offset);
+				offset += entry->d_reclen;
+
+				if(isSkipped(entry->d_name)) {
+					continue;
+				}
+
+				if(!fn(entry->d_name, entry->d_type, static_cast<quint64>(entry->d_ino))) {
+					return true;
+				}
+			}
+		}
+#else
+		Q_UNUSED(buffer);
+
+		// fdopendir() takes ownership of the descriptor, and the caller owns dirFd
+		int fd = ::dup(dirFd);
+
+		if(-1 == fd) {
+			qDebug() << "failed to read directory entries:" << std::strerror(errno);
+			return false;
+		}
+
+		DIR * dir = ::fdopendir(fd);
+
+		if(!dir) {
+			qDebug() << "failed to read directory entries:" << std::strerror(errno);
+			::close(fd);
+			return false;
+		}
+
+		while(const auto * entry = ::readdir(dir)) {
+			if(isSkipped(entry->d_name)) {
+				continue;
+			}
+
+			if(!fn(entry->d_name, entry->d_type, static_cast<quint64>(entry->d_ino))) {
+				break;
+			}
+		}
+
+		::closedir(dir);
+		return true;
+#endif
+	}
+
+	inline void appendSeparator(QByteArray & path) {
+		if(!path.endsWith('/')) {
+			path.append('/');
+		}
+	}
+
+	/**
+	 * Put a directory's files into disk layout order.
+	 *
+	 * Files whose first page is already in the page cache come first, since reading them costs no I/O. The rest are
+	 * ordered by position - the inode number, or the physical offset of the first extent if that's been asked for and
+	 * the filesystem reports it - so that a rotating disk reads them in (roughly) one sweep.
+	 *
+	 * With noAtime the files are opened the way the scanner opens them when it preserves the page cache, so that finding
+	 * their layout doesn't write their access times.
+	 */
+	void sortByLayout(int dirFd, std::vector<LayoutEntry> & files, ScanOrder order, bool noAtime) {
+		for(auto & file : files) {
+			int fd = ::openat(dirFd, file.name.constData(), ScanQueue::Item::openFlags(file.isSymLink, noAtime));
+
+			// O_NOATIME is only allowed on the scanner's own files, unless it has CAP_FOWNER
+			if(-1 == fd && EPERM == errno && noAtime) {
+				fd = ::openat(dirFd, file.name.constData(), ScanQueue::Item::openFlags(file.isSymLink, false));
+			}
+
+			if(-1 == fd) {
+				continue;
+			}
+
+			file.isCached = DiskLayout::isCached(fd);
+
+			if(ScanOrder::PhysicalOffset == order) {
+				// files without a reported offset keep their inode order, after those that have one
+				auto offset = DiskLayout::physicalOffset(fd);
+				file.position = (offset ? *offset : std::numeric_limits<quint64>::max() / 2 + file.position / 2);
+			}
+
+			::close(fd);
+		}
+
+		std::stable_sort(files.begin(), files.end(), [](const LayoutEntry & lhs, const LayoutEntry & rhs) {
+			if(lhs.isCached != rhs.isCached) {
+				return lhs.isCached;
+			}
+
+			return lhs.position < rhs.position;
+		});
+	}
+}
+
+DirectoryWalker::DirectoryWalker(const std::atomic<bool> & abortFlag, int threadCount)
+: m_abortFlag(abortFlag),
+  m_threadCount(1),
+  m_sorted(false),
+  m_order(ScanOrder::Discovery),
+  m_noAtime(false),
+  m_statFiles(false),
+  m_relaxedStat(false),
+  m_fileHandler(),
+  m_directoryHandler(),
+  m_directoryDoneHandler(),
+  m_directoryFailedHandler(),
+  m_resumeHandler(),
+  m_device(0),
+  m_foreignDirectoryHandler(),
+  m_workers(),
+  m_pendingDirectories(0),
+  m_statCount(0),
+  m_statTime(0),
+  m_visitedDirs() {
+	setThreadCount(threadCount);
+}
+
+/**
+ * Walk the provided directories.
+ *
+ * The calling thread takes part in the walk, along with threadCount() - 1 additional threads. Blocks until every
+ * directory has been read or the abort flag is set. Directories read by an earlier walk() are not read again.
+ */
+void DirectoryWalker::walk(const QStringList & paths) {
+	QList<QByteArray> rawPaths;
+	rawPaths.reserve(paths.size());
+
+	for(const auto & path : paths) {
+		rawPaths.append(QFile::encodeName(path));
+	}
+
+	walk(rawPaths);
+}
+
+/**
+ * Walk the provided directories, given as raw paths in the local 8-bit encoding.
+ */
+void DirectoryWalker::walk(const QList<QByteArray> & paths) {
+	m_workers.clear();
+	m_pendingDirectories = 0;
+
+	for(int idx = 0; idx < m_threadCount; ++idx) {
+		m_workers.push_back(std::make_unique<Worker>());
+	}
+
+	// deal the roots out round-robin so that every thread has something to start on
+	std::size_t workerIdx = 0;
+
+	for(const auto & path : paths) {
+		++m_pendingDirectories;
+		m_workers[workerIdx]->directories.push_back({path});
+		workerIdx = (workerIdx + 1) % m_workers.size();
+	}
+
+	std::vector<std::thread> threads;
+
+	for(std::size_t idx = 1; idx < m_workers.size(); ++idx) {
+		threads.emplace_back(&DirectoryWalker::walkerThread, this, idx);
+	}
+
+	walkerThread(0);
+
+	for(auto & thread : threads) {
+		thread.join();
+	}
+
+	m_workers.clear();
+}
+
+void DirectoryWalker::walkerThread(std::size_t workerIdx) {
+	PendingDirectory dir;
+
+	while(!m_abortFlag) {
+		if(popDirectory(workerIdx, dir) || stealDirectory(workerIdx, dir)) {
+			readDirectory(workerIdx, dir);
+
+			if(0 == --m_pendingDirectories) {
+				m_workAvailable.notify_all();
+				return;
+			}
+
+			continue;
+		}
+
+		if(0 == m_pendingDirectories) {
+			return;
+		}
+
+		std::unique_lock<std::mutex> lock(m_idleLock);
+		m_workAvailable.wait_for(lock, IdleWait);
+	}
+}
+
+/**
+ * Read one directory, passing files to the file handler and queueing subdirectories.
+ *
+ * depth is the level of inline reading - it selects the dirent buffer so that a directory being read inline doesn't
+ * overwrite the entries of the directory that's reading it.
+ */
+void DirectoryWalker::readDirectory(std::size_t workerIdx, const PendingDirectory & dir, std::size_t depth) {
+	// the file handler holds on to this until the files have been scanned
+	const OpenDirectory::Pointer directory = OpenDirectory::open(dir.path, m_directoryDoneHandler);
+
+	if(!directory) {
+		qDebug() << "failed to open directory" << dir.path << ":" << std::strerror(errno);
+		failDirectory(dir.path);
+
+		if(m_directoryDoneHandler) {
+			m_directoryDoneHandler(dir.path);
+		}
+
+		return;
+	}
+
+	const int dirFd = directory->fd();
+	struct stat st{};
+
+	// the directory is reported done when it's released
+	if(0 != ::fstat(dirFd, &st)) {
+		qDebug() << "failed to read the metadata of directory" << dir.path << ":" << std::strerror(errno);
+		failDirectory(dir.path);
+		return;
+	}
+
+	if(m_foreignDirectoryHandler && st.st_dev != m_device) {
+		m_foreignDirectoryHandler(dir.path, st.st_dev);
+		return;
+	}
+
+	// directories are identified by device and inode, which catches symlink loops, bind mounts and any other way of
+	// reaching the same directory twice
+	if(!m_visitedDirs.insert(st.st_dev, st.st_ino)) {
+		return;
+	}
+
+	Worker & worker = *m_workers[workerIdx];
+
+	while(worker.buffers.size() <= depth) {
+		worker.buffers.emplace_back(DirentBufferSize);
+	}
+
+	// subdirectory paths are built by truncating this back to the directory's path and appending the entry name
+	QByteArray path(dir.path);
+	appendSeparator(path);
+	const int pathLength = path.size();
+
+	// files held back for layout ordering
+	std::vector<LayoutEntry> files;
+
+	// the files up to and including this one were dealt with by an earlier walk
+	const QByteArray cursor = (m_resumeHandler && m_sorted && ScanOrder::Discovery == m_order ? m_resumeHandler(dir.path) : QByteArray());
+
+	auto handleFile = [&](const char * name, bool isSymLink) {
+		if(!cursor.isEmpty() && !isNameBefore(cursor, name)) {
+			return;
+		}
+
+		if(!m_statFiles) {
+			m_fileHandler(directory, name, isSymLink, nullptr);
+			return;
+		}
+
+		struct stat fileSt{};
+		const auto statStart = std::chrono::steady_clock::now();
+		const bool isStatted = statEntry(dirFd, name, (isSymLink ? 0 : AT_SYMLINK_NOFOLLOW), fileSt, m_relaxedStat);
+		++m_statCount;
+		m_statTime += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - statStart).count();
+
+		if(!isStatted) {
+			// let the consumer find out what the problem is when it tries to open it
+			m_fileHandler(directory, name, isSymLink, nullptr);
+			return;
+		}
+
+		m_fileHandler(directory, name, isSymLink, &fileSt);
+	};
+
+	auto visitEntry = [&](const char * name, EntryType type, quint64 inode) -> bool {
+		if(m_abortFlag) {
+			return false;
+		}
+
+		switch(type) {
+			case EntryType::File:
+			case EntryType::FileLink:
+				if(ScanOrder::Discovery == m_order) {
+					handleFile(name, EntryType::FileLink == type);
+				}
+				else {
+					files.push_back({QByteArray(name), EntryType::FileLink == type, false, inode});
+				}
+				break;
+
+			case EntryType::Directory:
+			case EntryType::DirectoryLink: {
+				path.truncate(pathLength);
+				path.append(name);
+
+				if(m_directoryHandler && !m_directoryHandler(path)) {
+					break;
+				}
+
+				PendingDirectory subdir{path};
+
+				if(!pushDirectory(workerIdx, subdir)) {
+					readDirectory(workerIdx, subdir, depth + 1);
+				}
+				break;
+			}
+
+			case EntryType::Other:
+				qDebug() << "unknown path" << directory->filePath(name);
+				break;
+		}
+
+		return true;
+	};
+
+	bool isRead;
+
+	if(m_sorted) {
+		std::vector<Entry> entries;
+
+		isRead = readEntries(dirFd, worker.buffers[depth], [&](const char * name, unsigned char dType, quint64 inode) -> bool {
+			entries.push_back({QByteArray(name), entryType(dirFd, name, dType, m_relaxedStat), inode});
+			return !m_abortFlag;
+		});
+
+		std::sort(entries.begin(), entries.end(), [](const Entry & lhs, const Entry & rhs) {
+			const bool lhsIsDir = (EntryType::Directory == lhs.type || EntryType::DirectoryLink == lhs.type);
+			const bool rhsIsDir = (EntryType::Directory == rhs.type || EntryType::DirectoryLink == rhs.type);
+
+			if(lhsIsDir != rhsIsDir) {
+				return lhsIsDir;
+			}
+
+			return isNameBefore(lhs.name, rhs.name);
+		});
+
+		for(const auto & entry : entries) {
+			if(!visitEntry(entry.name.constData(), entry.type, entry.inode)) {
+				break;
+			}
+		}
+	}
+	else {
+		isRead = readEntries(dirFd, worker.buffers[depth], [&](const char * name, unsigned char dType, quint64 inode) -> bool {
+			return visitEntry(name, entryType(dirFd, name, dType, m_relaxedStat), inode);
+		});
+	}
+
+	// the entries that were read are still walked, but the directory mustn't count as finished
+	if(!isRead) {
+		failDirectory(dir.path);
+	}
+
+	if(files.empty() || m_abortFlag) {
+		return;
+	}
+
+	sortByLayout(dirFd, files, m_order, m_noAtime);
+
+	for(const auto & file : files) {
+		if(m_abortFlag) {
+			return;
+		}
+
+		handleFile(file.name.constData(), file.isSymLink);
+	}
+}
+
+bool DirectoryWalker::isNameBefore(const QByteArray & lhs, const QByteArray & rhs) {
+	int order = ::strcasecmp(lhs.constData(), rhs.constData());
+	return (0 != order ? 0 > order : 0 > std::strcmp(lhs.constData(), rhs.constData()));
+}
+
+/**
+ * Tell the failed directory handler, if there is one, that a directory couldn't be read in full.
+ */
+void DirectoryWalker::failDirectory(const QByteArray & path) {
+	if(m_directoryFailedHandler) {
+		m_directoryFailedHandler(path);
+	}
+}
+
+/**
+ * Queue a directory on a worker's deque for it or another worker to read. The directory is only moved from if it's
+ * queued - if the deque is full it's left as it was, for the caller to read itself.
+ */
+bool DirectoryWalker::pushDirectory(std::size_t workerIdx, PendingDirectory & dir) {
+	Worker & worker = *m_workers[workerIdx];
+
+	{
+		std::lock_guard<std::mutex> lock(worker.lock);
+
+		if(MaxQueuedDirectories <= worker.directories.size()) {
+			return false;
+		}
+
+		++m_pendingDirectories;
+		worker.directories.push_back(std::move(dir));
+	}
+
+	m_workAvailable.notify_one();
+	return true;
+}
+
+bool DirectoryWalker::popDirectory(std::size_t workerIdx, PendingDirectory & dir) {
+	Worker & worker = *m_workers[workerIdx];
+	std::lock_guard<std::mutex> lock(worker.lock);
+
+	if(worker.directories.empty()) {
+		return false;
+	}
+
+	dir = std::move(worker.directories.back());
+	worker.directories.pop_back();
+	return true;
+}
+
+bool DirectoryWalker::stealDirectory(std::size_t workerIdx, PendingDirectory & dir) {
+	const std::size_t workerCount = m_workers.size();
+
+	for(std::size_t offset = 1; offset < workerCount; ++offset) {
+		Worker & victim = *m_workers[(workerIdx + offset) % workerCount];
+		std::lock_guard<std::mutex> lock(victim.lock);
+
+		if(victim.directories.empty()) {
+			continue;
+		}
+
+		dir = std::move(victim.directories.front());
+		victim.directories.pop_front();
+		return true;
+	}
+
+	return false;
+}
@@ -0,0 +1,240 @@
+#ifndef QLAM_DIRECTORYWALKER_H
+#define QLAM_DIRECTORYWALKER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include <QtCore/QByteArray>
+#include <QtCore/QList>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+
+#include "fileidentityset.h"
+#include "opendirectory.h"
+#include "scanorder.h"
+#include "scanqueue.h"
+
+namespace Qlam {
+	/**
+	 * Walks a set of directory trees on several threads at once.
+	 *
+	 * Each thread owns a deque of directories waiting to be read. A thread works depth-first from the back of its own
+	 * deque and, when that runs dry, steals from the front of another thread's deque - the front holds the directories
+	 * nearest the root, which are the ones most likely to contain a lot of work. Files are handed to the file handler
+	 * as soon as they are found, so the consumer can start work before the walk has finished.
+	 *
+	 * Each deque is capped; a thread whose deque is full reads the directory inline instead, so memory use is bounded
+	 * by the depth of the tree rather than its size.
+	 *
+	 * Directories are read with getdents64() where it's available. The entry type comes from d_type, so the walker
+	 * only stats entries whose type the filesystem doesn't report, and symlinks. Files are reported as a name relative
+	 * to an OpenDirectory so that they can be opened with openat(); the full path is only built by the consumer when it
+	 * needs to display it.
+	 *
+	 * Other than in ScanOrder::Discovery, a directory's files are held back until the whole directory has been read and
+	 * are then handed over in disk layout order, so that rotating and network storage is read sequentially.
+	 *
+	 * A walker can be confined to one device, so that each device can be walked at its own pace; directories found on
+	 * other devices are handed back to the owner of the walker.
+	 */
+	class DirectoryWalker {
+		public:
+			/* receives the directory containing the file, the file's name, whether the entry is a symlink and, if
+			 * statFiles() is set, the file's metadata (null if it couldn't be read) */
+			using FileHandler = std::function<void(const OpenDirectory::Pointer &, const char *, bool, const struct stat *)>;
+
+			/* receives the path of a directory on another device and the device it's on */
+			using ForeignDirectoryHandler = std::function<void(const QByteArray &, dev_t)>;
+
+			/* receives the path of a subdirectory before it is queued, and returns whether it should be read */
+			using DirectoryHandler = std::function<bool(const QByteArray &)>;
+
+			/* receives the path of a directory that is done with */
+			using DirectoryDoneHandler = std::function<void(const QByteArray &)>;
+
+			/* receives the path of a directory that couldn't be opened or read in full */
+			using DirectoryFailedHandler = std::function<void(const QByteArray &)>;
+
+			/* receives the path of a directory about to be read, and returns the name of the last file in it that has
+			 * already been dealt with - that file and every file before it are skipped. empty to read them all */
+			using ResumeHandler = std::function<QByteArray(const QByteArray &)>;
+
+			explicit DirectoryWalker(const std::atomic<bool> & abortFlag, int threadCount = 1);
+
+			DirectoryWalker(const DirectoryWalker &) = delete;
+			DirectoryWalker & operator=(const DirectoryWalker &) = delete;
+
+			int threadCount() const {
+				return m_threadCount;
+			}
+
+			void setThreadCount(int count) {
+				m_threadCount = (1 > count ? 1 : count);
+			}
+
+			/* whether to visit the entries in each directory in name order (directories first) */
+			bool isSorted() const {
+				return m_sorted;
+			}
+
+			void setSorted(bool sorted) {
+				m_sorted = sorted;
+			}
+
+			/* the order in which the files in each directory are passed to the file handler */
+			ScanOrder order() const {
+				return m_order;
+			}
+
+			void setOrder(ScanOrder order) {
+				m_order = order;
+			}
+
+			/* whether files opened to find their layout are opened with O_NOATIME, so that the walk doesn't write their
+			 * access times - for scans that preserve the page cache */
+			bool noAtime() const {
+				return m_noAtime;
+			}
+
+			void setNoAtime(bool noAtime) {
+				m_noAtime = noAtime;
+			}
+
+			/* whether to stat() each file so that the file handler receives its metadata */
+			bool statFiles() const {
+				return m_statFiles;
+			}
+
+			void setStatFiles(bool stat) {
+				m_statFiles = stat;
+			}
+
+			/* whether entries are stat()ed for only the metadata the scanner uses, accepting what the filesystem has
+			 * cached rather than having it revalidate (statx() with AT_STATX_DONT_SYNC). for network filesystems, where
+			 * revalidating costs a round trip per file. metadata changed on another client may be seen late, as late as
+			 * the filesystem's attribute cache allows */
+			bool isRelaxedStat() const {
+				return m_relaxedStat;
+			}
+
+			void setRelaxedStat(bool relaxed) {
+				m_relaxedStat = relaxed;
+			}
+
+			/* how many files the walk has stat()ed for the file handler, and the ns it spent doing so */
+			quint64 statCount() const {
+				return m_statCount;
+			}
+
+			qint64 statTime() const {
+				return m_statTime;
+			}
+
+			/* called from the walker threads, possibly concurrently, for each file found */
+			void setFileHandler(FileHandler handler) {
+				m_fileHandler = std::move(handler);
+			}
+
+			/* called from the walker threads, possibly concurrently, for each subdirectory found. a subdirectory for which
+			 * the handler returns false is skipped without being opened */
+			void setDirectoryHandler(DirectoryHandler handler) {
+				m_directoryHandler = std::move(handler);
+			}
+
+			/* called, possibly concurrently, for each directory the walk has finished reading once the file handler's
+			 * consumer has released every file found in it - from whichever thread releases the last one. a directory
+			 * on another device is reported once here after it is handed to the foreign directory handler, and again by
+			 * the walk it is handed to */
+			void setDirectoryDoneHandler(DirectoryDoneHandler handler) {
+				m_directoryDoneHandler = std::move(handler);
+			}
+
+			/* called from the walker threads, possibly concurrently, for each directory that couldn't be opened or read
+			 * in full. it is called before the directory is reported done */
+			void setDirectoryFailedHandler(DirectoryFailedHandler handler) {
+				m_directoryFailedHandler = std::move(handler);
+			}
+
+			/* called from the walker threads, possibly concurrently, for each directory read. only used by a sorted walk
+			 * in discovery order, which is the only one that hands out each directory's files in name order */
+			void setResumeHandler(ResumeHandler handler) {
+				m_resumeHandler = std::move(handler);
+			}
+
+			/* whether one file name comes before another in a sorted walk */
+			static bool isNameBefore(const QByteArray &, const QByteArray &);
+
+			/* with a foreign directory handler set, only directories on device() are read - directories on other
+			 * devices are passed to the handler instead. called from the walker threads, possibly concurrently */
+			dev_t device() const {
+				return m_device;
+			}
+
+			void setForeignDirectoryHandler(dev_t device, ForeignDirectoryHandler handler) {
+				m_device = device;
+				m_foreignDirectoryHandler = std::move(handler);
+			}
+
+			void walk(const QStringList &);
+			void walk(const QList<QByteArray> &);
+
+		private:
+			struct PendingDirectory {
+				// the path through which the directory was reached
+				QByteArray path;
+			};
+
+			struct Worker {
+				std::mutex lock;
+				std::deque<PendingDirectory> directories;
+
+				// one dirent buffer for each level of inline reading, reused from directory to directory. a deque so that
+				// adding a level doesn't move the buffers of the levels being read
+				std::deque<std::vector<char>> buffers;
+			};
+
+			void walkerThread(std::size_t);
+			void readDirectory(std::size_t, const PendingDirectory &, std::size_t depth = 0);
+			void failDirectory(const QByteArray &);
+			bool pushDirectory(std::size_t, PendingDirectory &);
+			bool popDirectory(std::size_t, PendingDirectory &);
+			bool stealDirectory(std::size_t, PendingDirectory &);
+
+			const std::atomic<bool> & m_abortFlag;
+			int m_threadCount;
+			bool m_sorted;
+			ScanOrder m_order;
+			bool m_noAtime;
+			bool m_statFiles;
+			bool m_relaxedStat;
+			FileHandler m_fileHandler;
+			DirectoryHandler m_directoryHandler;
+			DirectoryDoneHandler m_directoryDoneHandler;
+			DirectoryFailedHandler m_directoryFailedHandler;
+			ResumeHandler m_resumeHandler;
+			dev_t m_device;
+			ForeignDirectoryHandler m_foreignDirectoryHandler;
+			std::vector<std::unique_ptr<Worker>> m_workers;
+
+			// directories that are queued or being read; the walk is over when this reaches 0
+			std::atomic<int> m_pendingDirectories;
+			std::mutex m_idleLock;
+			std::condition_variable m_workAvailable;
+
+			std::atomic<quint64> m_statCount;
+			std::atomic<qint64> m_statTime;
+
+			// the (device, inode) of each directory read, so that symlink loops and bind mounts are only walked once.
+			// kept from one walk() to the next
+			FileIdentitySet m_visitedDirs;
+	};
+}
+
+#endif // QLAM_DIRECTORYWALKER_H
@@ -0,0 +1,144 @@
+#include "disklayout.h"
+
+#include <cerrno>
+#include <vector>
+
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#if defined(Q_OS_LINUX)
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
+
+using namespace Qlam;
+
+// files with more extents than this aren't worth comparing by extent map
+static constexpr const quint32 MaxSharedExtents = 1024;
+
+/**
+ * The physical offset on the device of the start of a file's data.
+ *
+ * Returns nothing if the filesystem doesn't support FIEMAP or the file has no mapped extents (e.g. it's empty or its
+ * data is stored inline).
+ */
+std::optional<quint64> DiskLayout::physicalOffset(int fd) {
+#if defined(Q_OS_LINUX)
+	// room for the header and a single extent - only the first extent is wanted
+	alignas(struct fiemap) char buffer[sizeof(struct fiemap) + sizeof(struct fiemap_extent)] = {};
+	auto * map = reinterpret_cast<struct fiemap *>(buffer);
+	map->fm_start = 0;
+	map->fm_length = FIEMAP_MAX_OFFSET;
+	map->fm_extent_count = 1;
+
+	if(0 != ::ioctl(fd, FS_IOC_FIEMAP, map) || 0 == map->fm_mapped_extents) {
+		return {};
+	}
+
+	return static_cast<quint64>(map->fm_extents[0].fe_physical);
+#else
+	Q_UNUSED(fd);
+	return {};
+#endif
+}
+
+/**
+ * Check whether the start of a file is in the page cache.
+ *
+ * Uses a one-byte preadv2() with RWF_NOWAIT, which fails with EAGAIN rather than going to the device. Where that isn't
+ * supported, maps the first page and asks mincore().
+ */
+bool DiskLayout::isCached(int fd) {
+#if defined(Q_OS_LINUX) && defined(RWF_NOWAIT)
+	char byte;
+	struct iovec iov{&byte, 1};
+	ssize_t ret = ::preadv2(fd, &iov, 1, 0, RWF_NOWAIT);
+
+	if(0 <= ret) {
+		return true;
+	}
+
+	if(EAGAIN == errno) {
+		return false;
+	}
+#endif
+
+	const long pageSize = ::sysconf(_SC_PAGESIZE);
+	void * addr = ::mmap(nullptr, static_cast<std::size_t>(pageSize), PROT_READ, MAP_SHARED, fd, 0);
+
+	if(MAP_FAILED == addr) {
+		return false;
+	}
+
+	unsigned char resident = 0;
+	bool cached = (0 == ::mincore(addr, static_cast<std::size_t>(pageSize), &resident) && (resident & 1));
+	::munmap(addr, static_cast<std::size_t>(pageSize));
+	return cached;
+}
+
+/**
+ * The extent map of a file whose data is entirely shared with other files (e.g. reflinked copies on btrfs or XFS).
+ *
+ * Two files on the same device with the same size and the same extent map have the same content. The map is only
+ * returned if every extent is marked shared and refers to data that is on the device - delayed allocation, inline
+ * data and the like make the physical locations meaningless. Dirty data is written back first so that a copy that has
+ * been changed but not yet flushed doesn't appear to still share its extents.
+ *
+ * Returns an empty array if the file doesn't qualify or the filesystem doesn't support FIEMAP.
+ */
+QByteArray DiskLayout::sharedExtentMap(int fd) {
+#if defined(Q_OS_LINUX)
+	struct fiemap query{};
+	query.fm_start = 0;
+	query.fm_length = FIEMAP_MAX_OFFSET;
+	query.fm_flags = FIEMAP_FLAG_SYNC;
+	query.fm_extent_count = 0;
+
+	// with no room for extents, FIEMAP just counts them
+	if(0 != ::ioctl(fd, FS_IOC_FIEMAP, &query) || 0 == query.fm_mapped_extents || MaxSharedExtents < query.fm_mapped_extents) {
+		return {};
+	}
+
+	const quint32 extentCount = query.fm_mapped_extents;
+	std::vector<quint64> buffer((sizeof(struct fiemap) + extentCount * sizeof(struct fiemap_extent) + sizeof(quint64) - 1) / sizeof(quint64), 0);
+	auto * map = reinterpret_cast<struct fiemap *>(buffer.data());
+	map->fm_start = 0;
+	map->fm_length = FIEMAP_MAX_OFFSET;
+	map->fm_flags = FIEMAP_FLAG_SYNC;
+	map->fm_extent_count = extentCount;
+
+	if(0 != ::ioctl(fd, FS_IOC_FIEMAP, map) || 0 == map->fm_mapped_extents) {
+		return {};
+	}
+
+	// if the file has grown since the count, the map is incomplete
+	if(0 == (map->fm_extents[map->fm_mapped_extents - 1].fe_flags & FIEMAP_EXTENT_LAST)) {
+		return {};
+	}
+
+	// an encoded (e.g. compressed) extent's physical address is that of the whole extent, whatever part of it the file
+	// uses, so two files with the same map can still hold different data
+	static constexpr const quint32 Unusable = FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_DELALLOC | FIEMAP_EXTENT_ENCODED | FIEMAP_EXTENT_DATA_ENCRYPTED | FIEMAP_EXTENT_DATA_INLINE | FIEMAP_EXTENT_DATA_TAIL | FIEMAP_EXTENT_NOT_ALIGNED | FIEMAP_EXTENT_UNWRITTEN;
+	QByteArray extents;
+	extents.reserve(static_cast<int>(map->fm_mapped_extents * 3 * sizeof(quint64)));
+
+	for(quint32 idx = 0; idx < map->fm_mapped_extents; ++idx) {
+		const struct fiemap_extent & extent = map->fm_extents[idx];
+
+		if(0 == (extent.fe_flags & FIEMAP_EXTENT_SHARED) || 0 != (extent.fe_flags & Unusable)) {
+			return {};
+		}
+
+		extents.append(reinterpret_cast<const char *>(&extent.fe_logical), sizeof(extent.fe_logical));
+		extents.append(reinterpret_cast<const char *>(&extent.fe_physical), sizeof(extent.fe_physical));
+		extents.append(reinterpret_cast<const char *>(&extent.fe_length), sizeof(extent.fe_length));
+	}
+
+	return extents;
+#else
+	Q_UNUSED(fd);
+	return {};
+#endif
+}
@@ -0,0 +1,26 @@
+#ifndef QLAM_DISKLAYOUT_H
+#define QLAM_DISKLAYOUT_H
+
+#include <optional>
+
+#include <QtGlobal>
+#include <QtCore/QByteArray>
+
+namespace Qlam {
+	/**
+	 * Queries about where a file's data lives.
+	 *
+	 * Used to order scans so that rotating and network storage is read as sequentially as possible, with files that
+	 * are already in the page cache taken first, and to recognise files that share their data with other files.
+	 */
+	class DiskLayout {
+		public:
+			DiskLayout() = delete;
+
+			static std::optional<quint64> physicalOffset(int fd);
+			static bool isCached(int fd);
+			static QByteArray sharedExtentMap(int fd);
+	};
+}
+
+#endif // QLAM_DISKLAYOUT_H
@@ -0,0 +1,112 @@
+#include "fileidentityset.h"
+
+using namespace Qlam;
+
+namespace {
+	// shard tables are grown when they become more than half full, which keeps probe sequences short
+	inline bool needsToGrow(std::size_t count, std::size_t capacity) {
+		return (count + 1) * 2 > capacity;
+	}
+
+	std::size_t roundUpToPowerOfTwo(std::size_t value) {
+		std::size_t ret = 16;
+
+		while(ret < value) {
+			ret <<= 1;
+		}
+
+		return ret;
+	}
+}
+
+FileIdentitySet::FileIdentitySet(std::size_t capacity)
+: m_shardCapacity(roundUpToPowerOfTwo(capacity / ShardCount)),
+  m_shards() {
+	clear();
+}
+
+/**
+ * Mix the device and inode numbers (splitmix64 finaliser).
+ *
+ * Inode numbers are often sequential, so the bits need spreading before they're used to pick a shard and a slot.
+ */
+quint64 FileIdentitySet::hash(quint64 device, quint64 inode) {
+	quint64 value = inode ^ (device * 0x9e3779b97f4a7c15ULL);
+	value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+	return value ^ (value >> 31);
+}
+
+/**
+ * Find the slot that holds an identity, or the empty slot where it would go.
+ *
+ * The table is never full, so this always terminates.
+ */
+std::size_t FileIdentitySet::findSlot(const std::vector<Slot> & slots, quint64 hash, quint64 device, quint64 inode) {
+	const std::size_t mask = slots.size() - 1;
+	std::size_t idx = static_cast<std::size_t>(hash) & mask;
+
+	while(slots[idx].used && (slots[idx].device != device || slots[idx].inode != inode)) {
+		idx = (idx + 1) & mask;
+	}
+
+	return idx;
+}
+
+void FileIdentitySet::grow(Shard & shard) {
+	std::vector<Slot> slots(shard.slots.size() * 2, Slot{0, 0, false});
+
+	for(const auto & slot : shard.slots) {
+		if(slot.used) {
+			slots[findSlot(slots, hash(slot.device, slot.inode), slot.device, slot.inode)] = slot;
+		}
+	}
+
+	shard.slots.swap(slots);
+}
+
+bool FileIdentitySet::insert(quint64 device, quint64 inode) {
+	const quint64 h = hash(device, inode);
+	Shard & shard = m_shards[h >> 60];
+	std::lock_guard<std::mutex> lock(shard.lock);
+	std::size_t idx = findSlot(shard.slots, h, device, inode);
+
+	if(shard.slots[idx].used) {
+		return false;
+	}
+
+	if(needsToGrow(shard.count, shard.slots.size())) {
+		grow(shard);
+		idx = findSlot(shard.slots, h, device, inode);
+	}
+
+	shard.slots[idx] = {device, inode, true};
+	++shard.count;
+	return true;
+}
+
+bool FileIdentitySet::contains(quint64 device, quint64 inode) const {
+	const quint64 h = hash(device, inode);
+	const Shard & shard = m_shards[h >> 60];
+	std::lock_guard<std::mutex> lock(shard.lock);
+	return shard.slots[findSlot(shard.slots, h, device, inode)].used;
+}
+
+std::size_t FileIdentitySet::count() const {
+	std::size_t ret = 0;
+
+	for(const auto & shard : m_shards) {
+		std::lock_guard<std::mutex> lock(shard.lock);
+		ret += shard.count;
+	}
+
+	return ret;
+}
+
+void FileIdentitySet::clear() {
+	for(auto & shard : m_shards) {
+		std::lock_guard<std::mutex> lock(shard.lock);
+		shard.slots.assign(m_shardCapacity, Slot{0, 0, false});
+		shard.count = 0;
+	}
+}
@@ -0,0 +1,57 @@
+#ifndef QLAM_FILEIDENTITYSET_H
+#define QLAM_FILEIDENTITYSET_H
+
+#include <array>
+#include <mutex>
+#include <vector>
+
+#include <QtGlobal>
+
+namespace Qlam {
+	/**
+	 * A set of file identities - (st_dev, st_ino) pairs.
+	 *
+	 * Used to detect directories that have already been walked (symlink loops, bind mounts) and files that have
+	 * already been scanned through another hard link. Identities are spread across a fixed number of shards, each an
+	 * open-addressing hash table with linear probing behind its own lock, so lookups are O(1) and threads walking
+	 * different parts of a tree rarely contend.
+	 */
+	class FileIdentitySet {
+		public:
+			explicit FileIdentitySet(std::size_t capacity = DefaultCapacity);
+
+			FileIdentitySet(const FileIdentitySet &) = delete;
+			FileIdentitySet & operator=(const FileIdentitySet &) = delete;
+
+			/* returns true if the identity was added, false if it was already in the set */
+			bool insert(quint64 device, quint64 inode);
+			bool contains(quint64 device, quint64 inode) const;
+			std::size_t count() const;
+			void clear();
+
+		private:
+			static constexpr const std::size_t DefaultCapacity = 4096;
+			static constexpr const std::size_t ShardCount = 16;
+
+			struct Slot {
+				quint64 device;
+				quint64 inode;
+				bool used;
+			};
+
+			struct Shard {
+				mutable std::mutex lock;
+				std::vector<Slot> slots;
+				std::size_t count = 0;
+			};
+
+			static quint64 hash(quint64 device, quint64 inode);
+			static std::size_t findSlot(const std::vector<Slot> &, quint64 hash, quint64 device, quint64 inode);
+			static void grow(Shard &);
+
+			std::size_t m_shardCapacity;
+			std::array<Shard, ShardCount> m_shards;
+	};
+}
+
+#endif // QLAM_FILEIDENTITYSET_H
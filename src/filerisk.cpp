@@ -0,0 +1,97 @@
+#include "filerisk.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <strings.h>
+
+using namespace Qlam;
+
+// the points for a file's type are far enough apart that nothing else can move it into another type's range
+static constexpr const quint32 TypePoints = 1000;
+
+// the points for how recently the file changed, and for how long it's been since it was last found clean, each lose
+// this many per doubling of the age in minutes
+static constexpr const double PointsPerDoubling = 25.0;
+static constexpr const double MaxAgePoints = 499.0;
+
+namespace {
+	struct Extension {
+		const char * suffix;
+		FileRisk::Type type;
+	};
+
+	constexpr const Extension Extensions[] = {
+		{"exe", FileRisk::Type::Executable}, {"dll", FileRisk::Type::Executable}, {"sys", FileRisk::Type::Executable},
+		{"scr", FileRisk::Type::Executable}, {"com", FileRisk::Type::Executable}, {"cpl", FileRisk::Type::Executable},
+		{"ocx", FileRisk::Type::Executable}, {"msi", FileRisk::Type::Executable}, {"efi", FileRisk::Type::Executable},
+		{"so", FileRisk::Type::Executable}, {"ko", FileRisk::Type::Executable}, {"elf", FileRisk::Type::Executable},
+		{"bin", FileRisk::Type::Executable}, {"apk", FileRisk::Type::Executable}, {"dex", FileRisk::Type::Executable},
+		{"jar", FileRisk::Type::Executable}, {"class", FileRisk::Type::Executable}, {"appimage", FileRisk::Type::Executable},
+
+		{"sh", FileRisk::Type::Script}, {"bash", FileRisk::Type::Script}, {"zsh", FileRisk::Type::Script},
+		{"py", FileRisk::Type::Script}, {"pl", FileRisk::Type::Script}, {"rb", FileRisk::Type::Script},
+		{"php", FileRisk::Type::Script}, {"lua", FileRisk::Type::Script}, {"js", FileRisk::Type::Script},
+		{"jse", FileRisk::Type::Script}, {"vbs", FileRisk::Type::Script}, {"vbe", FileRisk::Type::Script},
+		{"wsf", FileRisk::Type::Script}, {"wsh", FileRisk::Type::Script}, {"hta", FileRisk::Type::Script},
+		{"ps1", FileRisk::Type::Script}, {"psm1", FileRisk::Type::Script}, {"bat", FileRisk::Type::Script},
+		{"cmd", FileRisk::Type::Script}, {"desktop", FileRisk::Type::Script},
+
+		{"doc", FileRisk::Type::Document}, {"docx", FileRisk::Type::Document}, {"docm", FileRisk::Type::Document},
+		{"dot", FileRisk::Type::Document}, {"dotm", FileRisk::Type::Document}, {"xls", FileRisk::Type::Document},
+		{"xlsx", FileRisk::Type::Document}, {"xlsm", FileRisk::Type::Document}, {"xlsb", FileRisk::Type::Document},
+		{"xlt", FileRisk::Type::Document}, {"ppt", FileRisk::Type::Document}, {"pptx", FileRisk::Type::Document},
+		{"pptm", FileRisk::Type::Document}, {"pdf", FileRisk::Type::Document}, {"rtf", FileRisk::Type::Document},
+		{"odt", FileRisk::Type::Document}, {"ods", FileRisk::Type::Document}, {"odp", FileRisk::Type::Document},
+		{"one", FileRisk::Type::Document}, {"chm", FileRisk::Type::Document}, {"lnk", FileRisk::Type::Document},
+		{"eml", FileRisk::Type::Document}, {"msg", FileRisk::Type::Document}, {"htm", FileRisk::Type::Document},
+		{"html", FileRisk::Type::Document}, {"svg", FileRisk::Type::Document},
+
+		{"zip", FileRisk::Type::Archive}, {"rar", FileRisk::Type::Archive}, {"7z", FileRisk::Type::Archive},
+		{"gz", FileRisk::Type::Archive}, {"tgz", FileRisk::Type::Archive}, {"bz2", FileRisk::Type::Archive},
+		{"xz", FileRisk::Type::Archive}, {"tar", FileRisk::Type::Archive}, {"cab", FileRisk::Type::Archive},
+		{"iso", FileRisk::Type::Archive}, {"img", FileRisk::Type::Archive}, {"dmg", FileRisk::Type::Archive},
+		{"arj", FileRisk::Type::Archive}, {"lzh", FileRisk::Type::Archive}, {"cpio", FileRisk::Type::Archive},
+	};
+
+	// fewer points the older something is
+	double agePoints(qint64 ageNs) {
+		const double minutes = static_cast<double>(std::max<qint64>(0, ageNs)) / 60e9;
+		return std::max(0.0, MaxAgePoints - PointsPerDoubling * std::log2(1.0 + minutes));
+	}
+
+	qint64 nanoseconds(const struct timespec & time) {
+		return static_cast<qint64>(time.tv_sec) * 1000000000 + time.tv_nsec;
+	}
+}
+
+FileRisk::Type FileRisk::type(const char * name, const struct stat * st) {
+	const char * dot = std::strrchr(name, '.');
+
+	if(dot && dot != name) {
+		for(const auto & extension : Extensions) {
+			if(0 == ::strcasecmp(dot + 1, extension.suffix)) {
+				return extension.type;
+			}
+		}
+	}
+
+	if(st && S_ISREG(st->st_mode) && 0 != (st->st_mode & (S_IXUSR | S_IXGRP | S_IXOTH))) {
+		return Type::Executable;
+	}
+
+	return Type::Other;
+}
+
+quint32 FileRisk::score(Type type, const struct stat * st, qint64 cleanTime, qint64 now) {
+	double points = static_cast<double>(static_cast<quint32>(type) * TypePoints);
+
+	if(st) {
+		// recently changed first
+		points += agePoints(now - std::max(nanoseconds(st->st_mtim), nanoseconds(st->st_ctim)));
+	}
+
+	// longest since it was last found clean first - never is longest of all
+	points += (0 > cleanTime ? MaxAgePoints : MaxAgePoints - agePoints(now - cleanTime));
+	return static_cast<quint32>(points);
+}
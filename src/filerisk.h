@@ -0,0 +1,40 @@
+#ifndef QLAM_FILERISK_H
+#define QLAM_FILERISK_H
+
+#include <sys/stat.h>
+
+#include <QtGlobal>
+
+namespace Qlam {
+	/**
+	 * Ranks files by how much there is to gain from scanning them first, for scans that won't have time for everything.
+	 *
+	 * The type of file matters most - executables, then scripts, then documents that can carry macros or exploits,
+	 * then archives that may contain any of these - and is taken from the name, or from the execute permission. Files
+	 * of the same type are ranked by how recently they changed and by how long it has been since the scan cache last
+	 * saw them clean, each on a log scale so that the difference between a minute and an hour counts for as much as
+	 * the difference between a day and a month.
+	 */
+	class FileRisk {
+		public:
+			enum class Type {
+				Other = 0,
+				Archive,
+				Document,
+				Script,
+				Executable,
+			};
+
+			static constexpr const int TypeCount = 5;
+
+			/* the file's metadata is optional */
+			static Type type(const char * name, const struct stat *);
+
+			/* higher is riskier. cleanTime is when the version of the file the scan cache last found clean was made,
+			 * in ns since the epoch - negative if it has never been found clean. all of the file's metadata and cleanTime
+			 * are optional */
+			static quint32 score(Type, const struct stat *, qint64 cleanTime, qint64 now);
+	};
+}
+
+#endif // QLAM_FILERISK_H
@@ -22,9 +22,22 @@
 
 using namespace Qlam;
 
+namespace {
+	// copy the scan mode and its parameters from one profile to another
+	void setScanMode(ScanProfile & profile, const ScanProfile & from) {
+		profile.setScanMode(from.scanMode());
+		profile.setScrubPeriod(from.scrubPeriod());
+		profile.setSliceDuration(from.sliceDuration());
+		profile.setSliceSize(from.sliceSize());
+		profile.setDeadline(from.deadline());
+	}
+}
+
 MainWindow::MainWindow(QWidget * parent)
 :   QMainWindow(parent),
-    m_ui(std::make_unique<Ui::MainWindow>())
+    m_ui(std::make_unique<Ui::MainWindow>()),
+    m_blockedFileMessage(nullptr),
+    m_blockedFileCount(0)
 {
 	m_ui->setupUi(this);
     setAcceptDrops(true);
@@ -46,6 +59,9 @@ MainWindow::MainWindow(QWidget * parent)
 	connect(m_ui->scanWidget, &ScanWidget::scanStarted, this, &MainWindow::slotDisableBackButton);
 	connect(m_ui->scanWidget, &ScanWidget::scanFinished, this, &MainWindow::slotEnableBackButton);
 	connect(Application::instance(), qOverload<int>(&Application::scanProfileAdded), this,  &MainWindow::slotScanProfileAdded);
+
+	// emitted from the on-access scanner's workers, so queued
+	connect(qlamApp->onAccessScanner(), &OnAccessScanner::fileBlocked, this, &MainWindow::slotOnAccessFileBlocked, Qt::QueuedConnection);
 }
 
 MainWindow::~MainWindow() = default;
@@ -133,6 +149,7 @@ void MainWindow::slotSaveProfileButtonClicked() {
 		if(ok && !name.isEmpty()) {
 			auto * profile = new ScanProfile(name);
 			profile->setPaths(m_ui->scanWidget->scanPaths());
+			setScanMode(*profile, m_ui->scanWidget->scanProfile());
 			Application::instance()->addScanProfile(profile);
 		}
 	}
@@ -142,6 +159,9 @@ void MainWindow::slotSaveProfileButtonClicked() {
 		if(profile) {
 			profile->clearPaths();
 			profile->setPaths(m_ui->scanWidget->scanPaths());
+			setScanMode(*profile, m_ui->scanWidget->scanProfile());
+			m_ui->scanWidget->setSavedScanProfile(*profile);
+			qlamApp->updateChangeJournal();
 		}
 	}
 }
@@ -180,6 +200,37 @@ void MainWindow::slotEnableBackButton() {
 	m_ui->scanBack->setEnabled(true);
 }
 
+/**
+ * Tell the user that an infected file was kept from being opened.
+ *
+ * A program that keeps retrying, or a folder full of infected files, can have many opens blocked at once, so rather
+ * than a message for each the one message is kept up to date until it's dismissed.
+ */
+void MainWindow::slotOnAccessFileBlocked(const QString & path, const QString & virusName) {
+	if(!m_blockedFileMessage) {
+		m_blockedFileMessage = new QMessageBox(QMessageBox::Warning, tr("Infected file blocked"), QString(), QMessageBox::Ok, this);
+		m_blockedFileMessage->setWindowModality(Qt::NonModal);
+
+		connect(m_blockedFileMessage, &QMessageBox::finished, this, [this]() {
+			m_blockedFileMessage->deleteLater();
+			m_blockedFileMessage = nullptr;
+			m_blockedFileCount = 0;
+		});
+	}
+
+	++m_blockedFileCount;
+
+	if(1 == m_blockedFileCount) {
+		m_blockedFileMessage->setText(tr("%1 was not allowed to open because it is infected with %2.").arg(path, virusName));
+	}
+	else {
+		m_blockedFileMessage->setText(tr("%1 infected files were not allowed to open. The last was %2, which is infected with %3.").arg(m_blockedFileCount).arg(path, virusName));
+	}
+
+	m_blockedFileMessage->show();
+	m_blockedFileMessage->raise();
+}
+
 void MainWindow::dragEnterEvent(QDragEnterEvent * event) {
     if(QList<QUrl> urls = event->mimeData()->urls(); std::any_of(urls.cbegin(), urls.cend(), [](const QUrl & url) {
         return !url.toLocalFile().isEmpty();
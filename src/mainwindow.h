@@ -4,6 +4,7 @@
 #include <QtGlobal>
 #include <QtWidgets/QMainWindow>
 
+class QMessageBox;
 class QStackedWidget;
 class QToolButton;
 
@@ -49,12 +50,17 @@ namespace Qlam {
 			void syncScanBackButtonWithStack();
 			void slotDisableBackButton();
 			void slotEnableBackButton();
+			void slotOnAccessFileBlocked(const QString & path, const QString & virusName);
 
 		private:
 			void readWindowSettings();
 			void writeWindowSettings() const;
 
 			std::unique_ptr<Ui::MainWindow> m_ui;
+
+			// tells the user about files the on-access scanner has blocked - one message, updated as more are blocked
+			QMessageBox * m_blockedFileMessage;
+			int m_blockedFileCount;
 //			QStackedWidget * m_scanStack;
 //			QToolButton * m_scanBackButton;
 //			ScanWidget * m_scanWidget;
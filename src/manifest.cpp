@@ -0,0 +1,407 @@
+#include "manifest.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <unistd.h>
+
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QDateTime>
+#include <QtCore/QDebug>
+#include <QtCore/QDir>
+#include <QtCore/QFileInfo>
+#include <QtCore/QProcess>
+#include <QtCore/QSaveFile>
+#include <QtCore/QStandardPaths>
+
+using namespace Qlam;
+
+// identifies a manifest file, and the version of its layout
+static constexpr const char FileMagic[8] = {'Q', 'L', 'A', 'M', 'K', 'G', 'M', '1'};
+
+// where dpkg keeps each package's *.md5sums, and the file it rewrites whenever a package is installed or removed
+static constexpr const char * DpkgInfoDir = "/var/lib/dpkg/info";
+static constexpr const char * DpkgStatusFile = "/var/lib/dpkg/status";
+
+// the rpm database, in the formats used by the various rpm versions
+static constexpr const char * RpmDatabaseFiles[] = {
+	"/var/lib/rpm/rpmdb.sqlite",
+	"/var/lib/rpm/Packages.db",
+	"/var/lib/rpm/Packages",
+};
+
+// how much of a file is read at a time while hashing it
+static constexpr const std::size_t HashBlockSize = 1024 * 1024;
+
+namespace {
+	// the file starts with this, followed by the table of entries
+	struct Header {
+		char magic[8];
+
+		// identifies the set of sources the table was built from
+		char sourcesDigest[32];
+		quint64 entryCount;
+	};
+
+	bool isBefore(const Manifest::Entry & lhs, const Manifest::Entry & rhs) {
+		return lhs.pathHash < rhs.pathHash;
+	}
+
+	QCryptographicHash::Algorithm hashAlgorithm(Manifest::Algorithm algorithm) {
+		return Manifest::Algorithm::Md5 == algorithm ? QCryptographicHash::Md5 : QCryptographicHash::Sha256;
+	}
+
+	// returns an empty array if the file can't be read
+	QByteArray fileDigest(int fd, Manifest::Algorithm algorithm) {
+		thread_local std::vector<char> buffer(HashBlockSize);
+		QCryptographicHash hash(hashAlgorithm(algorithm));
+		off_t offset = 0;
+
+		while(true) {
+			ssize_t bytesRead = ::pread(fd, buffer.data(), buffer.size(), offset);
+
+			if(0 > bytesRead) {
+				if(EINTR == errno) {
+					continue;
+				}
+
+				return {};
+			}
+
+			if(0 == bytesRead) {
+				break;
+			}
+
+			hash.addData(buffer.data(), static_cast<int>(bytesRead));
+			offset += bytesRead;
+		}
+
+		return hash.result();
+	}
+}
+
+Manifest::Manifest(QString path)
+: m_path(std::move(path)),
+  m_file(),
+  m_entries(nullptr),
+  m_entryCount(0) {
+}
+
+Manifest::~Manifest() {
+	close();
+}
+
+QString Manifest::defaultPath() {
+	return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + QStringLiteral("/manifest");
+}
+
+quint64 Manifest::pathHash(const QByteArray & path) {
+	quint64 hash = 0;
+	std::memcpy(&hash, QCryptographicHash::hash(path, QCryptographicHash::Blake2b_256).constData(), sizeof(hash));
+	return hash;
+}
+
+/**
+ * The files the manifest is built from that exist on this system.
+ */
+QStringList Manifest::sources(const QStringList & manifestFiles) {
+	QStringList ret;
+
+	if(QFileInfo::exists(DpkgStatusFile)) {
+		ret.append(DpkgStatusFile);
+	}
+
+	for(const auto * rpmDatabase : RpmDatabaseFiles) {
+		if(QFileInfo::exists(rpmDatabase)) {
+			ret.append(rpmDatabase);
+			break;
+		}
+	}
+
+	for(const auto & manifestFile : manifestFiles) {
+		ret.append(QFileInfo(manifestFile).absoluteFilePath());
+	}
+
+	ret.sort();
+	ret.removeDuplicates();
+	return ret;
+}
+
+/**
+ * Add the digest listed for a path.
+ *
+ * Paths are taken as relative to the root, as dpkg lists them, unless they're absolute. Digests that aren't MD5 or
+ * SHA-256, and the all-zero digests rpm gives for files with no content of their own, are skipped.
+ */
+void Manifest::addEntry(std::vector<Entry> & entries, QByteArray path, const QByteArray & hexDigest) {
+	const QByteArray digest = QByteArray::fromHex(hexDigest);
+	Entry entry{};
+
+	if(16 == digest.size()) {
+		entry.algorithm = Algorithm::Md5;
+	}
+	else if(32 == digest.size()) {
+		entry.algorithm = Algorithm::Sha256;
+	}
+	else {
+		return;
+	}
+
+	if(digest.count('\0') == digest.size()) {
+		return;
+	}
+
+	if(path.startsWith("./")) {
+		path.remove(0, 1);
+	}
+	else if(!path.startsWith('/')) {
+		path.prepend('/');
+	}
+
+	entry.pathHash = pathHash(path);
+	entry.digestLength = static_cast<quint32>(digest.size());
+	std::memcpy(entry.digest, digest.constData(), static_cast<std::size_t>(digest.size()));
+	entries.push_back(entry);
+}
+
+void Manifest::importDpkg(std::vector<Entry> & entries) {
+	const auto md5sumsFiles = QDir(DpkgInfoDir).entryInfoList(QStringList() << QStringLiteral("*.md5sums"), QDir::Files);
+
+	for(const auto & md5sumsFile : md5sumsFiles) {
+		importDigestFile(entries, md5sumsFile.absoluteFilePath());
+	}
+}
+
+/**
+ * Import the digests of the files of every installed rpm package.
+ *
+ * rpm's --dump output has the path followed by 10 fields, the third of them the digest and the fourth the mode. The
+ * path may contain spaces, so the line is split from the end.
+ */
+void Manifest::importRpm(std::vector<Entry> & entries) {
+	QProcess rpm;
+	rpm.start(QStringLiteral("rpm"), QStringList() << QStringLiteral("-qa") << QStringLiteral("--dump"));
+
+	if(!rpm.waitForStarted() || !rpm.waitForFinished(-1) || QProcess::NormalExit != rpm.exitStatus()) {
+qDebug() << "failed to read the rpm database";
+		return;
+	}
+
+	const auto lines = rpm.readAllStandardOutput().split('\n');
+
+	for(const auto & line : lines) {
+		auto fields = line.split(' ');
+
+		if(11 > fields.size()) {
+			continue;
+		}
+
+		// regular files only
+		const QByteArray mode = fields.at(fields.size() - 7);
+
+		if(!mode.startsWith("0100") && !mode.startsWith("100")) {
+			continue;
+		}
+
+		const QByteArray digest = fields.at(fields.size() - 8);
+		fields.erase(fields.end() - 10, fields.end());
+		addEntry(entries, fields.join(' '), digest);
+	}
+}
+
+/**
+ * Import a file of "digest  path" lines, as written by md5sum and sha256sum and as dpkg keeps them.
+ */
+void Manifest::importDigestFile(std::vector<Entry> & entries, const QString & fileName) {
+	QFile file(fileName);
+
+	if(!file.open(QIODevice::ReadOnly)) {
+qDebug() << "failed to read manifest" << fileName;
+		return;
+	}
+
+	while(!file.atEnd()) {
+		QByteArray line = file.readLine();
+
+		if(line.endsWith('\n')) {
+			line.chop(1);
+		}
+
+		int separator = line.indexOf(' ');
+
+		// a '*' in front of the path marks a file hashed in binary mode
+		if(0 >= separator || line.size() < separator + 3 || ('*' != line.at(separator + 1) && ' ' != line.at(separator + 1))) {
+			continue;
+		}
+
+		addEntry(entries, line.mid(separator + 2), line.left(separator));
+	}
+}
+
+/**
+ * Open the manifest for a scan, rebuilding it first if it's out of date.
+ *
+ * manifestFiles are the plain manifests to include along with the package databases. Returns false if there is no
+ * usable manifest - e.g. no package manager was found and no manifest files were given.
+ */
+bool Manifest::open(const QStringList & manifestFiles) {
+	close();
+
+	const QStringList currentSources = sources(manifestFiles);
+
+	if(currentSources.isEmpty()) {
+		return false;
+	}
+
+	const QByteArray sourcesDigest = QCryptographicHash::hash(currentSources.join('\n').toUtf8(), QCryptographicHash::Blake2b_256);
+	const QDateTime builtAt = QFileInfo(m_path).lastModified();
+	bool isCurrent = builtAt.isValid();
+
+	for(const auto & source : currentSources) {
+		if(!isCurrent) {
+			break;
+		}
+
+		isCurrent = QFileInfo(source).lastModified() < builtAt;
+	}
+
+	if(isCurrent && map(sourcesDigest)) {
+		return true;
+	}
+
+	return rebuild(currentSources, sourcesDigest) && map(sourcesDigest);
+}
+
+/**
+ * Map the table on disk, if it was built from the expected sources.
+ */
+bool Manifest::map(const QByteArray & sourcesDigest) {
+	m_file.setFileName(m_path);
+
+	if(!m_file.open(QIODevice::ReadOnly)) {
+		return false;
+	}
+
+	Header header{};
+	const qint64 fileSize = m_file.size();
+
+	if(static_cast<qint64>(sizeof(Header)) > fileSize || static_cast<qint64>(sizeof(Header)) != m_file.read(reinterpret_cast<char *>(&header), sizeof(Header)) || 0 != std::memcmp(header.magic, FileMagic, sizeof(FileMagic))) {
+qDebug() << "manifest" << m_path << "is not valid";
+		m_file.close();
+		return false;
+	}
+
+	if(0 != std::memcmp(header.sourcesDigest, sourcesDigest.constData(), sizeof(header.sourcesDigest)) || static_cast<quint64>(fileSize) != sizeof(Header) + header.entryCount * sizeof(Entry) || 0 == header.entryCount) {
+		m_file.close();
+		return false;
+	}
+
+	uchar * table = m_file.map(sizeof(Header), static_cast<qint64>(header.entryCount * sizeof(Entry)));
+
+	if(!table) {
+qDebug() << "failed to map manifest" << m_path;
+		m_file.close();
+		return false;
+	}
+
+	m_entries = reinterpret_cast<const Entry *>(table);
+	m_entryCount = static_cast<std::size_t>(header.entryCount);
+qDebug() << "opened manifest" << m_path << "with" << m_entryCount << "files";
+	return true;
+}
+
+/**
+ * Build the table from the package databases and plain manifests and write it to disk.
+ */
+bool Manifest::rebuild(const QStringList & currentSources, const QByteArray & sourcesDigest) {
+	std::vector<Entry> entries;
+
+	for(const auto & source : currentSources) {
+		if(DpkgStatusFile == source) {
+			importDpkg(entries);
+		}
+		else if(std::any_of(std::begin(RpmDatabaseFiles), std::end(RpmDatabaseFiles), [&source](const char * rpmDatabase) {
+			return rpmDatabase == source;
+		})) {
+			importRpm(entries);
+		}
+		else {
+			importDigestFile(entries, source);
+		}
+	}
+
+	if(entries.empty()) {
+qDebug() << "no known good files found for the manifest";
+		return false;
+	}
+
+	std::sort(entries.begin(), entries.end(), isBefore);
+	QDir().mkpath(QFileInfo(m_path).absolutePath());
+	QSaveFile file(m_path);
+
+	if(!file.open(QIODevice::WriteOnly)) {
+qDebug() << "failed to write manifest" << m_path;
+		return false;
+	}
+
+	Header header{};
+	std::memcpy(header.magic, FileMagic, sizeof(FileMagic));
+	std::memcpy(header.sourcesDigest, sourcesDigest.constData(), sizeof(header.sourcesDigest));
+	header.entryCount = entries.size();
+	file.write(reinterpret_cast<const char *>(&header), sizeof(Header));
+	file.write(reinterpret_cast<const char *>(entries.data()), static_cast<qint64>(entries.size() * sizeof(Entry)));
+
+	if(!file.commit()) {
+qDebug() << "failed to write manifest" << m_path;
+		return false;
+	}
+
+qDebug() << "built manifest" << m_path << "with" << entries.size() << "files";
+	return true;
+}
+
+void Manifest::close() {
+	if(m_entries) {
+		m_file.unmap(reinterpret_cast<uchar *>(const_cast<Entry *>(m_entries)));
+		m_entries = nullptr;
+	}
+
+	m_file.close();
+	m_entryCount = 0;
+}
+
+/**
+ * Check whether the content of a file matches the digest the manifest has for its path.
+ *
+ * The file is only read if the manifest lists its path. A path listed more than once - e.g. by two packages - is
+ * known good if it matches any of its digests.
+ */
+bool Manifest::isKnownGood(const QByteArray & path, int fd) const {
+	if(!m_entries) {
+		return false;
+	}
+
+	Entry probe{};
+	probe.pathHash = pathHash(path);
+	const auto range = std::equal_range(m_entries, m_entries + m_entryCount, probe, isBefore);
+	QByteArray digests[2];
+
+	for(auto entry = range.first; entry != range.second; ++entry) {
+		QByteArray & digest = digests[Algorithm::Md5 == entry->algorithm ? 0 : 1];
+
+		if(digest.isEmpty()) {
+			digest = fileDigest(fd, entry->algorithm);
+
+			if(digest.isEmpty()) {
+				return false;
+			}
+		}
+
+		if(static_cast<quint32>(digest.size()) == entry->digestLength && 0 == std::memcmp(digest.constData(), entry->digest, entry->digestLength)) {
+			return true;
+		}
+	}
+
+	return false;
+}
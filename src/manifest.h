@@ -0,0 +1,81 @@
+#ifndef QLAM_MANIFEST_H
+#define QLAM_MANIFEST_H
+
+#include <vector>
+
+#include <QtCore/QByteArray>
+#include <QtCore/QFile>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+
+namespace Qlam {
+	/**
+	 * The digests of known good files, by path.
+	 *
+	 * The manifest is built from the digests the package managers already keep - dpkg's *.md5sums files and the rpm
+	 * database - and from any plain "digest  path" manifests given (e.g. sha256sum output from a golden image). A file
+	 * whose content matches the digest recorded for its path is as shipped, so it doesn't need a full scan: hashing
+	 * it is much cheaper than having libclamav parse it.
+	 *
+	 * The table is built once and kept on disk, sorted by a hash of the path, and is mapped rather than read. It is
+	 * rebuilt when the package databases or the plain manifests change.
+	 */
+	class Manifest {
+		public:
+			enum class Algorithm : quint32 {
+				Md5 = 1,
+				Sha256,
+			};
+
+			struct Entry {
+				quint64 pathHash;
+				Algorithm algorithm;
+				quint32 digestLength;
+				char digest[32];
+			};
+
+			explicit Manifest(QString path = defaultPath());
+			~Manifest();
+
+			Manifest(const Manifest &) = delete;
+			Manifest & operator=(const Manifest &) = delete;
+
+			static QString defaultPath();
+
+			const QString & path() const {
+				return m_path;
+			}
+
+			bool isOpen() const {
+				return nullptr != m_entries;
+			}
+
+			std::size_t entryCount() const {
+				return m_entryCount;
+			}
+
+			bool open(const QStringList & manifestFiles = {});
+			void close();
+
+			/* thread safe once open() has returned. path is the absolute path of the file open on fd */
+			bool isKnownGood(const QByteArray & path, int fd) const;
+
+		private:
+			static quint64 pathHash(const QByteArray &);
+			static QStringList sources(const QStringList & manifestFiles);
+			static void addEntry(std::vector<Entry> &, QByteArray path, const QByteArray & hexDigest);
+			static void importDpkg(std::vector<Entry> &);
+			static void importRpm(std::vector<Entry> &);
+			static void importDigestFile(std::vector<Entry> &, const QString &);
+
+			bool map(const QByteArray & sourcesDigest);
+			bool rebuild(const QStringList & sources, const QByteArray & sourcesDigest);
+
+			QString m_path;
+			QFile m_file;
+			const Entry * m_entries;
+			std::size_t m_entryCount;
+	};
+}
+
+#endif // QLAM_MANIFEST_H
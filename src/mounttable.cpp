@@ -0,0 +1,192 @@
+#include "mounttable.h"
+
+#include <QtGlobal>
+#include <QtCore/QFile>
+#include <QtCore/QList>
+
+#include <sys/sysmacros.h>
+#include <sys/vfs.h>
+
+using namespace Qlam;
+
+// filesystem types whose data comes over the network. FUSE filesystems report "fuse.<name>"
+static constexpr const char * NetworkFsTypes[] = {
+	"nfs", "nfs4", "cifs", "smb3", "smbfs", "ceph", "glusterfs", "9p", "afs", "lustre", "gpfs", "ocfs2", "fuse.sshfs",
+	"fuse.rclone", "fuse.s3fs",
+};
+
+// f_type magic numbers of the network filesystems, from linux/magic.h and the filesystems' own sources
+static constexpr const unsigned long NetworkFsMagics[] = {
+	0x6969,		// NFS
+	0x517b,		// SMB
+	0xff534d42,	// CIFS
+	0xfe534d42,	// SMB2
+	0x00c36400,	// Ceph
+	0x01021997,	// 9P
+	0x5346414f,	// AFS
+	0x0bd00bd0,	// Lustre
+	0x47504653,	// GPFS
+	0x7461636f,	// OCFS2
+	0x73757245,	// Coda
+};
+
+static constexpr const unsigned long FuseMagic = 0x65735546;
+
+namespace {
+	/**
+	 * Undo the octal escaping mountinfo applies to spaces, tabs, newlines and backslashes in paths.
+	 */
+	QByteArray unescape(const QByteArray & field) {
+		QByteArray ret;
+		ret.reserve(field.size());
+
+		for(int idx = 0; idx < field.size(); ++idx) {
+			if('\\' == field[idx] && idx + 3 < field.size()) {
+				bool ok;
+				int ch = field.mid(idx + 1, 3).toInt(&ok, 8);
+
+				if(ok) {
+					ret.append(static_cast<char>(ch));
+					idx += 3;
+					continue;
+				}
+			}
+
+			ret.append(field[idx]);
+		}
+
+		return ret;
+	}
+
+	/**
+	 * Classify a mount by the magic number of its filesystem. Nothing if it can't be read or isn't a network or FUSE
+	 * filesystem.
+	 */
+	std::optional<MountTable::StorageType> remoteType(const QByteArray & mountPoint) {
+		struct statfs fs{};
+
+		if(0 != ::statfs(mountPoint.constData(), &fs)) {
+			return {};
+		}
+
+		const auto magic = static_cast<unsigned long>(fs.f_type) & 0xffffffff;
+
+		if(FuseMagic == magic) {
+			return MountTable::StorageType::Fuse;
+		}
+
+		for(unsigned long networkMagic : NetworkFsMagics) {
+			if(networkMagic == magic) {
+				return MountTable::StorageType::Network;
+			}
+		}
+
+		return {};
+	}
+
+	/**
+	 * Read the rotational flag the block layer reports for a device.
+	 *
+	 * Partitions don't have a queue of their own, so if the device has none its parent's is used.
+	 */
+	std::optional<bool> isRotational(dev_t device) {
+		const QByteArray base = "/sys/dev/block/" + QByteArray::number(major(device)) + ':' + QByteArray::number(minor(device));
+
+		for(const char * queue : {"/queue/rotational", "/../queue/rotational"}) {
+			QFile file(QFile::decodeName(base + queue));
+
+			if(file.open(QIODevice::ReadOnly)) {
+				return "1" == file.readAll().trimmed();
+			}
+		}
+
+		return {};
+	}
+}
+
+/**
+ * Read the mount table of the current process.
+ *
+ * Returns an empty table if /proc isn't available.
+ */
+MountTable MountTable::load() {
+	MountTable table;
+	QFile file(QStringLiteral("/proc/self/mountinfo"));
+
+	if(!file.open(QIODevice::ReadOnly)) {
+		return table;
+	}
+
+	// <id> <parent> <major>:<minor> <root> <mount point> <options> [<optional>...] - <fs type> <source> <super options>
+	for(const auto & line : file.readAll().split('\n')) {
+		QList<QByteArray> fields = line.split(' ');
+		int separator = fields.indexOf("-");
+
+		if(5 > separator || separator + 2 >= fields.size()) {
+			continue;
+		}
+
+		QList<QByteArray> device = fields[2].split(':');
+
+		if(2 != device.size()) {
+			continue;
+		}
+
+		table.m_mounts.push_back({
+			makedev(device[0].toUInt(), device[1].toUInt()),
+			unescape(fields[4]),
+			unescape(fields[separator + 2]),
+			fields[separator + 1],
+		});
+	}
+
+	return table;
+}
+
+/**
+ * Find the mount of a device.
+ *
+ * A device that is mounted more than once (e.g. bind mounts) has the same storage behind each mount, so the first one
+ * listed is as good as any.
+ */
+std::optional<MountTable::Mount> MountTable::find(dev_t device) const {
+	for(const auto & mount : m_mounts) {
+		if(mount.device == device) {
+			return mount;
+		}
+	}
+
+	return {};
+}
+
+/**
+ * Classify the storage behind a mount.
+ *
+ * Network and FUSE filesystems are recognised by the magic number statfs() reports, and failing that by type. FUSE
+ * filesystems not known to be network ones - including fuseblk, such as ntfs-3g - are Fuse. Otherwise the block
+ * layer's rotational flag tells spinning disks from solid state; filesystems without a block device of their own
+ * (tmpfs, overlay, btrfs subvolumes) are Unknown.
+ */
+MountTable::StorageType MountTable::storageType(const Mount & mount) {
+	for(const char * type : NetworkFsTypes) {
+		if(mount.fsType == type) {
+			return StorageType::Network;
+		}
+	}
+
+	if(auto remote = remoteType(mount.mountPoint)) {
+		return *remote;
+	}
+
+	if(mount.fsType.startsWith("fuse")) {
+		return StorageType::Fuse;
+	}
+
+	auto rotational = isRotational(mount.device);
+
+	if(!rotational) {
+		return StorageType::Unknown;
+	}
+
+	return (*rotational ? StorageType::Rotating : StorageType::SolidState);
+}
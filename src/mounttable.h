@@ -0,0 +1,62 @@
+#ifndef QLAM_MOUNTTABLE_H
+#define QLAM_MOUNTTABLE_H
+
+#include <optional>
+#include <vector>
+
+#include <sys/types.h>
+
+#include <QtCore/QByteArray>
+
+namespace Qlam {
+	/**
+	 * The filesystems mounted in the process's mount namespace, as listed in /proc/self/mountinfo.
+	 *
+	 * Used to work out what kind of storage a device is, so that each device can be scanned with a concurrency that
+	 * suits it. Network and FUSE filesystems are recognised by the magic number statfs() reports for the mount as well
+	 * as by name, since the name in the mount table is whatever the mount was given.
+	 */
+	class MountTable {
+		public:
+			enum class StorageType {
+				Unknown = 0,
+				SolidState,
+				Rotating,
+				Network,
+
+				// served by a userspace process, so every request is a round trip to it, often over the network
+				Fuse,
+			};
+
+			struct Mount {
+				dev_t device;
+
+				// raw paths in the local 8-bit encoding
+				QByteArray mountPoint;
+				QByteArray source;
+
+				QByteArray fsType;
+			};
+
+			static MountTable load();
+
+			const std::vector<Mount> & mounts() const {
+				return m_mounts;
+			}
+
+			std::optional<Mount> find(dev_t) const;
+
+			static StorageType storageType(const Mount &);
+
+			/* whether each request to the storage costs a round trip, so that latency rather than bandwidth or CPU is
+			 * what limits the scan */
+			static bool isHighLatency(StorageType type) {
+				return StorageType::Network == type || StorageType::Fuse == type;
+			}
+
+		private:
+			std::vector<Mount> m_mounts;
+	};
+}
+
+#endif // QLAM_MOUNTTABLE_H
@@ -0,0 +1,547 @@
+#include "onaccessscanner.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <ctime>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/fanotify.h>
+
+#include <QtCore/QDebug>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+
+#include <clamav.h>
+
+#include "application.h"
+#include "cpubudget.h"
+
+using namespace Qlam;
+
+// the scan stops at the first match and collects no metadata - an open is waiting for the answer
+static constexpr const uint32_t OnAccessGeneralScanOptions = static_cast<uint32_t>(CL_SCAN_GENERAL_HEURISTICS);
+
+static constexpr const uint32_t OnAccessParseScanOptions =
+	static_cast<uint32_t>(CL_SCAN_PARSE_ARCHIVE) |
+	static_cast<uint32_t>(CL_SCAN_PARSE_ELF) |
+	static_cast<uint32_t>(CL_SCAN_PARSE_PDF) |
+	static_cast<uint32_t>(CL_SCAN_PARSE_XMLDOCS) |
+	static_cast<uint32_t>(CL_SCAN_PARSE_MAIL) |
+	static_cast<uint32_t>(CL_SCAN_PARSE_OLE2) |
+	static_cast<uint32_t>(CL_SCAN_PARSE_HTML) |
+	static_cast<uint32_t>(CL_SCAN_PARSE_PE)
+	;
+
+// the permission events answered - FAN_OPEN_EXEC_PERM needs Linux 5.0
+static constexpr const quint64 PermissionMask = FAN_OPEN_PERM | FAN_OPEN_EXEC_PERM;
+
+// queued events each worker may have waiting before the fallback answer is given straight away
+static constexpr const std::size_t QueuedEventsPerWorker = 32;
+
+// a file whose ctime is this recent, in ns, when its scan starts doesn't have its verdict cached, since a change
+// made within the granularity of the filesystem's timestamps wouldn't show up in them
+static constexpr const qint64 RecentChangeWindow = 2000000000;
+
+// the longest the reader waits, in ms, before checking for events that have timed out
+static constexpr const int MaxPollInterval = 100;
+
+namespace {
+	qint64 nanoseconds(const struct timespec & time) {
+		return static_cast<qint64>(time.tv_sec) * 1000000000 + time.tv_nsec;
+	}
+
+	qint64 monotonicTime() {
+		struct timespec now{};
+		::clock_gettime(CLOCK_MONOTONIC, &now);
+		return nanoseconds(now);
+	}
+
+	QByteArray fdPath(int fd) {
+		char path[PATH_MAX];
+		ssize_t length = ::readlink(("/proc/self/fd/" + QByteArray::number(fd)).constData(), path, sizeof(path));
+
+		if(0 >= length || static_cast<ssize_t>(sizeof(path)) == length) {
+			return {};
+		}
+
+		return QByteArray(path, static_cast<int>(length));
+	}
+
+	quint64 verdictDigest(const struct stat & st) {
+		quint64 value = static_cast<quint64>(st.st_dev) * 0x9e3779b97f4a7c15ULL;
+		value ^= static_cast<quint64>(st.st_ino) + 0x632be59bd9b4e019ULL + (value << 6) + (value >> 2);
+		value ^= static_cast<quint64>(st.st_size) + 0x9e3779b97f4a7c15ULL + (value << 6) + (value >> 2);
+		value ^= static_cast<quint64>(nanoseconds(st.st_mtim)) + 0x85ebca6b2c2b5f0dULL + (value << 6) + (value >> 2);
+		value ^= static_cast<quint64>(nanoseconds(st.st_ctim)) + 0xc2b2ae3d27d4eb4fULL + (value << 6) + (value >> 2);
+
+		// splitmix64 finaliser
+		value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+		return value ^ (value >> 31);
+	}
+
+	// the latency bucket for a number of µs, and the largest latency in a bucket
+	std::size_t latencyBucket(quint64 us) {
+		if(8 > us) {
+			return static_cast<std::size_t>(us);
+		}
+
+		const int msb = 63 - __builtin_clzll(us);
+		return 8 + static_cast<std::size_t>(msb - 3) * 4 + static_cast<std::size_t>((us >> (msb - 2)) & 3);
+	}
+
+	quint64 latencyBucketLimit(std::size_t bucket) {
+		if(8 > bucket) {
+			return bucket;
+		}
+
+		const int msb = static_cast<int>((bucket - 8) / 4) + 3;
+		const quint64 quarter = (bucket - 8) % 4;
+		return (quint64(1) << msb) + ((quarter + 1) << (msb - 2)) - 1;
+	}
+}
+
+OnAccessScanner::Event::Event(int fd, const struct stat & st, qint64 received, qint64 deadline)
+: fd(fd),
+  stat(st),
+  received(received),
+  deadline(deadline),
+  isAnswered(false) {
+}
+
+OnAccessScanner::Event::~Event() {
+	::close(fd);
+}
+
+OnAccessScanner::OnAccessScanner(QObject * parent)
+: QObject(parent),
+  m_workerCount(0),
+  m_timeout(DefaultTimeout),
+  m_denyOnTimeout(false),
+  m_paths(),
+  m_engine(nullptr),
+  m_notifyFd(-1),
+  m_stopFd(-1),
+  m_reader(),
+  m_workers(),
+  m_queue(),
+  m_queueCapacity(QueuedEventsPerWorker),
+  m_stopping(false),
+  m_unanswered(),
+  m_verdicts(std::make_unique<std::atomic<quint64>[]>(VerdictCacheSize)),
+  m_latencies(),
+  m_scannedFileCount(0),
+  m_cachedVerdictCount(0),
+  m_timedOutCount(0) {
+}
+
+OnAccessScanner::~OnAccessScanner() {
+	stop();
+}
+
+/**
+ * Start answering permission events for the mounts containing the given paths.
+ *
+ * Must be called from the application's thread, since it acquires the shared scan engine.
+ */
+bool OnAccessScanner::start(const QStringList & paths) {
+	stop();
+	m_paths.clear();
+
+	for(const auto & path : paths) {
+		const QString canonicalPath = QFileInfo(path).canonicalFilePath();
+
+		if(!canonicalPath.isEmpty()) {
+			m_paths.append(QFile::encodeName(canonicalPath));
+		}
+	}
+
+	if(m_paths.isEmpty()) {
+		return false;
+	}
+
+	m_notifyFd = ::fanotify_init(FAN_CLASS_CONTENT | FAN_CLOEXEC | FAN_NONBLOCK, O_RDONLY | O_LARGEFILE | O_CLOEXEC);
+
+	if(-1 == m_notifyFd) {
+qDebug() << "on-access scanning is not available (it needs CAP_SYS_ADMIN):" << std::strerror(errno);
+		return false;
+	}
+
+	m_engine = Application::instance()->acquireEngine();
+
+	if(!m_engine) {
+		::close(m_notifyFd);
+		m_notifyFd = -1;
+		return false;
+	}
+
+	for(std::size_t idx = 0; idx < VerdictCacheSize; ++idx) {
+		m_verdicts[idx].store(0, std::memory_order_relaxed);
+	}
+
+	for(auto & bucket : m_latencies) {
+		bucket = 0;
+	}
+
+	m_scannedFileCount = 0;
+	m_cachedVerdictCount = 0;
+	m_timedOutCount = 0;
+	m_stopping = false;
+
+	const int workerCount = (0 < m_workerCount ? m_workerCount : std::max(1, CpuBudget::available() / 2));
+	m_queueCapacity = static_cast<std::size_t>(workerCount) * QueuedEventsPerWorker;
+	m_stopFd = ::eventfd(0, EFD_CLOEXEC);
+
+	for(int idx = 0; idx < workerCount; ++idx) {
+		m_workers.emplace_back(&OnAccessScanner::workerThread, this);
+	}
+
+	m_reader = std::thread(&OnAccessScanner::readerThread, this);
+
+	// marked last, so that there's something to answer the first event
+	for(const auto & path : m_paths) {
+		int ret = ::fanotify_mark(m_notifyFd, FAN_MARK_ADD | FAN_MARK_MOUNT, PermissionMask, AT_FDCWD, path.constData());
+
+		if(0 != ret && EINVAL == errno) {
+			ret = ::fanotify_mark(m_notifyFd, FAN_MARK_ADD | FAN_MARK_MOUNT, FAN_OPEN_PERM, AT_FDCWD, path.constData());
+		}
+
+		if(0 != ret) {
+qDebug() << "failed to watch" << path << "for on-access scanning:" << std::strerror(errno);
+			stop();
+			return false;
+		}
+	}
+
+qDebug() << "on-access scanning" << m_paths << "with" << workerCount << "workers";
+	return true;
+}
+
+void OnAccessScanner::stop() {
+	if(!m_reader.joinable()) {
+		return;
+	}
+
+	const quint64 stop = 1;
+
+	if(sizeof(stop) != ::write(m_stopFd, &stop, sizeof(stop))) {
+qDebug() << "failed to signal the on-access reader to stop:" << std::strerror(errno);
+	}
+
+	m_reader.join();
+
+	for(auto & worker : m_workers) {
+		worker.join();
+	}
+
+	m_workers.clear();
+	m_queue.clear();
+	m_unanswered.clear();
+
+	// closing the descriptor allows anything the kernel still has waiting
+	::close(m_notifyFd);
+	m_notifyFd = -1;
+	::close(m_stopFd);
+	m_stopFd = -1;
+	m_engine = nullptr;
+	Application::instance()->releaseEngine();
+
+	const Latency times = latency();
+qDebug() << "on-access scanning answered" << times.count << "opens; latency p50" << times.p50 << "µs, p90" << times.p90 << "µs, p99" << times.p99 << "µs, p99.9" << times.p999 << "µs;" << m_scannedFileCount << "scanned," << m_cachedVerdictCount << "from the verdict cache," << m_timedOutCount << "timed out";
+}
+
+/**
+ * The time taken to answer permission events, from the event being read to the answer being written.
+ */
+OnAccessScanner::Latency OnAccessScanner::latency() const {
+	Latency ret{0, 0, 0, 0, 0};
+	std::array<quint64, LatencyBucketCount> counts;
+
+	for(std::size_t idx = 0; idx < LatencyBucketCount; ++idx) {
+		counts[idx] = m_latencies[idx].load(std::memory_order_relaxed);
+		ret.count += counts[idx];
+	}
+
+	if(0 == ret.count) {
+		return ret;
+	}
+
+	auto percentile = [&counts, &ret](quint64 perThousand) {
+		// the rank of the event at the percentile, counting from 1
+		const quint64 rank = std::max<quint64>(1, (ret.count * perThousand + 999) / 1000);
+		quint64 seen = 0;
+
+		for(std::size_t idx = 0; idx < LatencyBucketCount; ++idx) {
+			seen += counts[idx];
+
+			if(seen >= rank) {
+				return latencyBucketLimit(idx);
+			}
+		}
+
+		return latencyBucketLimit(LatencyBucketCount - 1);
+	};
+
+	ret.p50 = percentile(500);
+	ret.p90 = percentile(900);
+	ret.p99 = percentile(990);
+	ret.p999 = percentile(999);
+	return ret;
+}
+
+void OnAccessScanner::readerThread() {
+	struct pollfd fds[2] = {
+		{m_notifyFd, POLLIN, 0},
+		{m_stopFd, POLLIN, 0},
+	};
+
+	while(true) {
+		answerTimedOut();
+		int timeout = MaxPollInterval;
+
+		if(!m_unanswered.empty()) {
+			timeout = static_cast<int>(std::clamp<qint64>((m_unanswered.front()->deadline - monotonicTime()) / 1000000 + 1, 1, MaxPollInterval));
+		}
+
+		int ret = ::poll(fds, 2, timeout);
+
+		if(0 > ret && EINTR != errno) {
+qDebug() << "failed waiting for permission events:" << std::strerror(errno);
+			break;
+		}
+
+		if(0 < ret && (fds[1].revents & POLLIN)) {
+			break;
+		}
+
+		if(0 < ret && (fds[0].revents & POLLIN)) {
+			readEvents();
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_queueLock);
+		m_stopping = true;
+	}
+
+	m_queueChanged.notify_all();
+
+	// nothing is left waiting on a scan that won't happen
+	for(const auto & event : m_unanswered) {
+		respond(*event, true);
+	}
+}
+
+/**
+ * Give the fallback answer to the events whose time is up.
+ */
+void OnAccessScanner::answerTimedOut() {
+	const qint64 now = monotonicTime();
+
+	while(!m_unanswered.empty()) {
+		Event & event = *m_unanswered.front();
+
+		if(!event.isAnswered && event.deadline > now) {
+			break;
+		}
+
+		if(!event.isAnswered) {
+			respond(event, !m_denyOnTimeout);
+			++m_timedOutCount;
+		}
+
+		m_unanswered.pop_front();
+	}
+}
+
+void OnAccessScanner::readEvents() {
+	alignas(struct fanotify_event_metadata) char buffer[16 * 1024];
+	const pid_t ownPid = ::getpid();
+
+	while(true) {
+		ssize_t length = ::read(m_notifyFd, buffer, sizeof(buffer));
+
+		if(0 >= length) {
+			if(0 > length && EINTR == errno) {
+				continue;
+			}
+
+			return;
+		}
+
+		for(auto * metadata = reinterpret_cast<struct fanotify_event_metadata *>(buffer); FAN_EVENT_OK(metadata, length); metadata = FAN_EVENT_NEXT(metadata, length)) {
+			if(FANOTIFY_METADATA_VERSION != metadata->vers || 0 > metadata->fd) {
+				continue;
+			}
+
+			const qint64 received = monotonicTime();
+			struct stat st{};
+
+			if(!(metadata->mask & PermissionMask)) {
+				::close(metadata->fd);
+				continue;
+			}
+
+			// our own opens include libclamav's, which would otherwise wait on themselves
+			if(ownPid == metadata->pid || 0 != ::fstat(metadata->fd, &st) || !S_ISREG(st.st_mode)) {
+				respond(metadata->fd, true);
+				::close(metadata->fd);
+				recordLatency(monotonicTime() - received);
+				continue;
+			}
+
+			if(auto verdict = cachedVerdict(st)) {
+				respond(metadata->fd, *verdict);
+				::close(metadata->fd);
+				++m_cachedVerdictCount;
+				recordLatency(monotonicTime() - received);
+				continue;
+			}
+
+			if(!isWatched(metadata->fd)) {
+				respond(metadata->fd, true);
+				::close(metadata->fd);
+				recordLatency(monotonicTime() - received);
+				continue;
+			}
+
+			auto event = std::make_shared<Event>(metadata->fd, st, received, received + static_cast<qint64>(m_timeout) * 1000000);
+			bool isQueued = false;
+
+			{
+				std::lock_guard<std::mutex> lock(m_queueLock);
+
+				if(m_queue.size() < m_queueCapacity) {
+					m_queue.push_back(event);
+					isQueued = true;
+				}
+			}
+
+			if(!isQueued) {
+				respond(*event, !m_denyOnTimeout);
+				++m_timedOutCount;
+				continue;
+			}
+
+			m_queueChanged.notify_one();
+			m_unanswered.push_back(std::move(event));
+		}
+	}
+}
+
+void OnAccessScanner::workerThread() {
+	struct cl_scan_options opts {
+		OnAccessGeneralScanOptions,
+		OnAccessParseScanOptions,
+		0,
+		0,
+		0,
+	};
+
+	while(true) {
+		EventPointer event;
+
+		{
+			std::unique_lock<std::mutex> lock(m_queueLock);
+			m_queueChanged.wait(lock, [this]() {
+				return m_stopping || !m_queue.empty();
+			});
+
+			if(m_stopping) {
+				return;
+			}
+
+			event = std::move(m_queue.front());
+			m_queue.pop_front();
+		}
+
+		// timed out while it was queued
+		if(event->isAnswered) {
+			continue;
+		}
+
+		struct timespec now{};
+		::clock_gettime(CLOCK_REALTIME, &now);
+		const bool isSettled = nanoseconds(event->stat.st_ctim) < nanoseconds(now) - RecentChangeWindow;
+		const char * virusName = nullptr;
+		unsigned long scannedDataSize = 0;
+		int ret = cl_scandesc(event->fd, nullptr, &virusName, &scannedDataSize, m_engine, &opts);
+		++m_scannedFileCount;
+
+		// a file that can't be scanned is let through, as it would be if the scan took too long
+		const bool allow = (CL_VIRUS != ret);
+
+		if(isSettled && (CL_CLEAN == ret || CL_VIRUS == ret)) {
+			cacheVerdict(event->stat, allow);
+		}
+
+		respond(*event, allow);
+
+		if(!allow) {
+			Q_EMIT fileBlocked(QFile::decodeName(fdPath(event->fd)), QString::fromUtf8(virusName));
+		}
+	}
+}
+
+/**
+ * Check whether the file open on a descriptor is in one of the watched paths - the marks cover whole mounts.
+ */
+bool OnAccessScanner::isWatched(int fd) const {
+	const QByteArray path = fdPath(fd);
+
+	return std::any_of(m_paths.cbegin(), m_paths.cend(), [&path](const QByteArray & root) {
+		return path == root || "/" == root || path.startsWith(root + '/');
+	});
+}
+
+/**
+ * Answer an event that may also be answered by another thread - only the first answer is written.
+ */
+void OnAccessScanner::respond(Event & event, bool allow) {
+	if(event.isAnswered.exchange(true)) {
+		return;
+	}
+
+	respond(event.fd, allow);
+	recordLatency(monotonicTime() - event.received);
+}
+
+void OnAccessScanner::respond(int fd, bool allow) {
+	struct fanotify_response response{fd, allow ? static_cast<quint32>(FAN_ALLOW) : static_cast<quint32>(FAN_DENY)};
+
+	if(sizeof(response) != ::write(m_notifyFd, &response, sizeof(response))) {
+qDebug() << "failed to answer a permission event:" << std::strerror(errno);
+	}
+}
+
+void OnAccessScanner::recordLatency(qint64 ns) {
+	m_latencies[latencyBucket(static_cast<quint64>(std::max<qint64>(0, ns)) / 1000)].fetch_add(1, std::memory_order_relaxed);
+}
+
+/**
+ * Look a file up in the verdict cache.
+ *
+ * Each slot is a single atomic word, so the reader and the workers share the cache without locking. A slot holds
+ * the verdict for one file at a time; a file whose slot has since been taken by another is simply scanned again.
+ */
+std::optional<bool> OnAccessScanner::cachedVerdict(const struct stat & st) const {
+	const quint64 digest = verdictDigest(st);
+	const quint64 slot = m_verdicts[digest & (VerdictCacheSize - 1)].load(std::memory_order_relaxed);
+
+	// bit 1 marks the slot as used, bit 0 is the verdict
+	if((slot & ~quint64(1)) != ((digest & ~quint64(3)) | 2)) {
+		return {};
+	}
+
+	return 0 != (slot & 1);
+}
+
+void OnAccessScanner::cacheVerdict(const struct stat & st, bool allow) {
+	const quint64 digest = verdictDigest(st);
+	m_verdicts[digest & (VerdictCacheSize - 1)].store((digest & ~quint64(3)) | 2 | (allow ? 1 : 0), std::memory_order_relaxed);
+}
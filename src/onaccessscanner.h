@@ -0,0 +1,173 @@
+#ifndef QLAM_ONACCESSSCANNER_H
+#define QLAM_ONACCESSSCANNER_H
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include <QtCore/QByteArray>
+#include <QtCore/QList>
+#include <QtCore/QObject>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+
+struct cl_engine;
+
+namespace Qlam {
+	/**
+	 * Scans files as they are opened, and blocks the ones that are infected.
+	 *
+	 * The mounts containing the watched paths are marked for fanotify permission events (FAN_OPEN_PERM and, where the
+	 * kernel has it, FAN_OPEN_EXEC_PERM), so every open of a file on them waits for our answer. This needs
+	 * CAP_SYS_ADMIN.
+	 *
+	 * Files outside the watched paths, files opened by this process and files that aren't regular are allowed
+	 * straight away, as are files in the verdict cache - so repeat opens of an unchanged file cost one lookup. The
+	 * rest are queued for a pool of workers scanning with the application's shared engine. A file that isn't
+	 * answered within the timeout, or that turns up while the queue is full, gets the fallback answer, so a slow scan
+	 * can never leave the desktop hanging.
+	 */
+	class OnAccessScanner
+	: public QObject {
+
+		Q_OBJECT
+
+		public:
+			// response latencies at these percentiles, in µs
+			struct Latency {
+				quint64 count;
+				quint64 p50;
+				quint64 p90;
+				quint64 p99;
+				quint64 p999;
+			};
+
+			static constexpr const int DefaultTimeout = 5000;
+
+			explicit OnAccessScanner(QObject * = nullptr);
+			~OnAccessScanner() override;
+
+			bool isRunning() const {
+				return m_reader.joinable();
+			}
+
+			/* the number of scan workers - 0 to size the pool from the CPU budget */
+			int workerCount() const {
+				return m_workerCount;
+			}
+
+			void setWorkerCount(int count) {
+				m_workerCount = (0 > count ? 0 : count);
+			}
+
+			/* how long, in ms, an open may wait for its scan before the fallback answer is given */
+			int timeout() const {
+				return m_timeout;
+			}
+
+			void setTimeout(int timeout) {
+				m_timeout = (1 > timeout ? 1 : timeout);
+			}
+
+			/* whether the fallback answer denies the open rather than allowing it */
+			bool deniesOnTimeout() const {
+				return m_denyOnTimeout;
+			}
+
+			void setDenyOnTimeout(bool deny) {
+				m_denyOnTimeout = deny;
+			}
+
+			/* the settings above take effect when the scanner is started */
+			bool start(const QStringList & paths);
+			void stop();
+
+			/* thread safe */
+			Latency latency() const;
+
+			int scannedFileCount() const {
+				return m_scannedFileCount;
+			}
+
+			int cachedVerdictCount() const {
+				return m_cachedVerdictCount;
+			}
+
+			int timedOutCount() const {
+				return m_timedOutCount;
+			}
+
+		Q_SIGNALS:
+			/* emitted from the worker threads */
+			void fileBlocked(const QString & path, const QString & virusName);
+
+		private:
+			struct Event {
+				Event(int fd, const struct stat & st, qint64 received, qint64 deadline);
+				~Event();
+
+				int fd;
+				struct stat stat;
+				qint64 received;
+				qint64 deadline;
+				std::atomic<bool> isAnswered;
+			};
+
+			using EventPointer = std::shared_ptr<Event>;
+
+			// latency buckets: exact below 8µs, then 4 per power of 2
+			static constexpr const std::size_t LatencyBucketCount = 8 + 4 * 61;
+
+			// slots in the verdict cache - a power of 2
+			static constexpr const std::size_t VerdictCacheSize = 65536;
+
+			void readEvents();
+			void readerThread();
+			void answerTimedOut();
+			void workerThread();
+			bool isWatched(int fd) const;
+			void respond(Event &, bool allow);
+			void respond(int fd, bool allow);
+			void recordLatency(qint64);
+			std::optional<bool> cachedVerdict(const struct stat &) const;
+			void cacheVerdict(const struct stat &, bool allow);
+
+			int m_workerCount;
+			int m_timeout;
+			bool m_denyOnTimeout;
+			QList<QByteArray> m_paths;
+			struct cl_engine * m_engine;
+			int m_notifyFd;
+			int m_stopFd;
+			std::thread m_reader;
+			std::vector<std::thread> m_workers;
+
+			// events waiting for a worker
+			std::mutex m_queueLock;
+			std::condition_variable m_queueChanged;
+			std::deque<EventPointer> m_queue;
+			std::size_t m_queueCapacity;
+			bool m_stopping;
+
+			// the events handed to the workers, in the order they arrived, so that the reader can time them out
+			std::deque<EventPointer> m_unanswered;
+
+			// each slot holds a digest of a file's identity and metadata with the verdict in the lowest bit
+			std::unique_ptr<std::atomic<quint64>[]> m_verdicts;
+
+			std::array<std::atomic<quint64>, LatencyBucketCount> m_latencies;
+			std::atomic<int> m_scannedFileCount;
+			std::atomic<int> m_cachedVerdictCount;
+			std::atomic<int> m_timedOutCount;
+	};
+}
+
+#endif // QLAM_ONACCESSSCANNER_H
@@ -0,0 +1,55 @@
+#include "opendirectory.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace Qlam;
+
+OpenDirectory::OpenDirectory(int fd, QByteArray path, CloseHandler closeHandler)
+: m_fd(fd),
+  m_path(std::move(path)),
+  m_closeHandler(std::move(closeHandler)) {
+}
+
+OpenDirectory::~OpenDirectory() {
+	if(-1 != m_fd) {
+		::close(m_fd);
+	}
+
+	if(m_closeHandler) {
+		m_closeHandler(m_path);
+	}
+}
+
+/**
+ * Open a directory by path.
+ *
+ * Returns a null pointer if the directory can't be opened, in which case the close handler is not called.
+ */
+OpenDirectory::Pointer OpenDirectory::open(const QByteArray & path, CloseHandler closeHandler) {
+	int fd = ::open(path.constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+	if(-1 == fd) {
+		return {};
+	}
+
+	return std::make_shared<const OpenDirectory>(fd, path, std::move(closeHandler));
+}
+
+/**
+ * Build the full path of a file in the directory.
+ *
+ * This is only needed when the path is going to be displayed or reported - scanning uses the descriptor.
+ */
+QByteArray OpenDirectory::filePath(const QByteArray & name) const {
+	QByteArray path;
+	path.reserve(m_path.size() + name.size() + 1);
+	path.append(m_path);
+
+	if(!path.endsWith('/')) {
+		path.append('/');
+	}
+
+	path.append(name);
+	return path;
+}
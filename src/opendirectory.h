@@ -0,0 +1,50 @@
+#ifndef QLAM_OPENDIRECTORY_H
+#define QLAM_OPENDIRECTORY_H
+
+#include <functional>
+#include <memory>
+
+#include <QtCore/QByteArray>
+
+namespace Qlam {
+	/**
+	 * A directory that has been opened by the walker.
+	 *
+	 * Files found in the directory are opened relative to its descriptor with openat(), so the kernel doesn't have to
+	 * resolve the full path again for every file. The directory is shared between all the queued files it contains
+	 * and is closed when the last of them has been scanned.
+	 */
+	class OpenDirectory {
+		public:
+			using Pointer = std::shared_ptr<const OpenDirectory>;
+
+			/* receives the directory's path once it has been closed */
+			using CloseHandler = std::function<void(const QByteArray &)>;
+
+			OpenDirectory(int fd, QByteArray path, CloseHandler = {});
+			~OpenDirectory();
+
+			OpenDirectory(const OpenDirectory &) = delete;
+			OpenDirectory & operator=(const OpenDirectory &) = delete;
+
+			static Pointer open(const QByteArray &, CloseHandler = {});
+
+			int fd() const {
+				return m_fd;
+			}
+
+			/* raw path in the local 8-bit encoding, as reached by the walk (i.e. symlinks are not resolved) */
+			const QByteArray & path() const {
+				return m_path;
+			}
+
+			QByteArray filePath(const QByteArray &) const;
+
+		private:
+			int m_fd;
+			QByteArray m_path;
+			CloseHandler m_closeHandler;
+	};
+}
+
+#endif // QLAM_OPENDIRECTORY_H
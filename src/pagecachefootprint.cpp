@@ -0,0 +1,67 @@
+#include "pagecachefootprint.h"
+
+#include <algorithm>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+using namespace Qlam;
+
+// files are mapped this much at a time to find out which pages are resident, so that the residency vector stays small
+// whatever the size of the file
+static constexpr const quint64 MeasureChunkSize = 256 * 1024 * 1024;
+
+/**
+ * Measure a file that has just been opened, before anything reads it.
+ *
+ * A file that can't be mapped is taken to be resident, so nothing is dropped for it - better to leave the scan's pages
+ * behind than to drop someone else's.
+ */
+PageCacheFootprint PageCacheFootprint::measure(int fd, quint64 size) {
+	PageCacheFootprint footprint;
+	::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	const auto pageSize = static_cast<quint64>(::sysconf(_SC_PAGESIZE));
+	std::vector<unsigned char> residency;
+
+	for(quint64 offset = 0; offset < size; offset += MeasureChunkSize) {
+		const quint64 length = std::min(MeasureChunkSize, size - offset);
+		void * map = ::mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, static_cast<off_t>(offset));
+
+		if(MAP_FAILED == map) {
+			break;
+		}
+
+		residency.resize((length + pageSize - 1) / pageSize);
+		const int ret = ::mincore(map, length, residency.data());
+		::munmap(map, length);
+
+		if(0 != ret) {
+			break;
+		}
+
+		for(std::size_t page = 0; page < residency.size(); ++page) {
+			if(0 == (residency[page] & 1)) {
+				footprint.add(offset + page * pageSize, pageSize);
+			}
+		}
+	}
+
+	return footprint;
+}
+
+void PageCacheFootprint::drop(int fd) const {
+	for(const auto & range : m_ranges) {
+		::posix_fadvise(fd, static_cast<off_t>(range.first), static_cast<off_t>(range.second), POSIX_FADV_DONTNEED);
+	}
+}
+
+void PageCacheFootprint::add(quint64 offset, quint64 length) {
+	if(!m_ranges.empty() && m_ranges.back().first + m_ranges.back().second == offset) {
+		m_ranges.back().second += length;
+		return;
+	}
+
+	m_ranges.emplace_back(offset, length);
+}
@@ -0,0 +1,38 @@
+#ifndef QLAM_PAGECACHEFOOTPRINT_H
+#define QLAM_PAGECACHEFOOTPRINT_H
+
+#include <utility>
+#include <vector>
+
+#include <QtGlobal>
+
+namespace Qlam {
+	/**
+	 * The parts of a file that weren't in the page cache before a scan read it.
+	 *
+	 * A full scan reads far more than the page cache holds, so left to itself it pushes out the working set of
+	 * whatever else runs on the machine. Measuring the file with mincore() when it's opened, and dropping only the
+	 * ranges that weren't resident once it has been scanned, leaves the cache as it found it: pages that something else
+	 * had brought in stay, and the ones only the scan wanted go.
+	 */
+	class PageCacheFootprint {
+		public:
+			/* declare the file is about to be read sequentially, and record which of its pages aren't resident */
+			static PageCacheFootprint measure(int fd, quint64 size);
+
+			bool isEmpty() const {
+				return m_ranges.empty();
+			}
+
+			/* drop the pages that weren't resident when the file was measured */
+			void drop(int fd) const;
+
+		private:
+			void add(quint64 offset, quint64 length);
+
+			// offset and length of each range that wasn't resident, in order and not touching one another
+			std::vector<std::pair<quint64, quint64>> m_ranges;
+	};
+}
+
+#endif // QLAM_PAGECACHEFOOTPRINT_H
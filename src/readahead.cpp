@@ -0,0 +1,375 @@
+#include "readahead.h"
+
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+
+#include <unistd.h>
+
+#include <QtCore/QDebug>
+
+#if defined(QLAM_HAVE_LIBURING)
+#include <liburing.h>
+#endif
+
+using namespace Qlam;
+
+namespace {
+	// ns
+	qint64 monotonicTime() {
+		struct timespec now{};
+		::clock_gettime(CLOCK_MONOTONIC, &now);
+		return static_cast<qint64>(now.tv_sec) * 1000000000 + now.tv_nsec;
+	}
+}
+
+struct ReadAhead::Ring {
+#if defined(QLAM_HAVE_LIBURING)
+	struct io_uring ring{};
+#endif
+};
+
+ReadAhead::ReadAhead(ScanQueue & source, std::size_t depth, std::unique_ptr<Ring> ring)
+: m_source(source),
+  m_ring(std::move(ring)),
+  m_slots(depth),
+  m_preservePageCache(false),
+  m_readySlots(),
+  m_freeSlots(),
+  m_finished(false),
+  m_aborted(false),
+  m_inFlight(0),
+  m_submissionCount(0),
+  m_depthTotal(0),
+  m_stallCount(0),
+  m_stallTime(0) {
+	for(std::size_t idx = depth; 0 < idx; --idx) {
+		m_freeSlots.push_back(idx - 1);
+	}
+}
+
+ReadAhead::~ReadAhead() {
+	drain();
+
+#if defined(QLAM_HAVE_LIBURING)
+	io_uring_queue_exit(&m_ring->ring);
+#endif
+}
+
+/**
+ * Set up a read-ahead for a scan queue.
+ *
+ * Returns nothing if io_uring can't be used - the build has no liburing, the kernel doesn't support io_uring or the
+ * operations the read-ahead needs, or io_uring has been disabled.
+ */
+std::unique_ptr<ReadAhead> ReadAhead::create(ScanQueue & source, std::size_t depth) {
+#if defined(QLAM_HAVE_LIBURING)
+	depth = (0 < depth ? depth : DefaultDepth);
+	auto ring = std::make_unique<Ring>();
+	int ret = io_uring_queue_init(static_cast<unsigned>(depth), &ring->ring, 0);
+
+	if(0 > ret) {
+qDebug() << "io_uring is not available:" << std::strerror(-ret);
+		return {};
+	}
+
+	struct io_uring_probe * probe = io_uring_get_probe_ring(&ring->ring);
+	bool isSupported = probe && io_uring_opcode_supported(probe, IORING_OP_OPENAT) && io_uring_opcode_supported(probe, IORING_OP_READ);
+
+	if(probe) {
+		io_uring_free_probe(probe);
+	}
+
+	if(!isSupported) {
+qDebug() << "io_uring does not support opening and reading files on this kernel";
+		io_uring_queue_exit(&ring->ring);
+		return {};
+	}
+
+	return std::unique_ptr<ReadAhead>(new ReadAhead(source, depth, std::move(ring)));
+#else
+	Q_UNUSED(source);
+	Q_UNUSED(depth);
+	return {};
+#endif
+}
+
+/**
+ * Keep the ring full of opens and reads for the files at the front of the scan queue.
+ *
+ * While nothing is in flight this blocks on the scan queue like a worker would; otherwise it only takes what the queue
+ * already has, and waits on the ring for something to complete.
+ */
+void ReadAhead::run() {
+#if defined(QLAM_HAVE_LIBURING)
+	bool isDrained = false;
+
+	while(!isDrained || 0 < m_inFlight) {
+		while(!isDrained) {
+			Slot * slot = takeFreeSlot(0 == m_inFlight);
+
+			if(!slot) {
+				std::lock_guard<std::mutex> lock(m_lock);
+				isDrained = m_aborted;
+				break;
+			}
+
+			auto item = (0 == m_inFlight ? m_source.pop() : m_source.tryPop());
+
+			if(!item) {
+				returnSlot(static_cast<std::size_t>(slot - m_slots.data()));
+				isDrained = m_source.isDrained();
+				break;
+			}
+
+			slot->file = {};
+			slot->file.item = std::move(*item);
+			slot->file.slot = static_cast<std::size_t>(slot - m_slots.data());
+			slot->isReading = false;
+
+			if(!submitOpen(*slot, m_preservePageCache)) {
+				complete(*slot, -EAGAIN);
+			}
+		}
+
+		if(0 == m_inFlight) {
+			continue;
+		}
+
+		struct io_uring_cqe * cqe = nullptr;
+		int ret = io_uring_submit_and_wait(&m_ring->ring, 1);
+
+		if(0 > ret && -EINTR != ret) {
+qDebug() << "io_uring wait failed:" << std::strerror(-ret);
+		}
+
+		while(0 == io_uring_peek_cqe(&m_ring->ring, &cqe)) {
+			auto * slot = static_cast<Slot *>(io_uring_cqe_get_data(cqe));
+			int result = cqe->res;
+			io_uring_cqe_seen(&m_ring->ring, cqe);
+			--m_inFlight;
+			complete(*slot, result);
+		}
+	}
+#endif
+
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_finished = true;
+	}
+
+	m_ready.notify_all();
+}
+
+/**
+ * Take the next file that has been opened, and read if it was small enough.
+ *
+ * Waits that happen while opens or reads are in flight are counted as stalls - the workers are waiting on the device
+ * rather than on the walk.
+ */
+std::optional<ReadAhead::File> ReadAhead::next() {
+	std::unique_lock<std::mutex> lock(m_lock);
+
+	if(m_readySlots.empty() && !m_finished && !m_aborted) {
+		const bool isStall = (0 < m_inFlight);
+		const qint64 start = monotonicTime();
+
+		m_ready.wait(lock, [this]() {
+			return !m_readySlots.empty() || m_finished || m_aborted;
+		});
+
+		if(isStall && !m_readySlots.empty()) {
+			++m_stallCount;
+			m_stallTime += monotonicTime() - start;
+		}
+	}
+
+	if(m_aborted || m_readySlots.empty()) {
+		return {};
+	}
+
+	Slot & slot = m_slots[m_readySlots.front()];
+	m_readySlots.pop_front();
+	return std::move(slot.file);
+}
+
+void ReadAhead::release(const File & file) {
+	returnSlot(file.slot);
+}
+
+void ReadAhead::abort() {
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_aborted = true;
+	}
+
+	m_ready.notify_all();
+	m_slotFree.notify_all();
+}
+
+std::vector<ScanQueue::Item> ReadAhead::drain() {
+	std::vector<ScanQueue::Item> items;
+	std::lock_guard<std::mutex> lock(m_lock);
+
+	for(auto idx : m_readySlots) {
+		File & file = m_slots[idx].file;
+
+		if(-1 != file.fd) {
+			::close(file.fd);
+		}
+
+		items.push_back(std::move(file.item));
+		file = {};
+		m_freeSlots.push_back(idx);
+	}
+
+	m_readySlots.clear();
+	return items;
+}
+
+ReadAhead::Stats ReadAhead::stats() const {
+	Stats stats;
+	stats.submissionCount = m_submissionCount;
+	stats.depthTotal = m_depthTotal;
+	stats.stallCount = m_stallCount;
+	stats.stallTime = m_stallTime;
+	return stats;
+}
+
+/**
+ * Take a slot for the next file, waiting for one to be released if wait is set. Returns nullptr if there is none, or
+ * the read-ahead has been aborted.
+ */
+ReadAhead::Slot * ReadAhead::takeFreeSlot(bool wait) {
+	std::unique_lock<std::mutex> lock(m_lock);
+
+	if(wait) {
+		m_slotFree.wait(lock, [this]() {
+			return !m_freeSlots.empty() || m_aborted;
+		});
+	}
+
+	if(m_aborted || m_freeSlots.empty()) {
+		return nullptr;
+	}
+
+	Slot * slot = &m_slots[m_freeSlots.back()];
+	m_freeSlots.pop_back();
+	return slot;
+}
+
+void ReadAhead::returnSlot(std::size_t idx) {
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_freeSlots.push_back(idx);
+	}
+
+	m_slotFree.notify_one();
+}
+
+bool ReadAhead::submitOpen(Slot & slot, bool noAtime) {
+#if defined(QLAM_HAVE_LIBURING)
+	struct io_uring_sqe * sqe = io_uring_get_sqe(&m_ring->ring);
+
+	if(!sqe) {
+		return false;
+	}
+
+	const ScanQueue::Item & item = slot.file.item;
+	io_uring_prep_openat(sqe, item.directory->fd(), item.name.constData(), item.openFlags(noAtime), 0);
+	io_uring_sqe_set_data(sqe, &slot);
+	slot.isReading = false;
+	slot.isNoAtime = noAtime;
+	m_depthTotal += ++m_inFlight;
+	++m_submissionCount;
+	return true;
+#else
+	Q_UNUSED(slot);
+	Q_UNUSED(noAtime);
+	return false;
+#endif
+}
+
+bool ReadAhead::submitRead(Slot & slot) {
+#if defined(QLAM_HAVE_LIBURING)
+	struct io_uring_sqe * sqe = io_uring_get_sqe(&m_ring->ring);
+
+	if(!sqe) {
+		return false;
+	}
+
+	if(!slot.buffer) {
+		slot.buffer = std::make_unique<char[]>(BufferSize);
+	}
+
+	io_uring_prep_read(sqe, slot.file.fd, slot.buffer.get(), static_cast<unsigned>(slot.file.stat.st_size), 0);
+	io_uring_sqe_set_data(sqe, &slot);
+	slot.isReading = true;
+	m_depthTotal += ++m_inFlight;
+	++m_submissionCount;
+	return true;
+#else
+	Q_UNUSED(slot);
+	return false;
+#endif
+}
+
+/**
+ * Deal with the result of a slot's open or read - a descriptor or byte count, or a negated errno.
+ */
+void ReadAhead::complete(Slot & slot, int result) {
+	File & file = slot.file;
+
+	if(slot.isReading) {
+		// a short read means the file changed - the worker reads it itself
+		if(static_cast<qint64>(result) == static_cast<qint64>(file.stat.st_size)) {
+			file.data = slot.buffer.get();
+			file.length = static_cast<std::size_t>(result);
+		}
+
+		publish(slot);
+		return;
+	}
+
+	// not the process's file - try again with access times
+	if(-EPERM == result && slot.isNoAtime && submitOpen(slot, false)) {
+		return;
+	}
+
+	if(0 > result) {
+		file.openError = -result;
+		publish(slot);
+		return;
+	}
+
+	file.fd = result;
+
+	// an empty file has nothing to read, and the worker looks again at a file whose metadata can't be read
+	bool isSmall = (0 == ::fstat(file.fd, &file.stat) && S_ISREG(file.stat.st_mode) && 0 < file.stat.st_size && static_cast<quint64>(file.stat.st_size) <= BufferSize);
+
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+
+		if(m_aborted) {
+			isSmall = false;
+		}
+	}
+
+	// measured before the read brings the file in
+	if(m_preservePageCache && S_ISREG(file.stat.st_mode)) {
+		file.footprint = PageCacheFootprint::measure(file.fd, static_cast<quint64>(file.stat.st_size));
+	}
+
+	if(!isSmall || !submitRead(slot)) {
+		publish(slot);
+	}
+}
+
+void ReadAhead::publish(Slot & slot) {
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_readySlots.push_back(slot.file.slot);
+	}
+
+	m_ready.notify_one();
+}
@@ -0,0 +1,161 @@
+#ifndef QLAM_READAHEAD_H
+#define QLAM_READAHEAD_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include <QtGlobal>
+
+#include "pagecachefootprint.h"
+#include "scanqueue.h"
+
+namespace Qlam {
+	/**
+	 * Opens and reads the next files in a scan queue ahead of the workers, using io_uring.
+	 *
+	 * libclamav opens and reads each file itself, one request at a time, so with a worker per CPU the device sees a
+	 * queue only as deep as the number of workers - far too shallow to keep an NVMe drive busy. The read-ahead takes
+	 * files off the scan queue on its own thread and keeps up to its depth of them in flight in an io_uring: each is
+	 * opened and, if it fits in one of the read-ahead's buffers, read whole. The workers take the files in the order
+	 * they complete and scan the small ones straight from memory.
+	 *
+	 * Each file in flight or waiting for a worker holds a slot, and the slots are only given back once the worker has
+	 * finished with the file, so the memory used is fixed by the depth.
+	 *
+	 * Only available when built with liburing and run on a kernel that supports the operations - create() returns
+	 * nothing otherwise, and the workers read from the scan queue themselves.
+	 */
+	class ReadAhead {
+		public:
+			static constexpr const std::size_t DefaultDepth = 32;
+
+			// files up to this size are read into memory - larger ones are only opened
+			static constexpr const std::size_t BufferSize = 256 * 1024;
+
+			struct File {
+				ScanQueue::Item item;
+
+				// the open file, -1 if it couldn't be opened, in which case openError is the errno. the worker closes it
+				int fd = -1;
+				int openError = 0;
+
+				// the file's metadata when it was opened, before it was read
+				struct stat stat{};
+
+				// the whole of the file's content - nullptr if it wasn't read
+				const char * data = nullptr;
+				std::size_t length = 0;
+
+				// what wasn't in the page cache before the file was read, when the page cache is being preserved
+				PageCacheFootprint footprint;
+
+				// the slot the file holds until it is released
+				std::size_t slot = 0;
+			};
+
+			struct Stats {
+				// the operations submitted, and the sum of the number in flight as each was submitted
+				quint64 submissionCount = 0;
+				quint64 depthTotal = 0;
+
+				// the times a worker waited for a file while reads were in flight, and the ns spent waiting
+				quint64 stallCount = 0;
+				qint64 stallTime = 0;
+
+				double averageDepth() const {
+					return (0 == submissionCount ? 0.0 : static_cast<double>(depthTotal) / static_cast<double>(submissionCount));
+				}
+
+				Stats & operator+=(const Stats & other) {
+					submissionCount += other.submissionCount;
+					depthTotal += other.depthTotal;
+					stallCount += other.stallCount;
+					stallTime += other.stallTime;
+					return *this;
+				}
+			};
+
+			static std::unique_ptr<ReadAhead> create(ScanQueue &, std::size_t depth = DefaultDepth);
+			~ReadAhead();
+
+			ReadAhead(const ReadAhead &) = delete;
+			ReadAhead & operator=(const ReadAhead &) = delete;
+
+			/* whether files are opened without updating their access times, and measured for their page cache
+			 * footprint before they're read. must not be changed once run() has started */
+			bool preservesPageCache() const {
+				return m_preservePageCache;
+			}
+
+			void setPreservePageCache(bool preserve) {
+				m_preservePageCache = preserve;
+			}
+
+			/* the body of the read-ahead's thread - returns once the scan queue is drained and nothing is in flight */
+			void run();
+
+			/* blocks until a file is ready. nothing means there are no more, or the read-ahead has been aborted */
+			std::optional<File> next();
+
+			/* give back the file's slot once the worker is done with it - the file must already be closed */
+			void release(const File &);
+
+			/* stop handing out files. the scan queue must be aborted as well, to release run() */
+			void abort();
+
+			/* once run() has returned and the workers are done, close the files no worker took and return them */
+			std::vector<ScanQueue::Item> drain();
+
+			Stats stats() const;
+
+		private:
+			struct Ring;
+
+			struct Slot {
+				File file;
+				std::unique_ptr<char[]> buffer;
+				bool isReading = false;
+				bool isNoAtime = false;
+			};
+
+			ReadAhead(ScanQueue &, std::size_t, std::unique_ptr<Ring>);
+
+			Slot * takeFreeSlot(bool wait);
+			void returnSlot(std::size_t);
+			bool submitOpen(Slot &, bool noAtime);
+			bool submitRead(Slot &);
+			void complete(Slot &, int result);
+			void publish(Slot &);
+
+			ScanQueue & m_source;
+			std::unique_ptr<Ring> m_ring;
+			std::vector<Slot> m_slots;
+			bool m_preservePageCache;
+
+			// guards the slot lists and the flags
+			std::mutex m_lock;
+			std::condition_variable m_ready;
+			std::condition_variable m_slotFree;
+			std::deque<std::size_t> m_readySlots;
+			std::vector<std::size_t> m_freeSlots;
+			bool m_finished;
+			bool m_aborted;
+
+			// only changed by run()
+			std::atomic<std::size_t> m_inFlight;
+
+			std::atomic<quint64> m_submissionCount;
+			std::atomic<quint64> m_depthTotal;
+			std::atomic<quint64> m_stallCount;
+			std::atomic<qint64> m_stallTime;
+	};
+}
+
+#endif // QLAM_READAHEAD_H
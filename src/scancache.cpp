@@ -0,0 +1,348 @@
+#include "scancache.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <QtCore/QDebug>
+#include <QtCore/QDir>
+#include <QtCore/QFileInfo>
+#include <QtCore/QSaveFile>
+#include <QtCore/QStandardPaths>
+
+using namespace Qlam;
+
+// identifies a cache file, and the version of its layout
+static constexpr const char FileMagic[8] = {'Q', 'L', 'A', 'M', 'S', 'C', 'C', '1'};
+
+// filter bits per cached file. with 4 probes this gives a false positive rate of well under 1%
+static constexpr const std::size_t FilterBitsPerEntry = 16;
+static constexpr const int FilterProbes = 4;
+
+namespace {
+	// the file starts with this, followed by the database version string padded to a multiple of 8 bytes, then the
+	// table of entries
+	struct Header {
+		char magic[8];
+		quint64 databaseVersionLength;
+		quint64 entryCount;
+	};
+
+	bool isBefore(const ScanCache::Key & lhs, const ScanCache::Key & rhs) {
+		return lhs.device < rhs.device || (lhs.device == rhs.device && lhs.inode < rhs.inode);
+	}
+
+	quint64 hash(const ScanCache::Key & key) {
+		quint64 value = key.device * 0x9e3779b97f4a7c15ULL;
+		value ^= key.inode + 0x632be59bd9b4e019ULL + (value << 6) + (value >> 2);
+		value ^= key.size + 0x9e3779b97f4a7c15ULL + (value << 6) + (value >> 2);
+		value ^= static_cast<quint64>(key.mtime) + 0x85ebca6b2c2b5f0dULL + (value << 6) + (value >> 2);
+		value ^= static_cast<quint64>(key.ctime) + 0xc2b2ae3d27d4eb4fULL + (value << 6) + (value >> 2);
+
+		// splitmix64 finaliser
+		value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+		return value ^ (value >> 31);
+	}
+
+	constexpr quint64 paddedLength(quint64 length) {
+		return (length + 7) & ~quint64(7);
+	}
+}
+
+ScanCache::ScanCache(QString path)
+: m_path(std::move(path)),
+  m_isOpen(false),
+  m_isProvisional(false),
+  m_databaseVersion(),
+  m_file(),
+  m_entries(nullptr),
+  m_entryCount(0),
+  m_filter(),
+  m_added() {
+}
+
+ScanCache::~ScanCache() {
+	close();
+}
+
+QString ScanCache::defaultPath() {
+	return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + QStringLiteral("/scancache");
+}
+
+bool ScanCache::clear(const QString & path) {
+	return !QFileInfo::exists(path) || QFile::remove(path);
+}
+
+ScanCache::Key ScanCache::key(const struct stat & st) {
+	return {
+		static_cast<quint64>(st.st_dev),
+		static_cast<quint64>(st.st_ino),
+		static_cast<quint64>(st.st_size),
+		static_cast<qint64>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec,
+		static_cast<qint64>(st.st_ctim.tv_sec) * 1000000000 + st.st_ctim.tv_nsec,
+	};
+}
+
+/**
+ * Open the cache for a scan.
+ *
+ * databaseVersion identifies the signatures the scan will use. If the cache on disk was built with one of the
+ * baseVersions instead, it is opened as provisional. If it was built with any other signatures, or can't be read, the
+ * cache starts out empty. Returns false only if the cache is unusable - e.g. no database version was given.
+ */
+bool ScanCache::open(const QByteArray & databaseVersion, const QList<QByteArray> & baseVersions) {
+	close();
+
+	if(databaseVersion.isEmpty()) {
+		return false;
+	}
+
+	m_databaseVersion = databaseVersion;
+	m_isOpen = true;
+	m_file.setFileName(m_path);
+
+	if(!m_file.open(QIODevice::ReadOnly)) {
+		return true;
+	}
+
+	Header header{};
+	const qint64 fileSize = m_file.size();
+
+	if(static_cast<qint64>(sizeof(Header)) > fileSize || static_cast<qint64>(sizeof(Header)) != m_file.read(reinterpret_cast<char *>(&header), sizeof(Header)) || 0 != std::memcmp(header.magic, FileMagic, sizeof(FileMagic))) {
+qDebug() << "scan cache" << m_path << "is not valid - starting a new one";
+		m_file.close();
+		return true;
+	}
+
+	const quint64 tableOffset = sizeof(Header) + paddedLength(header.databaseVersionLength);
+
+	if(static_cast<quint64>(fileSize) != tableOffset + header.entryCount * sizeof(Key)) {
+qDebug() << "scan cache" << m_path << "is not valid - starting a new one";
+		m_file.close();
+		return true;
+	}
+
+	const QByteArray cacheVersion = m_file.read(static_cast<qint64>(header.databaseVersionLength));
+
+	if(cacheVersion != databaseVersion) {
+		if(!baseVersions.contains(cacheVersion)) {
+qDebug() << "scan cache" << m_path << "was built with other signatures - starting a new one";
+			m_file.close();
+			return true;
+		}
+
+		m_isProvisional = true;
+	}
+
+	if(0 < header.entryCount) {
+		uchar * table = m_file.map(static_cast<qint64>(tableOffset), static_cast<qint64>(header.entryCount * sizeof(Key)));
+
+		if(!table) {
+qDebug() << "failed to map scan cache" << m_path;
+			m_file.close();
+			return true;
+		}
+
+		m_entries = reinterpret_cast<const Key *>(table);
+		m_entryCount = static_cast<std::size_t>(header.entryCount);
+	}
+
+	std::size_t filterWords = 1;
+
+	while(filterWords * 64 < m_entryCount * FilterBitsPerEntry) {
+		filterWords *= 2;
+	}
+
+	m_filter.assign(filterWords, 0);
+
+	for(std::size_t idx = 0; idx < m_entryCount; ++idx) {
+		addToFilter(m_entries[idx]);
+	}
+
+qDebug() << "opened" << (m_isProvisional ? "provisional" : "") << "scan cache" << m_path << "with" << m_entryCount << "files";
+	return true;
+}
+
+/**
+ * Write the cache back to disk, including the files added since it was opened.
+ *
+ * A file that has been added replaces any older entry for the same device and inode. Entries for files that have not
+ * been seen again are kept, since the cache is shared by all scans - except in a provisional cache, where they haven't
+ * been checked against the current signatures.
+ */
+bool ScanCache::save() {
+	if(!m_isOpen) {
+		return false;
+	}
+
+	std::vector<Key> added;
+
+	{
+		std::lock_guard<std::mutex> lock(m_addedLock);
+		added.swap(m_added);
+	}
+
+	std::sort(added.begin(), added.end(), isBefore);
+	added.erase(std::unique(added.begin(), added.end(), [](const Key & lhs, const Key & rhs) {
+		return lhs.device == rhs.device && lhs.inode == rhs.inode;
+	}), added.end());
+
+	if(added.empty()) {
+		return true;
+	}
+
+	QDir().mkpath(QFileInfo(m_path).absolutePath());
+	QSaveFile file(m_path);
+
+	if(!file.open(QIODevice::WriteOnly)) {
+qDebug() << "failed to write scan cache" << m_path;
+		return false;
+	}
+
+	// the merged table is written in chunks so that the whole of it never has to be held in memory
+	std::vector<Key> chunk;
+	chunk.reserve(4096);
+	quint64 entryCount = 0;
+
+	auto write = [&file, &chunk, &entryCount](bool flush) {
+		if(flush || chunk.size() == chunk.capacity()) {
+			file.write(reinterpret_cast<const char *>(chunk.data()), static_cast<qint64>(chunk.size() * sizeof(Key)));
+			entryCount += chunk.size();
+			chunk.clear();
+		}
+	};
+
+	// the count isn't known until the merge is done, so the header is written again at the end
+	Header header{};
+	std::memcpy(header.magic, FileMagic, sizeof(FileMagic));
+	header.databaseVersionLength = static_cast<quint64>(m_databaseVersion.size());
+	file.write(reinterpret_cast<const char *>(&header), sizeof(Header));
+	file.write(m_databaseVersion);
+	file.write(QByteArray(static_cast<int>(paddedLength(header.databaseVersionLength) - header.databaseVersionLength), '\0'));
+
+	std::size_t oldIdx = 0;
+	auto addedIt = added.cbegin();
+
+	const std::size_t oldEntryCount = (m_isProvisional ? 0 : m_entryCount);
+
+	while(oldIdx < oldEntryCount || addedIt != added.cend()) {
+		if(addedIt == added.cend() || (oldIdx < oldEntryCount && isBefore(m_entries[oldIdx], *addedIt))) {
+			chunk.push_back(m_entries[oldIdx]);
+			++oldIdx;
+		}
+		else {
+			if(oldIdx < oldEntryCount && !isBefore(*addedIt, m_entries[oldIdx])) {
+				// same file - the new entry wins
+				++oldIdx;
+			}
+
+			chunk.push_back(*addedIt);
+			++addedIt;
+		}
+
+		write(false);
+	}
+
+	write(true);
+	header.entryCount = entryCount;
+
+	if(!file.seek(0) || static_cast<qint64>(sizeof(Header)) != file.write(reinterpret_cast<const char *>(&header), sizeof(Header)) || !file.commit()) {
+qDebug() << "failed to write scan cache" << m_path;
+		return false;
+	}
+
+qDebug() << "saved scan cache" << m_path << "with" << entryCount << "files";
+	return true;
+}
+
+void ScanCache::close() {
+	if(m_entries) {
+		m_file.unmap(reinterpret_cast<uchar *>(const_cast<Key *>(m_entries)));
+		m_entries = nullptr;
+	}
+
+	m_file.close();
+	m_entryCount = 0;
+	m_filter.clear();
+	m_added.clear();
+	m_databaseVersion.clear();
+	m_isProvisional = false;
+	m_isOpen = false;
+}
+
+/**
+ * Check whether a file, as it is now, was found to be clean by an earlier scan.
+ */
+bool ScanCache::isClean(const Key & key) const {
+	if(!mayContain(key)) {
+		return false;
+	}
+
+	const Key * end = m_entries + m_entryCount;
+	const Key * entry = std::lower_bound(m_entries, end, key, isBefore);
+	return entry != end && *entry == key;
+}
+
+/**
+ * Find when the version of a file that is in the cache was made.
+ *
+ * Unlike isClean() this matches on device and inode alone, so it finds the entry for a file that has changed since.
+ * The Bloom filter covers whole keys, so it can't help here.
+ */
+qint64 ScanCache::cleanTime(const struct stat & st) const {
+	const Key key = ScanCache::key(st);
+	const Key * end = m_entries + m_entryCount;
+	const Key * entry = std::lower_bound(m_entries, end, key, isBefore);
+
+	if(entry == end || entry->device != key.device || entry->inode != key.inode) {
+		return -1;
+	}
+
+	return entry->ctime;
+}
+
+/**
+ * Record that a file has been found to be clean.
+ *
+ * The entry only becomes visible to isClean() once the cache has been saved and opened again.
+ */
+void ScanCache::addClean(const Key & key) {
+	std::lock_guard<std::mutex> lock(m_addedLock);
+	m_added.push_back(key);
+}
+
+bool ScanCache::mayContain(const Key & key) const {
+	if(0 == m_entryCount) {
+		return false;
+	}
+
+	const quint64 bitCount = m_filter.size() * 64;
+	const quint64 value = hash(key);
+	quint64 probe = value;
+	const quint64 step = (value >> 32) | 1;
+
+	for(int idx = 0; idx < FilterProbes; ++idx) {
+		const quint64 bit = probe & (bitCount - 1);
+
+		if(0 == (m_filter[bit / 64] & (quint64(1) << (bit % 64)))) {
+			return false;
+		}
+
+		probe += step;
+	}
+
+	return true;
+}
+
+void ScanCache::addToFilter(const Key & key) {
+	const quint64 bitCount = m_filter.size() * 64;
+	const quint64 value = hash(key);
+	quint64 probe = value;
+	const quint64 step = (value >> 32) | 1;
+
+	for(int idx = 0; idx < FilterProbes; ++idx) {
+		const quint64 bit = probe & (bitCount - 1);
+		m_filter[bit / 64] |= quint64(1) << (bit % 64);
+		probe += step;
+	}
+}
@@ -0,0 +1,102 @@
+#ifndef QLAM_SCANCACHE_H
+#define QLAM_SCANCACHE_H
+
+#include <mutex>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include <QtCore/QByteArray>
+#include <QtCore/QFile>
+#include <QtCore/QList>
+#include <QtCore/QString>
+
+namespace Qlam {
+	/**
+	 * A persistent record of the files found to be clean by earlier scans.
+	 *
+	 * Files are identified by device, inode, size, mtime and ctime, so any change to a file - including one made with
+	 * its mtime put back afterwards, since ctime can't be set - takes it out of the cache. The cache as a whole is tied
+	 * to the versions of the signature databases it was built with and is discarded when they change - unless a
+	 * signature delta can bring it up to date, in which case it is opened as provisional: the files in it still need
+	 * checking against the new signatures, and only the ones that have been are kept when it is saved.
+	 *
+	 * The table on disk is sorted by device and inode and is mapped rather than read, so opening even a very large cache
+	 * is cheap. A Bloom filter built when the cache is loaded sits in front of the table so that looking up a file
+	 * that isn't there rarely touches it.
+	 */
+	class ScanCache {
+		public:
+			struct Key {
+				quint64 device;
+				quint64 inode;
+				quint64 size;
+
+				// ns since the epoch
+				qint64 mtime;
+				qint64 ctime;
+
+				bool operator==(const Key & other) const {
+					return device == other.device && inode == other.inode && size == other.size && mtime == other.mtime && ctime == other.ctime;
+				}
+			};
+
+			explicit ScanCache(QString path = defaultPath());
+			~ScanCache();
+
+			ScanCache(const ScanCache &) = delete;
+			ScanCache & operator=(const ScanCache &) = delete;
+
+			static QString defaultPath();
+			static Key key(const struct stat &);
+
+			/* forget every file found clean. a scan using the cache when it is cleared writes it back when it finishes */
+			static bool clear(const QString & path = defaultPath());
+
+			const QString & path() const {
+				return m_path;
+			}
+
+			bool isOpen() const {
+				return m_isOpen;
+			}
+
+			/* whether the entries are from one of the base versions given to open() rather than the current one */
+			bool isProvisional() const {
+				return m_isProvisional;
+			}
+
+			bool open(const QByteArray & databaseVersion, const QList<QByteArray> & baseVersions = {});
+			bool save();
+			void close();
+
+			/* thread safe once open() has returned */
+			bool isClean(const Key &) const;
+			void addClean(const Key &);
+
+			/* the ctime of the version of the file that was last found clean, in ns since the epoch - -1 if no version
+			 * of it is in the cache. thread safe once open() has returned */
+			qint64 cleanTime(const struct stat &) const;
+
+		private:
+			bool mayContain(const Key &) const;
+			void addToFilter(const Key &);
+
+			QString m_path;
+			bool m_isOpen;
+			bool m_isProvisional;
+			QByteArray m_databaseVersion;
+
+			// the table from the last save, mapped from the file
+			QFile m_file;
+			const Key * m_entries;
+			std::size_t m_entryCount;
+
+			std::vector<quint64> m_filter;
+
+			std::mutex m_addedLock;
+			std::vector<Key> m_added;
+	};
+}
+
+#endif // QLAM_SCANCACHE_H
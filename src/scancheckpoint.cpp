@@ -0,0 +1,454 @@
+#include "scancheckpoint.h"
+
+#include <algorithm>
+#include <ctime>
+
+#include <unistd.h>
+
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QDebug>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QSaveFile>
+#include <QtCore/QStandardPaths>
+
+using namespace Qlam;
+
+// identifies a checkpoint file, and the version of its layout
+static constexpr const char FileMagic[] = "QLAMCKP1";
+
+// how often, in ms, the checkpoint is rewritten while the scan makes progress
+static constexpr const qint64 SaveInterval = 15000;
+
+namespace {
+	// ms
+	qint64 monotonicTime() {
+		struct timespec now{};
+		::clock_gettime(CLOCK_MONOTONIC, &now);
+		return static_cast<qint64>(now.tv_sec) * 1000 + now.tv_nsec / 1000000;
+	}
+
+	// paths are tracked without a trailing separator, so that a subdirectory's path always extends its parent's
+	QByteArray normalised(const QByteArray & path) {
+		QByteArray ret = path;
+
+		while(1 < ret.size() && ret.endsWith('/')) {
+			ret.chop(1);
+		}
+
+		return ret;
+	}
+
+	QByteArray parentPath(const QByteArray & path) {
+		const int idx = path.lastIndexOf('/');
+
+		if(0 > idx || "/" == path) {
+			return {};
+		}
+
+		return (0 == idx ? QByteArray("/") : path.left(idx));
+	}
+}
+
+ScanCheckpoint::ScanCheckpoint(QString directory)
+: m_directory(std::move(directory)),
+  m_fileName(),
+  m_header(),
+  m_resumedDirectoryCount(0),
+  m_resumedIssues(),
+  m_directories(),
+  m_finished(),
+  m_cursors(),
+  m_issues(),
+  m_lastSave(0),
+  m_snapshotSequence(0),
+  m_writtenSequence(0) {
+}
+
+QString ScanCheckpoint::defaultDirectory() {
+	return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + QStringLiteral("/checkpoints");
+}
+
+/**
+ * Start recording the progress of a profile's scan.
+ *
+ * If the profile has a checkpoint from a scan of the same paths with the same signatures, the subtrees it had
+ * finished and the issues it had found in them are carried over. Returns false if there is no profile or no database
+ * version to tie the checkpoint to.
+ */
+bool ScanCheckpoint::open(const QString & profileName, const QByteArray & databaseVersion, const QStringList & scanPaths) {
+	close();
+
+	if(profileName.isEmpty() || databaseVersion.isEmpty()) {
+		return false;
+	}
+
+	QStringList sortedPaths = scanPaths;
+	sortedPaths.sort();
+
+	m_header = QByteArray(FileMagic) + '\0' + databaseVersion + '\0' + QCryptographicHash::hash(sortedPaths.join(QChar('\0')).toUtf8(), QCryptographicHash::Sha256).toHex() + '\0';
+	m_fileName = m_directory + '/' + QString::fromLatin1(QCryptographicHash::hash(profileName.toUtf8(), QCryptographicHash::Sha256).toHex().left(32)) + QStringLiteral(".checkpoint");
+	m_lastSave = monotonicTime();
+	QDir().mkpath(m_directory);
+
+	QFile file(m_fileName);
+
+	if(!file.open(QIODevice::ReadOnly)) {
+		return true;
+	}
+
+	const QByteArray data = file.readAll();
+
+	if(!data.startsWith(m_header)) {
+qDebug() << "checkpoint" << m_fileName << "is from a scan of other paths or with other signatures - starting from the beginning";
+		file.close();
+		QFile::remove(m_fileName);
+		return true;
+	}
+
+	// each record is a type followed by NUL-terminated fields: 'D' and the path of a finished subtree, 'I' and the
+	// path of a file with an issue and the issue's name, or 'C' and the path of a directory and its cursor
+	int pos = m_header.size();
+
+	while(pos < data.size()) {
+		const char type = data.at(pos++);
+		const int pathEnd = data.indexOf('\0', pos);
+
+		if(-1 == pathEnd) {
+			break;
+		}
+
+		const QByteArray path = data.mid(pos, pathEnd - pos);
+		pos = pathEnd + 1;
+
+		if('D' == type) {
+			m_finished.insert(path);
+		}
+		else if('I' == type) {
+			const int nameEnd = data.indexOf('\0', pos);
+
+			if(-1 == nameEnd) {
+				break;
+			}
+
+			m_issues.push_back({QString::fromUtf8(path), QString::fromUtf8(data.mid(pos, nameEnd - pos))});
+			pos = nameEnd + 1;
+		}
+		else if('C' == type) {
+			const int cursorEnd = data.indexOf('\0', pos);
+
+			if(-1 == cursorEnd) {
+				break;
+			}
+
+			m_cursors.insert(path, data.mid(pos, cursorEnd - pos));
+			pos = cursorEnd + 1;
+		}
+		else {
+			break;
+		}
+	}
+
+	// files outside the finished subtrees are scanned again, and report their issues again if they still have them
+	m_issues.erase(std::remove_if(m_issues.begin(), m_issues.end(), [this](const Issue & issue) {
+		return !isInFinishedSubtree(QFile::encodeName(issue.path));
+	}), m_issues.end());
+
+	m_resumedDirectoryCount = m_finished.size();
+	m_resumedIssues = m_issues;
+qDebug() << "resuming scan from checkpoint" << m_fileName << "with" << m_resumedDirectoryCount << "finished directories and" << m_issues.size() << "issues";
+	return true;
+}
+
+/**
+ * Write the checkpoint now, rather than waiting for the next periodic save.
+ */
+bool ScanCheckpoint::save() {
+	std::unique_lock<std::mutex> lock(m_lock);
+	return write(lock);
+}
+
+/**
+ * Stop recording. A save that's under way is finished first, and one that's still to start is dropped.
+ */
+void ScanCheckpoint::close() {
+	std::lock_guard<std::mutex> writeLock(m_writeLock);
+	std::lock_guard<std::mutex> lock(m_lock);
+	clear();
+}
+
+void ScanCheckpoint::discard() {
+	std::lock_guard<std::mutex> writeLock(m_writeLock);
+	std::lock_guard<std::mutex> lock(m_lock);
+
+	if(isOpen()) {
+		QFile::remove(m_fileName);
+	}
+
+	clear();
+}
+
+/**
+ * m_writeLock and m_lock must be held.
+ */
+void ScanCheckpoint::clear() {
+	m_fileName.clear();
+	m_header.clear();
+	m_resumedDirectoryCount = 0;
+	m_resumedIssues.clear();
+	m_directories.clear();
+	m_finished.clear();
+	m_cursors.clear();
+	m_issues.clear();
+
+	// snapshots taken before now belong to the checkpoint that was closed
+	m_writtenSequence = m_snapshotSequence;
+}
+
+/**
+ * Record that the walk has found a directory.
+ *
+ * Must be called before the directory is read, and before its parent is finished. Returns false if the scan being
+ * resumed had already finished the directory's subtree, in which case it must not be read.
+ */
+bool ScanCheckpoint::addDirectory(const QByteArray & path) {
+	const QByteArray key = normalised(path);
+	std::lock_guard<std::mutex> lock(m_lock);
+	auto parent = m_directories.find(parentPath(key));
+
+	if(m_finished.contains(key)) {
+		if(parent != m_directories.end()) {
+			parent->finishedChildren.push_back(key);
+		}
+
+		return false;
+	}
+
+	auto directory = m_directories.find(key);
+
+	// reached again, e.g. as a directory on another device that is handed to that device's walk - it is finished when
+	// every visit is
+	if(directory != m_directories.end()) {
+		++directory->outstanding;
+		return true;
+	}
+
+	if(parent != m_directories.end()) {
+		++parent->outstanding;
+	}
+
+	m_directories.insert(key, {1, false, {}, {}});
+	return true;
+}
+
+/**
+ * Record that a directory has been read and all the files found in it have been dealt with.
+ */
+void ScanCheckpoint::finishDirectory(const QByteArray & path) {
+	const QByteArray key = normalised(path);
+	std::unique_lock<std::mutex> lock(m_lock);
+	auto directory = m_directories.find(key);
+
+	if(directory == m_directories.end()) {
+		return;
+	}
+
+	if(0 == --directory->outstanding) {
+		finishSubtree(key);
+	}
+
+	saveIfDue(lock);
+}
+
+/**
+ * Record that a file in a directory couldn't be scanned, so that neither the directory nor any directory above it
+ * is ever finished.
+ */
+void ScanCheckpoint::failDirectory(const QByteArray & path) {
+	const QByteArray key = normalised(path);
+	std::lock_guard<std::mutex> lock(m_lock);
+	auto directory = m_directories.find(key);
+
+	if(directory != m_directories.end()) {
+		directory->isFailed = true;
+	}
+}
+
+void ScanCheckpoint::addIssue(const QString & path, const QString & name) {
+	std::unique_lock<std::mutex> lock(m_lock);
+	m_issues.push_back({path, name});
+	saveIfDue(lock);
+}
+
+QByteArray ScanCheckpoint::resumeCursor(const QByteArray & path) {
+	const QByteArray key = normalised(path);
+	std::lock_guard<std::mutex> lock(m_lock);
+	return m_cursors.value(key);
+}
+
+/**
+ * Record that the walk has handed out a file in a directory that isn't finished.
+ */
+void ScanCheckpoint::addFile(const QByteArray & directory, const QByteArray & name) {
+	const QByteArray key = normalised(directory);
+	std::lock_guard<std::mutex> lock(m_lock);
+	auto entry = m_directories.find(key);
+
+	// the cursor of a directory with a file that couldn't be scanned stays before that file
+	if(entry != m_directories.end() && !entry->isFailed) {
+		entry->files.emplace_back(name, false);
+	}
+}
+
+/**
+ * Record that a file has been dealt with, moving its directory's cursor past it if every file before it has been.
+ */
+void ScanCheckpoint::finishFile(const QByteArray & directory, const QByteArray & name) {
+	const QByteArray key = normalised(directory);
+	std::unique_lock<std::mutex> lock(m_lock);
+	auto entry = m_directories.find(key);
+
+	if(entry == m_directories.end()) {
+		return;
+	}
+
+	if(entry->isFailed) {
+		entry->files.clear();
+		return;
+	}
+
+	auto file = std::find_if(entry->files.begin(), entry->files.end(), [&name](const std::pair<QByteArray, bool> & file) {
+		return file.first == name;
+	});
+
+	if(file == entry->files.end()) {
+		return;
+	}
+
+	file->second = true;
+
+	if(file != entry->files.begin()) {
+		return;
+	}
+
+	while(!entry->files.empty() && entry->files.front().second) {
+		m_cursors.insert(key, entry->files.front().first);
+		entry->files.pop_front();
+	}
+
+	saveIfDue(lock);
+}
+
+/**
+ * Check whether a file is in one of the finished subtrees, i.e. whether the scan won't look at it again.
+ */
+bool ScanCheckpoint::isInFinishedSubtree(const QByteArray & path) const {
+	for(QByteArray directory = parentPath(normalised(path)); !directory.isEmpty(); directory = parentPath(directory)) {
+		if(m_finished.contains(directory)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/**
+ * Replace the entries for a directory's finished subdirectories with one for the directory, and work up through the
+ * parents that this finishes in turn.
+ *
+ * m_lock must be held.
+ */
+void ScanCheckpoint::finishSubtree(QByteArray path) {
+	while(true) {
+		auto directory = m_directories.find(path);
+
+		if(directory == m_directories.end()) {
+			return;
+		}
+
+		const bool isFailed = directory->isFailed;
+		const std::vector<QByteArray> children = std::move(directory->finishedChildren);
+		m_directories.erase(directory);
+
+		if(isFailed) {
+			return;
+		}
+
+		for(const auto & child : children) {
+			m_finished.remove(child);
+		}
+
+		m_finished.insert(path);
+		m_cursors.remove(path);
+		auto parent = m_directories.find(parentPath(path));
+
+		if(parent == m_directories.end()) {
+			return;
+		}
+
+		parent->finishedChildren.push_back(path);
+
+		if(0 < --parent->outstanding) {
+			return;
+		}
+
+		path = parent.key();
+	}
+}
+
+/**
+ * lock must hold m_lock, and is released if the checkpoint is saved.
+ */
+void ScanCheckpoint::saveIfDue(std::unique_lock<std::mutex> & lock) {
+	if(SaveInterval <= monotonicTime() - m_lastSave) {
+		write(lock);
+	}
+}
+
+/**
+ * Take a snapshot of the checkpoint and write it out.
+ *
+ * lock must hold m_lock. It is released once the snapshot is taken, so that the walker and the workers aren't held up
+ * while the file is written and synced.
+ */
+bool ScanCheckpoint::write(std::unique_lock<std::mutex> & lock) {
+	if(m_fileName.isEmpty()) {
+		return false;
+	}
+
+	m_lastSave = monotonicTime();
+	const quint64 sequence = ++m_snapshotSequence;
+	const QString fileName = m_fileName;
+	QByteArray data = m_header;
+
+	for(const auto & path : m_finished) {
+		data.append('D').append(path).append('\0');
+	}
+
+	for(auto cursor = m_cursors.cbegin(); cursor != m_cursors.cend(); ++cursor) {
+		data.append('C').append(cursor.key()).append('\0').append(cursor.value()).append('\0');
+	}
+
+	for(const auto & issue : m_issues) {
+		data.append('I').append(issue.path.toUtf8()).append('\0').append(issue.name.toUtf8()).append('\0');
+	}
+
+	lock.unlock();
+	std::lock_guard<std::mutex> writeLock(m_writeLock);
+
+	// a later snapshot has been written already, or the checkpoint has been closed since
+	if(sequence <= m_writtenSequence) {
+		return true;
+	}
+
+	// the checkpoint has to survive the machine going down, which is one of the things it's for
+	QSaveFile file(fileName);
+
+	if(!file.open(QIODevice::WriteOnly) || data.size() != file.write(data) || !file.flush() || 0 != ::fsync(file.handle()) || !file.commit()) {
+qDebug() << "failed to write checkpoint" << fileName;
+		return false;
+	}
+
+	m_writtenSequence = sequence;
+	return true;
+}
@@ -0,0 +1,121 @@
+#ifndef QLAM_SCANCHECKPOINT_H
+#define QLAM_SCANCHECKPOINT_H
+
+#include <deque>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <QtCore/QByteArray>
+#include <QtCore/QHash>
+#include <QtCore/QSet>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+
+namespace Qlam {
+	/**
+	 * The progress of a profile's scan, saved so that an interrupted scan can carry on where it left off.
+	 *
+	 * The checkpoint tracks which directory subtrees the scan has finished with: a directory is finished once it has
+	 * been read, every file in it has been scanned and every subdirectory is finished. Only the outermost finished
+	 * subtrees are kept - when a directory is finished its subdirectories' entries are replaced by its own - so the
+	 * checkpoint stays small however much of the tree has been scanned. A directory containing a file that couldn't be
+	 * scanned is never finished, so the resumed scan tries the file again.
+	 *
+	 * A walk that hands out each directory's files in name order can also track how far it got through the
+	 * directories it hasn't finished: each has a cursor, the last file dealt with along with every file before it, so
+	 * that a resumed scan can carry on from there rather than from the directory's first file.
+	 *
+	 * The checkpoint is rewritten from time to time as the scan goes on, along with the issues found so far, and
+	 * again when the scan is aborted. It is only resumed by a scan of the same paths with the same signatures.
+	 */
+	class ScanCheckpoint {
+		public:
+			struct Issue {
+				QString path;
+				QString name;
+			};
+
+			explicit ScanCheckpoint(QString directory = defaultDirectory());
+
+			ScanCheckpoint(const ScanCheckpoint &) = delete;
+			ScanCheckpoint & operator=(const ScanCheckpoint &) = delete;
+
+			static QString defaultDirectory();
+
+			bool isOpen() const {
+				return !m_fileName.isEmpty();
+			}
+
+			bool open(const QString & profileName, const QByteArray & databaseVersion, const QStringList & scanPaths);
+			bool save();
+			void close();
+
+			/* remove the checkpoint - the scan has run to the end */
+			void discard();
+
+			/* the number of finished subtrees and the issues carried over from the checkpoint that was resumed */
+			int resumedDirectoryCount() const {
+				return m_resumedDirectoryCount;
+			}
+
+			const std::vector<Issue> & resumedIssues() const {
+				return m_resumedIssues;
+			}
+
+			/* thread safe once open() has returned */
+			bool addDirectory(const QByteArray & path);
+			void finishDirectory(const QByteArray & path);
+			void failDirectory(const QByteArray & path);
+			void addIssue(const QString & path, const QString & name);
+
+			/* the last file in a directory that was dealt with along with every file before it - empty if none was.
+			 * thread safe once open() has returned */
+			QByteArray resumeCursor(const QByteArray & path);
+
+			/* thread safe once open() has returned. files must be added in the order they're handed out, after the
+			 * directory is added */
+			void addFile(const QByteArray & directory, const QByteArray & name);
+			void finishFile(const QByteArray & directory, const QByteArray & name);
+
+		private:
+			struct Directory {
+				// the directory's own files, plus its subdirectories that aren't finished
+				int outstanding;
+				bool isFailed;
+				std::vector<QByteArray> finishedChildren;
+
+				// the files handed out and not yet passed by the cursor, in order, and whether each has been dealt with
+				std::deque<std::pair<QByteArray, bool>> files;
+			};
+
+			bool isInFinishedSubtree(const QByteArray & path) const;
+			void finishSubtree(QByteArray path);
+			void clear();
+			bool write(std::unique_lock<std::mutex> & lock);
+			void saveIfDue(std::unique_lock<std::mutex> & lock);
+
+			QString m_directory;
+			QString m_fileName;
+			QByteArray m_header;
+			int m_resumedDirectoryCount;
+			std::vector<Issue> m_resumedIssues;
+
+			std::mutex m_lock;
+			QHash<QByteArray, Directory> m_directories;
+			QSet<QByteArray> m_finished;
+
+			// the cursors of the directories that aren't finished, by directory
+			QHash<QByteArray, QByteArray> m_cursors;
+			std::vector<Issue> m_issues;
+			qint64 m_lastSave;
+
+			// the file is written and synced outside m_lock, one snapshot at a time under m_writeLock. each snapshot is
+			// numbered as it's taken so that an older one is never written over a newer one
+			quint64 m_snapshotSequence;
+			std::mutex m_writeLock;
+			quint64 m_writtenSequence;
+	};
+}
+
+#endif // QLAM_SCANCHECKPOINT_H
@@ -9,11 +9,32 @@
 #include <QtCore/QFileInfo>
 #include <QtCore/QRegExp>
 #include <QtCore/QDir>
+#include <QtCore/QFile>
 #include <QtCore/QTimerEvent>
+#include <QtCore/QMetaMethod>
+#include <QtCore/QDateTime>
+#include <algorithm>
+#include <cstring>
+#include <chrono>
+#include <ctime>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 #include <clamav.h>
 #include "application.h"
+#include "changejournal.h"
+#include "cpubudget.h"
+#include "directorywalker.h"
 #include "infectedfile.h"
+#include "pagecachefootprint.h"
 #include "scannerheuristicmatch.h"
+#include "scrubschedule.h"
+#include "signaturedelta.h"
+#include "sparsefile.h"
 
 // how long to wait for a running scan to abort before forcing it in the destructor - comes into play when the
 // application closes (i.e. user clicks close button) while a scan is in progress
@@ -60,9 +81,151 @@ static constexpr uint32_t DefaultMailScanOptions = static_cast<uint32_t>(CL_SCAN
 
 static const auto HeuristicMatchPrefix = QStringLiteral("Heuristics."); // NOLINT(cert-err58-cpp)
 
-// error return codes for countFiles()
-static const int ErrPathDoesNotExist = -1;
-static const int ErrUncountablePath = -2;
+// rotating disks are scanned by at most this many workers - more just makes the heads seek from file to file
+static constexpr const int RotatingConcurrency = 2;
+
+// network filesystems are mostly latency rather than CPU, so they get this many times the usual number of workers
+static constexpr const int NetworkConcurrencyFactor = 2;
+
+// high-latency filesystems are walked by at least this many threads, so that many stat()s are waiting at once, and
+// have at least this many files being opened and read ahead at once
+static constexpr const int HighLatencyWalkerThreads = 16;
+static constexpr const std::size_t HighLatencyReadAheadDepth = 128;
+
+// files on high-latency filesystems up to this size are streamed into memory before they're scanned, so that the
+// filesystem sees a few large reads rather than one round trip for each of libclamav's small ones
+static constexpr const std::size_t StagingSize = 8 * 1024 * 1024;
+
+// files up to this size are read with a single pread into the worker's arena and scanned from memory, which costs far
+// less than libclamav setting up a map of the file and reading it itself
+static constexpr const std::size_t SmallFileSize = 64 * 1024;
+
+// each worker reports its progress once it has scanned this many files, or after this long if sooner - every report
+// waits for the widget, which would cost more than scanning a small file if it was done for each one
+static constexpr const int ProgressBatchSize = 64;
+static constexpr const qint64 ProgressInterval = 100;
+
+// a file whose ctime is this recent when its scan finishes isn't cached, since a change made within the granularity
+// of the filesystem's timestamps wouldn't show up in them
+static constexpr const qint64 RecentChangeWindow = 2000000000;
+
+// how often the tuner measures throughput and considers changing the number of active workers
+static constexpr const std::chrono::milliseconds TuningInterval(1000);
+
+// the tuner stops adding workers once the workers spend more than this fraction of their time waiting rather than on
+// the CPU - more threads only add to the I/O queue at that point
+static constexpr const double IoWaitDominates = 0.5;
+
+// an increase in workers must improve throughput by at least this fraction to be kept
+static constexpr const double MinTuningGain = 0.05;
+
+// how many intervals the tuner waits after backing off before it tries adding workers again
+static constexpr const int TuningHoldIntervals = 10;
+
+// the priorities a scrub's threads run at: the lowest niceness, and the lowest level of the best-effort I/O class
+// (IOPRIO_CLASS_BE << IOPRIO_CLASS_SHIFT | 7)
+static constexpr const int BackgroundNiceness = 19;
+static constexpr const int BackgroundIoPriority = (2 << 13) | 7;
+
+// a scrub's checkpoint is opened with this in place of the signature version, so that a cycle carries on across
+// database updates
+static constexpr const char ScrubCheckpointVersion[] = "scrub";
+
+// a scan with a deadline queues this many files per device, so that the riskiest of a large stretch of the walk can go
+// first. every queued file holds its directory open, so it is kept well inside common descriptor limits
+static constexpr const std::size_t DeadlineQueueCapacity = 16384;
+
+/**
+ * The CPU time consumed so far by the calling thread, in ns.
+ */
+static qint64 threadCpuTime() {
+	struct timespec time{};
+
+	if(0 != ::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time)) {
+		return 0;
+	}
+
+	return static_cast<qint64>(time.tv_sec) * 1000000000 + time.tv_nsec;
+}
+
+/**
+ * The time by the system clock, in ns since the epoch.
+ */
+static qint64 realTime() {
+	struct timespec time{};
+
+	if(0 != ::clock_gettime(CLOCK_REALTIME, &time)) {
+		return 0;
+	}
+
+	return static_cast<qint64>(time.tv_sec) * 1000000000 + time.tv_nsec;
+}
+
+/**
+ * Read the whole of a file into a buffer size bytes long.
+ *
+ * Returns false if the file can't be read or turns out to be shorter.
+ */
+static bool readWhole(int fd, char * buffer, std::size_t size) {
+	std::size_t offset = 0;
+
+	while(offset < size) {
+		const ssize_t bytesRead = ::pread(fd, buffer + offset, size - offset, static_cast<off_t>(offset));
+
+		if(0 > bytesRead) {
+			if(EINTR == errno) {
+				continue;
+			}
+
+			return false;
+		}
+
+		if(0 == bytesRead) {
+			return false;
+		}
+
+		offset += static_cast<std::size_t>(bytesRead);
+	}
+
+	return true;
+}
+
+/**
+ * Move the calling thread, and the threads it starts from now on, to background priority.
+ *
+ * The idle scheduling classes aren't used, since on a server that is never idle a scrub running in them would never
+ * finish.
+ */
+static void useBackgroundPriority() {
+	if(0 != ::setpriority(PRIO_PROCESS, static_cast<id_t>(::syscall(SYS_gettid)), BackgroundNiceness)) {
+		qDebug() << "failed to lower thread priority:" << std::strerror(errno);
+	}
+
+	// IOPRIO_WHO_PROCESS, which for a thread ID means just that thread
+	if(0 != ::syscall(SYS_ioprio_set, 1, 0, BackgroundIoPriority)) {
+		qDebug() << "failed to lower I/O priority:" << std::strerror(errno);
+	}
+}
+
+/**
+ * Raise the soft limit on open descriptors to the hard limit.
+ *
+ * Every directory with files waiting in the scan queue is held open so that its files can be opened relative to it,
+ * which can exceed the common default soft limit of 1024 on wide trees.
+ */
+static void raiseOpenFileLimit() {
+	struct rlimit limit{};
+
+	if(0 != ::getrlimit(RLIMIT_NOFILE, &limit) || limit.rlim_cur >= limit.rlim_max) {
+		return;
+	}
+
+	limit.rlim_cur = limit.rlim_max;
+
+	if(0 != ::setrlimit(RLIMIT_NOFILE, &limit)) {
+		qDebug() << "failed to raise open file limit:" << std::strerror(errno);
+	}
+}
 
 Scanner::Scanner( const QString & scanPath, QObject * parent )
 : Scanner(QStringList() << scanPath, parent) {
@@ -71,181 +234,1032 @@ Scanner::Scanner( const QString & scanPath, QObject * parent )
 Scanner::Scanner( const QStringList & scanPaths, QObject * parent )
 : QThread(parent),
   m_scanPaths(),
-  m_scannedDirs(),
-  m_countedDirs(),
+  m_workerCount(0),
+  m_orderedWalk(false),
+  m_scanOrder(ScanOrder::Discovery),
+  m_scanHardLinksOnce(false),
+  m_largeFilesFirst(false),
+  m_useReadAhead(true),
+  m_preservePageCache(false),
+  m_stageRemoteFiles(true),
+  m_useScanCache(false),
+  m_useScanStamps(false),
+  m_scanStampKeyFile(),
+  m_useSignatureDelta(false),
+  m_useManifest(false),
+  m_manifestFiles(),
+  m_changeJournalName(),
+  m_incremental(false),
+  m_checkpointName(),
+  m_scrubPeriod(0),
+  m_sliceDuration(0),
+  m_sliceSize(0),
+  m_deadline(0),
+  m_deduplicateContent(false),
+  m_scannedLinks(),
+  m_scanCache(),
+  m_scanCacheActive(false),
+  m_deltaEngine(nullptr),
+  m_scanStamp(),
+  m_scanStampsActive(false),
+  m_checkpoint(),
+  m_checkpointActive(false),
+  m_fileCursorsActive(false),
+  m_sliceSizeLimit(0),
+  m_sliceRequiredSize(0),
+  m_sliceDeadline(0),
+  m_sliceEnded(false),
+  m_scrubCycleScanned(0),
+  m_scrubCycleSize(0),
+  m_deadlineStopped(false),
+  m_deadlineReached(false),
+  m_coverage(),
+  m_manifest(),
+  m_manifestActive(false),
+  m_contentIndex(),
+  m_poolWorkerCount(1),
+  m_autoTune(false),
+  m_mounts(),
+  m_pools(),
+  m_pendingWalkCount(0),
+  m_activeWalkCount(0),
   m_issues(),
-  m_fileCount(),
+  m_issueCount(0),
+  m_discoveredFileCount(0),
+  m_walkComplete(false),
   m_scannedFileCount(0),
+  m_cachedFileCount(0),
+  m_deltaScannedFileCount(0),
+  m_stampedFileCount(0),
+  m_knownGoodFileCount(0),
+  m_dedupedFileCount(0),
   m_failedScanCount(0),
   m_scannedDataSize(0),
+  m_holeDataSize(0),
+  m_scanTimer(),
+  m_idleTailTime(0),
+  m_readAheadStats(),
+  m_mountLatencies(),
+  m_activeWorkerCount(0),
+  m_concurrency(0),
+  m_tuningStopped(false),
+  m_tunedFileCount(0),
+  m_tunedDataSize(0),
+  m_scanWallTime(0),
+  m_scanCpuTime(0),
   m_scanEngine(nullptr),
   m_abortFlag(false) {
 	setScanPaths(scanPaths);
     connect(Application::instance(), &Application::aboutToQuit, this, &Scanner::abort);
 }
 
-Scanner::~Scanner() {
-	if(isRunning()) {
-qDebug() << "scan in progress - attempting to abort";
-		abort();
+Scanner::~Scanner() {
+	if(isRunning()) {
+qDebug() << "scan in progress - attempting to abort";
+		abort();
+
+		/* wait up to 20 sec. for graceful exit */
+		if(!wait(QLAM_SCANNER_DESTROY_WAIT_TIMEOUT)) {
+qDebug() << "scan did not abort after" << QLAM_SCANNER_DESTROY_WAIT_TIMEOUT << "ms - destroying anyway (program will probably crash)";
+
+			if(m_scanEngine) {
+qDebug() << "forcing release of scan engine";
+				m_scanEngine = nullptr;
+				Application::instance()->releaseEngine();
+			}
+		}
+	}
+}
+
+
+Scanner::DevicePool::DevicePool(dev_t dev, MountTable::StorageType type, int workers, bool isTuned, const std::atomic<bool> & abortFlag)
+: device(dev),
+  storage(type),
+  mountPoint(),
+  concurrency(workers),
+  tuned(isTuned),
+  queue(),
+  readAhead(),
+  readAheadThread(),
+  walker(abortFlag, workers),
+  workers(),
+  walkThread(),
+  pendingDirectories(),
+  firstWorkerFinished(-1),
+  lastWorkerFinished(-1),
+  openCount(0),
+  openTime(0),
+  readCount(0),
+  readTime(0),
+  readSize(0) {
+}
+
+/**
+ * The body of each scan worker thread.
+ *
+ * Workers all scan against the same compiled engine, which libclamav allows. They keep taking files from their device's
+ * queue until the walk has finished and the queue is drained, or the scan is aborted. A worker whose index is beyond
+ * the current concurrency waits between files until the tuner lets it in, and leaves once tuning stops.
+ */
+void Scanner::scanWorker(DevicePool * pool, int idx) {
+	if(isScrub()) {
+		useBackgroundPriority();
+	}
+
+	int batchCount = 0;
+	qint64 batchStarted = m_scanTimer.elapsed();
+
+	while(waitForTurn(*pool, idx)) {
+		std::optional<ReadAhead::File> file;
+		std::optional<ScanQueue::Item> item;
+
+		if(pool->readAhead) {
+			file = pool->readAhead->next();
+
+			if(file) {
+				item = file->item;
+			}
+		}
+		else {
+			item = pool->queue.pop();
+		}
+
+		if(!item) {
+			qint64 noMoreWork = m_scanTimer.elapsed();
+			qint64 finished = -1;
+			pool->firstWorkerFinished.compare_exchange_strong(finished, noMoreWork);
+			finished = pool->lastWorkerFinished;
+
+			while(finished < noMoreWork && !pool->lastWorkerFinished.compare_exchange_weak(finished, noMoreWork)) {
+			}
+
+			if(0 < batchCount) {
+				Q_EMIT filesScanned(batchCount, QString());
+			}
+
+			return;
+		}
+
+		if(m_abortFlag) {
+			countSkipped(item->riskType, item->size);
+
+			if(file && -1 != file->fd) {
+				::close(file->fd);
+			}
+
+			return;
+		}
+
+		const ReadAhead::File * readFile = (file ? &*file : nullptr);
+
+		if(!pool->tuned) {
+			scanFile(*item, readFile, pool);
+		}
+		else {
+			qint64 wallStart = m_scanTimer.nsecsElapsed();
+			qint64 cpuStart = threadCpuTime();
+			m_tunedDataSize += scanFile(*item, readFile, pool);
+			m_scanCpuTime += threadCpuTime() - cpuStart;
+			m_scanWallTime += m_scanTimer.nsecsElapsed() - wallStart;
+			++m_tunedFileCount;
+		}
+
+		if(file) {
+			pool->readAhead->release(*file);
+		}
+
+		if(m_fileCursorsActive) {
+			m_checkpoint.finishFile(item->directory->path(), item->name);
+		}
+
+		if(ProgressBatchSize <= ++batchCount || ProgressInterval <= m_scanTimer.elapsed() - batchStarted) {
+			Q_EMIT filesScanned(batchCount, QFile::decodeName(item->directory->filePath(item->name)));
+			batchCount = 0;
+			batchStarted = m_scanTimer.elapsed();
+		}
+
+		if(isScrub()) {
+			checkSlice();
+		}
+	}
+}
+
+/**
+ * End a scrub's slice once it has used up its time or its data.
+ *
+ * The time limit only applies once the slice has scanned what the schedule needs from it. The slice is stopped the
+ * same way as an abort. The checkpoint records the directories that were finished and how far the slice got through
+ * the others, so the next slice carries on from the first file this one didn't deal with.
+ */
+void Scanner::checkSlice() {
+	const unsigned long scanned = m_scannedDataSize;
+	const bool isSizeUsed = (0 < m_sliceSizeLimit && scanned >= m_sliceSizeLimit);
+	const bool isTimeUsed = (0 < m_sliceDeadline && m_scanTimer.elapsed() >= m_sliceDeadline && scanned >= m_sliceRequiredSize);
+
+	if((isSizeUsed || isTimeUsed) && !m_sliceEnded.exchange(true)) {
+		abort();
+	}
+}
+
+/**
+ * Stop the scan when its deadline passes.
+ *
+ * Runs on its own thread for scans with a deadline, until the deadline passes or the workers are done. The scan is
+ * stopped the same way as an abort, so files already being scanned are finished and the rest are counted as skipped.
+ */
+void Scanner::watchDeadline() {
+	std::unique_lock<std::mutex> lock(m_deadlineLock);
+	const auto timeLeft = std::chrono::milliseconds(std::max<qint64>(0, m_deadline - m_scanTimer.elapsed()));
+
+	if(m_deadlineChanged.wait_for(lock, timeLeft, [this]() { return m_deadlineStopped || m_abortFlag.load(); })) {
+		return;
+	}
+
+	lock.unlock();
+	m_deadlineReached = true;
+	abort();
+}
+
+/**
+ * Count a file the walk has found, for the coverage of a scan with a deadline.
+ */
+void Scanner::countDiscovered(FileRisk::Type type, quint64 size) {
+	if(!hasDeadline()) {
+		return;
+	}
+
+	auto & counter = m_coverage[static_cast<std::size_t>(type)];
+	++counter.fileCount;
+	counter.dataSize += size;
+}
+
+/**
+ * Count a file the walk has found that won't be scanned because the scan has stopped.
+ */
+void Scanner::countSkipped(FileRisk::Type type, quint64 size) {
+	if(!hasDeadline()) {
+		return;
+	}
+
+	auto & counter = m_coverage[static_cast<std::size_t>(type)];
+	++counter.skippedFileCount;
+	counter.skippedDataSize += size;
+}
+
+Scanner::Coverage Scanner::coverage() const {
+	Coverage coverage;
+	coverage.isWalkComplete = m_walkComplete;
+
+	for(std::size_t idx = 0; idx < m_coverage.size(); ++idx) {
+		auto & counts = coverage.byType[idx];
+		counts.fileCount = m_coverage[idx].fileCount;
+		counts.skippedFileCount = m_coverage[idx].skippedFileCount;
+		counts.dataSize = m_coverage[idx].dataSize;
+		counts.skippedDataSize = m_coverage[idx].skippedDataSize;
+		coverage.total.fileCount += counts.fileCount;
+		coverage.total.skippedFileCount += counts.skippedFileCount;
+		coverage.total.dataSize += counts.dataSize;
+		coverage.total.skippedDataSize += counts.skippedDataSize;
+	}
+
+	return coverage;
+}
+
+/**
+ * Wait until the worker with the given index is among its pool's active workers.
+ *
+ * Returns false if the worker should exit instead - the scan has been aborted, or tuning has stopped with the worker
+ * still inactive.
+ */
+bool Scanner::waitForTurn(const DevicePool & pool, int idx) {
+	if(idx < activeWorkerCount(pool)) {
+		return true;
+	}
+
+	std::unique_lock<std::mutex> lock(m_tuningLock);
+	m_tuningChanged.wait(lock, [this, &pool, idx]() {
+		return idx < activeWorkerCount(pool) || m_tuningStopped || m_abortFlag;
+	});
+
+	return idx < activeWorkerCount(pool) && !m_abortFlag;
+}
+
+int Scanner::activeWorkerCount(const DevicePool & pool) const {
+	return (pool.tuned ? std::min(pool.concurrency, m_activeWorkerCount.load()) : pool.concurrency);
+}
+
+/**
+ * Adjust the number of active workers to what the system can sustain.
+ *
+ * Runs on its own thread while the walk is in progress, and applies to the pools on local solid state storage - the
+ * worker counts for rotating disks and network filesystems are fixed. Starting from half the CPU budget, it adds workers each
+ * interval as long as doing so improves the rate at which files and data are scanned, and stops adding them once the
+ * workers spend most of their time waiting on I/O. An increase that doesn't pay for itself is undone and the tuner
+ * holds for a while before trying again, since the tree being scanned changes as the walk goes on.
+ */
+void Scanner::tuneConcurrency(int maxWorkers) {
+	const int step = std::max(1, maxWorkers / 8);
+	qint64 lastTime = m_scanTimer.nsecsElapsed();
+	int lastFiles = 0;
+	unsigned long lastData = 0;
+	qint64 lastWall = 0;
+	qint64 lastCpu = 0;
+	double lastFileRate = 0.0;
+	double lastDataRate = 0.0;
+	bool lastWasIncrease = false;
+	int hold = 0;
+
+	std::unique_lock<std::mutex> lock(m_tuningLock);
+
+	while(!m_tuningChanged.wait_for(lock, TuningInterval, [this]() { return m_tuningStopped || m_abortFlag.load(); })) {
+		int active = m_activeWorkerCount;
+		int files = m_tunedFileCount;
+
+		// too few files finished to say anything - let the sample run on into the next interval
+		if(files - lastFiles < active) {
+			continue;
+		}
+
+		qint64 now = m_scanTimer.nsecsElapsed();
+		unsigned long data = m_tunedDataSize;
+		qint64 wall = m_scanWallTime;
+		qint64 cpu = m_scanCpuTime;
+		double seconds = static_cast<double>(now - lastTime) / 1e9;
+		double fileRate = (files - lastFiles) / seconds;
+		double dataRate = static_cast<double>(data - lastData) / seconds;
+		double waiting = (wall > lastWall ? 1.0 - static_cast<double>(cpu - lastCpu) / static_cast<double>(wall - lastWall) : 0.0);
+		int next = active;
+
+		if(lastWasIncrease && fileRate < lastFileRate * (1.0 + MinTuningGain) && dataRate < lastDataRate * (1.0 + MinTuningGain)) {
+			next = std::max(1, active - step);
+			hold = TuningHoldIntervals;
+		}
+		else if(0 < hold) {
+			--hold;
+		}
+		else if(IoWaitDominates > waiting && active < maxWorkers) {
+			next = std::min(maxWorkers, active + step);
+		}
+
+		lastTime = now;
+		lastFiles = files;
+		lastData = data;
+		lastWall = wall;
+		lastCpu = cpu;
+		lastFileRate = fileRate;
+		lastDataRate = dataRate;
+		lastWasIncrease = (next > active);
+
+		if(next != active) {
+			lock.unlock();
+			setConcurrency(next);
+			lock.lock();
+		}
+	}
+}
+
+void Scanner::setConcurrency(int count) {
+	{
+		std::lock_guard<std::mutex> lock(m_tuningLock);
+		m_activeWorkerCount = count;
+	}
+
+	m_tuningChanged.notify_all();
+	std::lock_guard<std::mutex> lock(m_poolsLock);
+	updateConcurrency();
+}
+
+/**
+ * Fix the number of active workers where it is and release the workers waiting for a turn.
+ */
+void Scanner::stopTuning() {
+	{
+		std::lock_guard<std::mutex> lock(m_tuningLock);
+		m_tuningStopped = true;
+	}
+
+	m_tuningChanged.notify_all();
+}
+
+/**
+ * Walk the directories queued for a pool.
+ *
+ * Runs on its own thread for each pool. Directories on other devices found by the walk are queued for their own pools,
+ * so a pool can be handed more work after its walk has run dry; the thread only leaves once every pool is out of
+ * directories.
+ */
+void Scanner::walkPool(DevicePool * pool) {
+	// the walker's own threads are started from this one, so they inherit it
+	if(isScrub()) {
+		useBackgroundPriority();
+	}
+
+	std::unique_lock<std::mutex> lock(m_poolsLock);
+
+	while(!m_abortFlag) {
+		if(!pool->pendingDirectories.isEmpty()) {
+			QList<QByteArray> dirs;
+			dirs.swap(pool->pendingDirectories);
+			m_pendingWalkCount -= dirs.size();
+			++m_activeWalkCount;
+			lock.unlock();
+			pool->walker.walk(dirs);
+			lock.lock();
+			--m_activeWalkCount;
+			m_walksChanged.notify_all();
+			continue;
+		}
+
+		if(0 == m_activeWalkCount && 0 == m_pendingWalkCount) {
+			break;
+		}
+
+		m_walksChanged.wait(lock);
+	}
+}
+
+/**
+ * Find the pool for a device, starting one if the device hasn't been seen yet.
+ *
+ * m_poolsLock must be held.
+ */
+Scanner::DevicePool * Scanner::poolFor(dev_t device) {
+	for(auto & pool : m_pools) {
+		if(pool->device == device) {
+			return pool.get();
+		}
+	}
+
+	auto mount = m_mounts.find(device);
+	auto storage = (mount ? MountTable::storageType(*mount) : MountTable::StorageType::Unknown);
+	int concurrency = m_poolWorkerCount;
+	bool tuned = false;
+
+	switch(storage) {
+		case MountTable::StorageType::Rotating:
+			concurrency = std::min(concurrency, RotatingConcurrency);
+			break;
+
+		case MountTable::StorageType::Network:
+		case MountTable::StorageType::Fuse:
+			concurrency *= NetworkConcurrencyFactor;
+			break;
+
+		default:
+			tuned = m_autoTune;
+			break;
+	}
+
+	m_pools.push_back(std::make_unique<DevicePool>(device, storage, concurrency, tuned, m_abortFlag));
+	DevicePool * pool = m_pools.back().get();
+	const bool isHighLatency = MountTable::isHighLatency(storage);
+
+	if(mount) {
+		pool->mountPoint = mount->mountPoint;
+	}
+
+	// size ordering only pays off with more than one worker, and the layout orders already decide which file goes next.
+	// with a deadline, what matters is which files get scanned at all. it needs every file stat()ed as it's found, and
+	// on a high-latency filesystem each of those is a round trip that costs more than the ordering gains
+	bool largeFilesFirst = m_largeFilesFirst && 1 < concurrency && ScanOrder::Discovery == m_scanOrder && !hasDeadline() && !isHighLatency;
+	pool->queue.setLargestFirst(largeFilesFirst);
+
+	if(hasDeadline()) {
+		pool->queue.setHighestScoreFirst(true);
+		pool->queue.setCapacity(DeadlineQueueCapacity);
+	}
+
+	// enough files in flight for every worker to have one waiting when it finishes the last
+	if(m_useReadAhead) {
+		pool->readAhead = ReadAhead::create(pool->queue, std::max((isHighLatency ? HighLatencyReadAheadDepth : ReadAhead::DefaultDepth), 2 * static_cast<std::size_t>(concurrency)));
+
+		if(pool->readAhead) {
+			pool->readAhead->setPreservePageCache(m_preservePageCache);
+		}
+	}
+
+	if(m_abortFlag) {
+		pool->queue.abort();
+
+		if(pool->readAhead) {
+			pool->readAhead->abort();
+		}
+	}
+
+	// a scrub walks the same way every time, handing out each directory's files in name order so that a slice can
+	// carry on part way through a directory
+	pool->walker.setSorted(m_orderedWalk || isScrub());
+	pool->walker.setOrder(isScrub() ? ScanOrder::Discovery : m_scanOrder);
+	pool->walker.setNoAtime(m_preservePageCache);
+	pool->walker.setStatFiles(largeFilesFirst || m_scanCacheActive || hasDeadline());
+
+	// the walk of a high-latency filesystem is bound by round trips rather than CPU, so more threads keep more of them
+	// in flight, and each stat() takes what the client has cached
+	if(isHighLatency) {
+		pool->walker.setThreadCount(std::max(concurrency, HighLatencyWalkerThreads));
+		pool->walker.setRelaxedStat(true);
+	}
+
+	// blocks while the queue is full so that the walk can't run too far ahead of the workers
+	pool->walker.setFileHandler([this, pool](const OpenDirectory::Pointer & directory, const char * name, bool isSymLink, const struct stat * st) {
+		const quint64 size = (st ? static_cast<quint64>(st->st_size) : 0);
+		const FileRisk::Type riskType = (hasDeadline() ? FileRisk::type(name, st) : FileRisk::Type::Other);
+		++m_discoveredFileCount;
+		countDiscovered(riskType, size);
+		bool isCached = (st && m_scanCacheActive && isKnownClean(*st));
+
+		if(m_fileCursorsActive) {
+			m_checkpoint.addFile(directory->path(), QByteArray(name));
+		}
+
+		// checked here rather than by the worker so that known clean files are never queued or opened
+		if(isCached && !m_scanCache.isProvisional()) {
+			++m_scannedFileCount;
+			++m_cachedFileCount;
+
+			if(m_fileCursorsActive) {
+				m_checkpoint.finishFile(directory->path(), QByteArray(name));
+			}
+
+			return;
+		}
+
+		ScanQueue::Item item{directory, QByteArray(name), isSymLink, size, isCached};
+
+		if(hasDeadline()) {
+			item.riskType = riskType;
+			item.score = FileRisk::score(riskType, st, (st && m_scanCacheActive ? m_scanCache.cleanTime(*st) : -1), realTime());
+		}
+
+		// refused once the scan has stopped
+		if(!pool->queue.push(std::move(item))) {
+			countSkipped(riskType, size);
+		}
+	});
+
+	pool->walker.setForeignDirectoryHandler(device, [this](const QByteArray & path, dev_t otherDevice) {
+		// this walk reports the directory done as well as the walk it's handed to
+		if(m_checkpointActive) {
+			m_checkpoint.addDirectory(path);
+		}
+
+		std::lock_guard<std::mutex> lock(m_poolsLock);
+		queueDirectory(path, otherDevice);
+	});
+
+	// so that the resumed scan reads the directory again
+	pool->walker.setDirectoryFailedHandler([this](const QByteArray & path) {
+		++m_failedScanCount;
+
+		if(m_checkpointActive) {
+			m_checkpoint.failDirectory(path);
+		}
+	});
+
+	if(m_fileCursorsActive) {
+		pool->walker.setResumeHandler([this](const QByteArray & path) {
+			return m_checkpoint.resumeCursor(path);
+		});
+	}
+
+	if(m_checkpointActive) {
+		pool->walker.setDirectoryHandler([this](const QByteArray & path) {
+			return m_checkpoint.addDirectory(path);
+		});
+
+		// an aborted walk gives up on directories part way through, so they mustn't be recorded as finished
+		pool->walker.setDirectoryDoneHandler([this](const QByteArray & path) {
+			if(!m_abortFlag) {
+				m_checkpoint.finishDirectory(path);
+			}
+		});
+	}
+
+	if(pool->readAhead) {
+		pool->readAheadThread = std::thread(&ReadAhead::run, pool->readAhead.get());
+	}
+
+	for(int idx = 0; idx < concurrency; ++idx) {
+		pool->workers.emplace_back(&Scanner::scanWorker, this, pool, idx);
+	}
+
+	pool->walkThread = std::thread(&Scanner::walkPool, this, pool);
+	updateConcurrency();
+	return pool;
+}
+
+/**
+ * Queue a directory to be walked by its device's pool.
+ *
+ * m_poolsLock must be held.
+ */
+void Scanner::queueDirectory(const QByteArray & path, dev_t device) {
+	poolFor(device)->pendingDirectories.append(path);
+	++m_pendingWalkCount;
+	m_walksChanged.notify_all();
+}
+
+/**
+ * Recalculate the number of workers scanning across all the pools.
+ *
+ * m_poolsLock must be held.
+ */
+void Scanner::updateConcurrency() {
+	int concurrency = 0;
+
+	for(const auto & pool : m_pools) {
+		concurrency += activeWorkerCount(*pool);
+	}
+
+	m_concurrency = concurrency;
+	Q_EMIT concurrencyChanged(concurrency);
+}
+
+/**
+ * Scan one file, returning the amount of data scanned.
+ *
+ * If the read-ahead has already opened the file it is passed in file, and if it read the file too and the file hasn't
+ * changed since, the content is scanned from memory. The pool the file came from, if given, has the time its requests
+ * took added to it, and decides whether the file is staged in memory before it's scanned.
+ */
+unsigned long Scanner::scanFile(const ScanQueue::Item & item, const ReadAhead::File * file, DevicePool * pool) {
+	Q_ASSERT_X(m_scanEngine != nullptr, "Scanner::scanFile()", "called with no scan engine");
+
+	const char * virusName = nullptr;
+	unsigned long scannedDataSize = 0;
+	int ret = CL_EOPEN;
+	const qint64 openStart = m_scanTimer.nsecsElapsed();
+	int fd = (file ? file->fd : ::openat(item.directory->fd(), item.name.constData(), item.openFlags(m_preservePageCache)));
+
+	// O_NOATIME is only allowed on the scanner's own files, unless it has CAP_FOWNER
+	if(!file && -1 == fd && EPERM == errno && m_preservePageCache) {
+		fd = ::openat(item.directory->fd(), item.name.constData(), item.openFlags());
+	}
+
+	int openError = (file ? file->openError : (-1 == fd ? errno : 0));
+
+	if(!file && pool) {
+		++pool->openCount;
+		pool->openTime += m_scanTimer.nsecsElapsed() - openStart;
+	}
+
+	struct cl_scan_options opts {
+	    DefaultGeneralScanOptions,
+	    DefaultParseScanOptions,
+	    DefaultHeuristicScanOptions,
+	    DefaultMailScanOptions,
+	    0,  // disable all dev-only options
+	};
+
+	if(-1 != fd && m_scanHardLinksOnce && isAlreadyScannedLink(fd)) {
+		::close(fd);
+		++m_scannedFileCount;
+		return 0;
+	}
+
+	// the file's identity before the scan, for the scan cache, scan stamps and deduplication
+	struct stat st{};
+	bool isRegular = (-1 != fd && 0 == ::fstat(fd, &st) && S_ISREG(st.st_mode));
+
+	// measured before anything reads the file - the stamp check, the manifest and deduplication all might
+	PageCacheFootprint measured;
+
+	if(!file && m_preservePageCache && isRegular) {
+		measured = PageCacheFootprint::measure(fd, static_cast<quint64>(st.st_size));
+	}
+
+	const PageCacheFootprint & footprint = (file ? file->footprint : measured);
+
+	const auto closeFile = [&footprint, fd]() {
+		footprint.drop(fd);
+		::close(fd);
+	};
 
-		/* wait up to 20 sec. for graceful exit */
-		if(!wait(QLAM_SCANNER_DESTROY_WAIT_TIMEOUT)) {
-qDebug() << "scan did not abort after" << QLAM_SCANNER_DESTROY_WAIT_TIMEOUT << "ms - destroying anyway (program will probably crash)";
+	bool isCacheable = ((m_scanCacheActive || m_scanStampsActive) && isRegular);
+	QByteArray contentKey;
 
-			if(m_scanEngine) {
-qDebug() << "forcing release of scan engine";
-				m_scanEngine = nullptr;
-				Application::instance()->releaseEngine();
-			}
+	// whether the file is as it was when the content key was taken, once it's been scanned
+	bool isContentUnchanged = true;
+
+	// checked again, since the file may have changed after the walk saw it
+	bool isDeltaScan = (item.isProvisionallyClean && isRegular && isKnownClean(st));
+
+	if(isRegular && m_scanStampsActive && m_scanStamp.isClean(fd, st)) {
+		// the stamp is already there, so the verdict only needs adding to the cache
+		if(m_scanCacheActive) {
+			rememberClean(fd, st, false);
 		}
+
+		closeFile();
+		++m_scannedFileCount;
+		++m_stampedFileCount;
+		return 0;
 	}
-}
 
+	if(isRegular && m_manifestActive && m_manifest.isKnownGood(item.directory->filePath(item.name), fd)) {
+		if(isCacheable) {
+			rememberClean(fd, st);
+		}
 
-void Scanner::scanEntity(const QFileInfo & path) {
-	if(!path.exists()) {
-		Q_EMIT pathNotFound(path.filePath());
-		return;
+		closeFile();
+		++m_scannedFileCount;
+		++m_knownGoodFileCount;
+		return 0;
 	}
 
-	if(path.isDir()) {
-		QFileInfo myPath(path);
-
-		while(myPath.isSymLink()) {
-			myPath.setFile(myPath.symLinkTarget());
+	// a copy found clean by the delta alone says nothing about a copy that isn't in the cache
+	if(m_deduplicateContent && isRegular && !isDeltaScan) {
+		contentKey = ContentIndex::key(fd, st);
+		ContentIndex::Result known;
+
+		if(!contentKey.isEmpty()) {
+			switch(m_contentIndex.claim(contentKey, item, known)) {
+				case ContentIndex::Claim::Pending:
+					// reported along with the copy that's being scanned
+					closeFile();
+					return 0;
+
+				case ContentIndex::Claim::Known:
+					if(isCacheable && CL_CLEAN == known.ret) {
+						rememberClean(fd, st);
+					}
+
+					closeFile();
+					++m_dedupedFileCount;
+					reportResult(item, known.ret, known.virusName, 0);
+					return 0;
+
+				case ContentIndex::Claim::First:
+					break;
+			}
 		}
+	}
 
-		if(m_scannedDirs.containsPath(myPath.absoluteFilePath())) {
-			return;
+	if(-1 != fd) {
+		const struct cl_engine * engine = (isDeltaScan ? m_deltaEngine : m_scanEngine);
+
+		cl_fmap_t * map = nullptr;
+		std::optional<SparseFile> sparse;
+		thread_local std::vector<char> smallFileArena(SmallFileSize);
+		std::vector<char> staging;
+		const bool isStaged = (pool && m_stageRemoteFiles && MountTable::isHighLatency(pool->storage));
+		const std::size_t wholeReadSize = (isStaged ? StagingSize : SmallFileSize);
+
+		// the content is only good if it was read from the version of the file the cache and stamps will record
+		if(file && file->data && isRegular && static_cast<quint64>(st.st_size) == file->length && ScanCache::key(st) == ScanCache::key(file->stat)) {
+			map = cl_fmap_open_memory(file->data, file->length);
 		}
+		else if(isRegular && 0 < st.st_size && wholeReadSize >= static_cast<quint64>(st.st_size)) {
+			const auto size = static_cast<std::size_t>(st.st_size);
+			char * buffer = smallFileArena.data();
+
+			if(SmallFileSize < size) {
+				staging.resize(size);
+				buffer = staging.data();
+			}
+
+			const qint64 readStart = m_scanTimer.nsecsElapsed();
 
-		m_scannedDirs.addPath(myPath.absoluteFilePath());
-		QFileInfoList entries = QDir(path.filePath()).entryInfoList(QDir::NoDotAndDotDot | QDir::Dirs | QDir::Files, QDir::DirsFirst | QDir::Name | QDir::IgnoreCase | QDir::LocaleAware);
+			// a short read means the file has changed, and it's left to libclamav
+			if(readWhole(fd, buffer, size)) {
+				map = cl_fmap_open_memory(buffer, size);
+			}
 
-		for(const auto & entry : entries) {
-			if(m_abortFlag) {
-				Q_EMIT scanAborted();
-				return;
+			if(pool) {
+				++pool->readCount;
+				pool->readTime += m_scanTimer.nsecsElapsed() - readStart;
+				pool->readSize += size;
 			}
+		}
+		else if(isRegular && SparseFile::isSparse(st)) {
+			sparse.emplace(fd, static_cast<quint64>(st.st_size));
+			map = cl_fmap_open_handle(&*sparse, 0, static_cast<size_t>(st.st_size), &SparseFile::read, 1);
+		}
+
+		if(map) {
+			ret = cl_scanmap_callback(map, item.name.constData(), &virusName, &scannedDataSize, engine, &opts, nullptr);
+			cl_fmap_close(map);
+		}
+		else {
+			ret = cl_scandesc(fd, item.name.constData(), &virusName, &scannedDataSize, engine, &opts);
+		}
+
+		if(sparse) {
+			m_holeDataSize += sparse->skippedSize();
+		}
+
+		if(isDeltaScan) {
+			++m_deltaScannedFileCount;
+		}
 
-			scanEntity(entry);
+		// the key was taken from one read of the file and the scan made another, so a file rewritten in between
+		// could have its verdict shared with copies of content that wasn't scanned. ctime can't be set back, so
+		// any write shows up here
+		if(!contentKey.isEmpty()) {
+			struct stat after{};
+			isContentUnchanged = (0 == ::fstat(fd, &after) && ScanCache::key(after) == ScanCache::key(st));
 		}
+
+		if(isCacheable && CL_CLEAN == ret) {
+			rememberClean(fd, st);
+		}
+
+		closeFile();
+		m_scannedDataSize += scannedDataSize;
 	}
-	else if(path.isFile()) {
-		scanFile(path);
+
+	QString qstrVirusName = (CL_VIRUS == ret ? QString::fromUtf8(virusName) : QString());
+	std::vector<ScanQueue::Item> copies;
+
+	// other workers may be waiting on this result, so it's recorded before anything that might block. the result
+	// for a file that changed while it was scanned isn't shared - its copies are scanned in their own right
+	if(!contentKey.isEmpty()) {
+		copies = (isContentUnchanged ? m_contentIndex.complete(contentKey, {ret, qstrVirusName}) : m_contentIndex.abandon(contentKey));
 	}
-	else {
-		qDebug() << "unknown path" << path.filePath() << "(" << path.canonicalFilePath() << ")";
+
+	reportResult(item, ret, qstrVirusName, openError);
+
+	for(const auto & copy : copies) {
+		if(isContentUnchanged && (CL_CLEAN == ret || CL_VIRUS == ret)) {
+			++m_dedupedFileCount;
+			reportResult(copy, ret, qstrVirusName, 0);
+		}
+		else {
+			scannedDataSize += scanFile(copy);
+		}
 	}
+
+	return scannedDataSize;
 }
 
-void Scanner::scanFile( const QFileInfo & path ) {
-	Q_ASSERT_X(m_scanEngine != nullptr, "Scanner::scanFile()", "called with no scan engine");
-	const char * virusName;
+/**
+ * Report the outcome of scanning a file.
+ *
+ * openError is the errno from opening the file, or 0 if it was opened.
+ */
+void Scanner::reportResult(const ScanQueue::Item & item, int ret, const QString & qstrVirusName, int openError) {
+	static const QMetaMethod fileScannedSignal = QMetaMethod::fromSignal(&Scanner::fileScanned);
+	static const QMetaMethod fileCleanSignal = QMetaMethod::fromSignal(&Scanner::fileClean);
 
-	struct cl_scan_options opts {
-	    DefaultGeneralScanOptions,
-	    DefaultParseScanOptions,
-	    DefaultHeuristicScanOptions,
-	    DefaultMailScanOptions,
-	    0,  // disable all dev-only options
-	};
+	// only build the display path if something is going to use it
+	QString path;
+
+	if(CL_CLEAN != ret || isSignalConnected(fileScannedSignal) || isSignalConnected(fileCleanSignal)) {
+		path = QFile::decodeName(item.directory->filePath(item.name));
+	}
 
-	int ret = cl_scanfile(QDir::toNativeSeparators(path.canonicalFilePath()).toUtf8(), &virusName, &m_scannedDataSize, m_scanEngine, &opts);
-    Q_EMIT fileScanned(path.filePath());
+    Q_EMIT fileScanned(path);
 
 	if(CL_CLEAN == ret) {
-		Q_EMIT fileClean(path.filePath());
+		Q_EMIT fileClean(path);
 		++m_scannedFileCount;
 	}
 	else if(CL_VIRUS == ret) {
-		FileWithIssues inf(path.filePath());
-		QString qstrVirusName = QString::fromUtf8(virusName);
-		inf.addIssue(qstrVirusName);
-		m_issues.append(FileWithIssues(path.filePath()));
-
-		if (qstrVirusName.startsWith(HeuristicMatchPrefix)) {
-		    ScannerHeuristicMatch heuristic = ScannerHeuristicMatch::Generic;
-
-            if (QStringLiteral("Heuristics.Limits.Exceeded") == qstrVirusName) {
-                heuristic = ScannerHeuristicMatch::ExceedsMaximum;
-            } else if (qstrVirusName.startsWith(QStringLiteral("Heuristics.Broken."))) {
-                heuristic = ScannerHeuristicMatch::BrokenExecutable;
-            } else if (QStringLiteral("Heuristics.Encrypted.Zip") == qstrVirusName) {
-                heuristic = ScannerHeuristicMatch::EncryptedArchive;
-            } else if (QStringLiteral("Heuristics.OLE2.ContainsMacros") == qstrVirusName) {
-                heuristic = ScannerHeuristicMatch::OleMacros;
-            } else if (qstrVirusName.startsWith(QStringLiteral("Heuristics.OLE2."))) {
-                heuristic = ScannerHeuristicMatch::OleGeneric;
-            } else if (QStringLiteral("Heuristics.Phishing.Email.SpoofedDomain") == qstrVirusName) {
-                heuristic = ScannerHeuristicMatch::PhishingEmailSpoofedDomain;
-            } else if (qstrVirusName.startsWith(QStringLiteral("Heuristics.Phishing."))) {
-                heuristic = ScannerHeuristicMatch::PhishingGeneric;
-            } else if (QStringLiteral("Heuristics.Structured.CreditCardNumber") == qstrVirusName) {
-                heuristic = ScannerHeuristicMatch::StructuredCreditCardNumber;
-            } else if (QStringLiteral("Heuristics.Structured.SSN") == qstrVirusName) {
-                heuristic = ScannerHeuristicMatch::StructuredSsnNormal;
-            } else if (qstrVirusName.startsWith(QStringLiteral("Heuristics.Structured."))) {
-                heuristic = ScannerHeuristicMatch::StructuredGeneric;
-            } else {
-                qDebug() << "Unrecognised heuristic issue string" << qstrVirusName << "please file a bug report";
-            }
-
-            Q_EMIT
-            fileMatchedHeuristic(path.filePath(), heuristic);
-        } else {
-            Q_EMIT fileInfected(path.filePath(), qstrVirusName);
+		if(m_checkpointActive) {
+			m_checkpoint.addIssue(path, qstrVirusName);
 		}
 
+		reportIssue(path, qstrVirusName);
 		++m_scannedFileCount;
 	}
 	else {
-qDebug() << "failure when scanning" << path.filePath();
+qDebug() << "failure when scanning" << path << ":" << (0 != openError ? std::strerror(openError) : cl_strerror(ret));
 		++m_failedScanCount;
+
+		// so that the resumed scan tries the file again
+		if(m_checkpointActive) {
+			m_checkpoint.failDirectory(item.directory->path());
+		}
+	}
+}
+
+/**
+ * Add an issue to the list and tell whoever is listening, as a heuristic match or as an infection.
+ */
+void Scanner::reportIssue(const QString & path, const QString & qstrVirusName) {
+	FileWithIssues inf(path);
+	inf.addIssue(qstrVirusName);
+	addIssue(inf);
+
+	if(!qstrVirusName.startsWith(HeuristicMatchPrefix)) {
+		Q_EMIT fileInfected(path, qstrVirusName);
+		return;
+	}
+
+	ScannerHeuristicMatch heuristic = ScannerHeuristicMatch::Generic;
+
+	if(QStringLiteral("Heuristics.Limits.Exceeded") == qstrVirusName) {
+		heuristic = ScannerHeuristicMatch::ExceedsMaximum;
+	}
+	else if(qstrVirusName.startsWith(QStringLiteral("Heuristics.Broken."))) {
+		heuristic = ScannerHeuristicMatch::BrokenExecutable;
+	}
+	else if(QStringLiteral("Heuristics.Encrypted.Zip") == qstrVirusName) {
+		heuristic = ScannerHeuristicMatch::EncryptedArchive;
+	}
+	else if(QStringLiteral("Heuristics.OLE2.ContainsMacros") == qstrVirusName) {
+		heuristic = ScannerHeuristicMatch::OleMacros;
+	}
+	else if(qstrVirusName.startsWith(QStringLiteral("Heuristics.OLE2."))) {
+		heuristic = ScannerHeuristicMatch::OleGeneric;
+	}
+	else if(QStringLiteral("Heuristics.Phishing.Email.SpoofedDomain") == qstrVirusName) {
+		heuristic = ScannerHeuristicMatch::PhishingEmailSpoofedDomain;
+	}
+	else if(qstrVirusName.startsWith(QStringLiteral("Heuristics.Phishing."))) {
+		heuristic = ScannerHeuristicMatch::PhishingGeneric;
+	}
+	else if(QStringLiteral("Heuristics.Structured.CreditCardNumber") == qstrVirusName) {
+		heuristic = ScannerHeuristicMatch::StructuredCreditCardNumber;
+	}
+	else if(QStringLiteral("Heuristics.Structured.SSN") == qstrVirusName) {
+		heuristic = ScannerHeuristicMatch::StructuredSsnNormal;
+	}
+	else if(qstrVirusName.startsWith(QStringLiteral("Heuristics.Structured."))) {
+		heuristic = ScannerHeuristicMatch::StructuredGeneric;
+	}
+	else {
+		qDebug() << "Unrecognised heuristic issue string" << qstrVirusName << "please file a bug report";
+	}
+
+	Q_EMIT fileMatchedHeuristic(path, heuristic);
+}
+
+/**
+ * Check whether a file is another hard link to a file that has already been scanned.
+ *
+ * Only files with more than one link are recorded, so the set stays small on typical trees.
+ */
+bool Scanner::isAlreadyScannedLink(int fd) {
+	struct stat st{};
+
+	if(0 != ::fstat(fd, &st) || 1 >= st.st_nlink) {
+		return false;
 	}
+
+	return !m_scannedLinks.insert(st.st_dev, st.st_ino);
 }
 
-int Scanner::countFiles(const QFileInfo & path) {
-    if (!path.exists()) {
-        qDebug() << "path" << path.filePath() << "does not exist";
-        return ErrPathDoesNotExist;
-    }
+/**
+ * Check whether the scan cache says a file is clean.
+ */
+bool Scanner::isKnownClean(const struct stat & st) const {
+	return S_ISREG(st.st_mode) && m_scanCache.isClean(ScanCache::key(st));
+}
 
-    if (path.isDir()) {
-        QFileInfo myPath(path);
+/**
+ * Record that a file has just been scanned clean, in the scan cache and, if writeStamp is set, in a scan stamp.
+ *
+ * st is the file's metadata from before the scan. If the file changed while it was being scanned, or so recently that
+ * a further change might not show in its timestamps, the verdict can't be tied to its metadata and isn't recorded.
+ */
+void Scanner::rememberClean(int fd, const struct stat & st, bool writeStamp) {
+	struct stat after{};
+	struct timespec now{};
 
-        while (myPath.isSymLink()) {
-            myPath.setFile(myPath.symLinkTarget());
-        }
+	if(0 != ::fstat(fd, &after) || 0 != ::clock_gettime(CLOCK_REALTIME, &now)) {
+		return;
+	}
 
-        if (m_countedDirs.containsPath(myPath.absoluteFilePath())) {
-            qDebug() << "ultimate target of" << path.filePath() << "(" << myPath.absoluteFilePath()
-                     << ") already counted";
-            return 0;
-        }
+	const ScanCache::Key key = ScanCache::key(st);
 
-        m_countedDirs.addPath(myPath.absoluteFilePath());
-        QFileInfoList entries = QDir(path.filePath()).entryInfoList(QDir::NoDotAndDotDot | QDir::Dirs | QDir::Files,
-                                                                    QDir::DirsFirst | QDir::Name |
-                                                                    QDir::IgnoreCase | QDir::LocaleAware);
+	if(!(key == ScanCache::key(after)) || key.ctime > static_cast<qint64>(now.tv_sec) * 1000000000 + now.tv_nsec - RecentChangeWindow) {
+		return;
+	}
 
-        int count = 0;
-        for(const auto & entry : entries) {
-            count += countFiles(entry);
+	// writing the stamp moves the file's ctime on, so a cache entry made now would never match. the next scan trusts
+	// the stamp and caches the file then
+	if(writeStamp && m_scanStampsActive && m_scanStamp.stamp(fd, st)) {
+		return;
+	}
 
-            if (m_abortFlag) {
-                return 0;
-            }
-        }
+	if(m_scanCacheActive) {
+		m_scanCache.addClean(key);
+	}
+}
 
-        return count;
-    } else if (path.isFile()) {
-        return 1;
-    }
+/**
+ * Record an issue found by one of the workers.
+ */
+void Scanner::addIssue(FileWithIssues issue) {
+	std::lock_guard<std::mutex> lock(m_issuesLock);
+	m_issues.append(std::move(issue));
+	++m_issueCount;
+}
 
-qDebug() << "unknown path" << path.filePath() << "(" << path.canonicalFilePath() << ")";
-    return  ErrUncountablePath;
+/**
+ * Put the issue list into a stable order.
+ *
+ * Both the walk and the scan run in parallel, so issues are found in no particular order. There is no sequential
+ * traversal order to restore either: the walkers steal directories from each other, and the walk can be sorted,
+ * ordered by layout or resumed from a checkpoint. Sorting by path means the same tree always produces the same
+ * report, however it was walked.
+ */
+void Scanner::sortIssues() {
+	std::lock_guard<std::mutex> lock(m_issuesLock);
+	std::sort(m_issues.begin(), m_issues.end(), [](const FileWithIssues & lhs, const FileWithIssues & rhs) {
+		return lhs.path() < rhs.path();
+	});
 }
 
 bool Scanner::startScan() {
@@ -260,11 +1274,12 @@ qDebug() << "scan is already running";
 
 void Scanner::run() {
 	reset();
-	startFileCounter();
 	Application * app = Application::instance();
 
 	Q_EMIT scanStarted();
+	m_scanTimer.start();
 	m_scanEngine = app->acquireEngine();
+	raiseOpenFileLimit();
 
 	if(!m_scanEngine) {
 		Q_EMIT scanFailed();
@@ -272,11 +1287,323 @@ void Scanner::run() {
 		return;
 	}
 
-	for(const auto & path : scanPaths()) {
-		scanEntity(QFileInfo(path));
+	// the version the engine was loaded with, which is behind the files on disk if they've been updated since
+	const QByteArray signatureVersion = app->engineDatabaseVersion();
+	SignatureDelta signatureDelta;
+	m_scanCacheActive = m_useScanCache && m_scanCache.open(signatureVersion, (m_useSignatureDelta ? signatureDelta.baseVersions(signatureVersion) : QList<QByteArray>()));
+
+	if(m_scanCacheActive && m_scanCache.isProvisional()) {
+		m_deltaEngine = signatureDelta.loadEngine();
+
+		// without the delta the cached verdicts can't be brought up to date
+		if(!m_deltaEngine) {
+			m_scanCache.open(signatureVersion);
+		}
+	}
+
+	if(m_useScanCache && !m_scanCacheActive) {
+qDebug() << "signature database versions not known - not using the scan cache";
 	}
 
-	if(m_abortFlag) {
+	m_scanStamp.setDatabaseVersion(signatureVersion);
+	m_scanStampsActive = m_useScanStamps && m_scanStamp.loadKey(m_scanStampKeyFile) && m_scanStamp.isValid();
+	m_manifestActive = m_useManifest && m_manifest.open(m_manifestFiles);
+
+	if(m_useManifest && !m_manifestActive) {
+qDebug() << "no known good files found - not using the manifest";
+	}
+
+	m_poolWorkerCount = (0 < m_workerCount ? m_workerCount : defaultWorkerCount());
+	m_mounts = MountTable::load();
+
+	// a fixed worker count is taken as given; otherwise the tuner works out how many of the workers to use
+	m_autoTune = (0 == m_workerCount && 1 < m_poolWorkerCount);
+	std::thread tuner;
+	setConcurrency(m_autoTune ? std::max(1, m_poolWorkerCount / 2) : m_poolWorkerCount);
+
+	if(m_autoTune) {
+		tuner = std::thread(&Scanner::tuneConcurrency, this, m_poolWorkerCount);
+	}
+
+	// the scan paths are sorted by device before any of them is handed over, so that no pool's walk can finish and
+	// leave while another device still has a root to walk
+	std::vector<std::pair<dev_t, QByteArray>> rootDirs;
+	struct RootFile {
+		struct stat stat;
+		ScanQueue::Item item;
+	};
+
+	std::vector<RootFile> rootFiles;
+	QStringList paths = scanPaths();
+	bool isIncrementalScan = false;
+
+	if(!m_changeJournalName.isEmpty()) {
+		// taken for every scan of the profile, so that the next incremental scan only has the changes from now on
+		ChangeJournal::Changes changes = ChangeJournal::take(m_changeJournalName, paths);
+
+		if(m_incremental && changes.isComplete) {
+qDebug() << "incremental scan of" << changes.paths.size() << "changed paths";
+			paths = changes.paths;
+			isIncrementalScan = true;
+		}
+		else if(m_incremental) {
+qDebug() << "change journal is not complete - walking all the scan paths";
+		}
+	}
+
+	m_deadlineReached = false;
+	m_deadlineStopped = false;
+	std::thread deadlineWatcher;
+
+	if(hasDeadline()) {
+		deadlineWatcher = std::thread(&Scanner::watchDeadline, this);
+	}
+
+	m_sliceEnded = false;
+	m_sliceSizeLimit = 0;
+	m_sliceRequiredSize = 0;
+	m_sliceDeadline = 0;
+	m_scrubCycleScanned = 0;
+	m_scrubCycleSize = 0;
+	ScrubSchedule scrubSchedule;
+	const qint64 sliceStarted = QDateTime::currentMSecsSinceEpoch();
+
+	const bool isScheduled = (isScrub() && scrubSchedule.load(m_checkpointName));
+
+	if(isScheduled) {
+		if(scrubSchedule.isOverdue(m_scrubPeriod, sliceStarted)) {
+qDebug() << "scrub is behind schedule - scanning to the end of the cycle";
+		}
+		else {
+			m_sliceRequiredSize = scrubSchedule.requiredSliceSize(m_scrubPeriod, sliceStarted);
+			m_sliceSizeLimit = (0 < m_sliceSize ? std::max(m_sliceSize, m_sliceRequiredSize) : 0);
+			m_sliceDeadline = m_sliceDuration;
+qDebug() << "scrub slice must scan at least" << m_sliceRequiredSize << "bytes";
+		}
+	}
+
+	m_checkpointActive = m_checkpoint.open(m_checkpointName, (isScrub() ? QByteArray(ScrubCheckpointVersion) : signatureVersion), paths);
+
+	m_fileCursorsActive = m_checkpointActive && (isScrub() || (m_orderedWalk && ScanOrder::Discovery == m_scanOrder));
+
+	if(isScrub() && !m_checkpointActive) {
+qDebug() << "scrub has no checkpoint - every slice starts from the beginning";
+	}
+
+	if(m_checkpointActive) {
+		for(const auto & issue : m_checkpoint.resumedIssues()) {
+			reportIssue(issue.path, issue.name);
+		}
+	}
+
+	for(const auto & path : paths) {
+		QFileInfo info(path);
+		QByteArray rawPath = QFile::encodeName(path);
+		struct stat st{};
+
+		if(!info.exists() || 0 != ::stat(rawPath.constData(), &st)) {
+			// changed files may since have been removed
+			if(!isIncrementalScan) {
+				Q_EMIT pathNotFound(path);
+			}
+		}
+		else if(info.isDir()) {
+			rootDirs.emplace_back(st.st_dev, rawPath);
+		}
+		else if(info.isFile()) {
+			auto directory = OpenDirectory::open(QFile::encodeName(info.absolutePath()));
+
+			if(!directory) {
+qDebug() << "failed to open the directory containing" << path;
+				++m_failedScanCount;
+				continue;
+			}
+
+			rootFiles.push_back({st, {directory, QFile::encodeName(info.fileName()), info.isSymLink(), static_cast<quint64>(st.st_size)}});
+		}
+		else {
+			qDebug() << "unknown path" << path << "(" << info.canonicalFilePath() << ")";
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_poolsLock);
+
+		for(const auto & dir : rootDirs) {
+			// the subtree was finished by the scan being resumed
+			if(m_checkpointActive && !m_checkpoint.addDirectory(dir.second)) {
+				continue;
+			}
+
+			queueDirectory(dir.second, dir.first);
+		}
+	}
+
+	for(auto & file : rootFiles) {
+		const FileRisk::Type riskType = (hasDeadline() ? FileRisk::type(file.item.name.constData(), &file.stat) : FileRisk::Type::Other);
+		++m_discoveredFileCount;
+		countDiscovered(riskType, file.item.size);
+
+		if(m_scanCacheActive && isKnownClean(file.stat)) {
+			if(m_scanCache.isProvisional()) {
+				file.item.isProvisionallyClean = true;
+			}
+			else {
+				++m_scannedFileCount;
+				++m_cachedFileCount;
+				continue;
+			}
+		}
+
+		DevicePool * pool;
+
+		{
+			std::lock_guard<std::mutex> lock(m_poolsLock);
+			pool = poolFor(file.stat.st_dev);
+		}
+
+		if(hasDeadline()) {
+			file.item.riskType = riskType;
+			file.item.score = FileRisk::score(riskType, &file.stat, (m_scanCacheActive ? m_scanCache.cleanTime(file.stat) : -1), realTime());
+		}
+
+		if(!pool->queue.push(std::move(file.item))) {
+			countSkipped(riskType, file.stat.st_size);
+		}
+	}
+
+	{
+		std::unique_lock<std::mutex> lock(m_poolsLock);
+		m_walksChanged.wait(lock, [this]() {
+			return m_abortFlag || (0 == m_activeWalkCount && 0 == m_pendingWalkCount);
+		});
+	}
+
+	// a pool is only ever added by the walk of an earlier pool, so by the time the loop reaches the end every walk
+	// that could have added one has been joined
+	for(std::size_t idx = 0; ; ++idx) {
+		DevicePool * pool;
+
+		{
+			std::lock_guard<std::mutex> lock(m_poolsLock);
+
+			if(idx >= m_pools.size()) {
+				break;
+			}
+
+			pool = m_pools[idx].get();
+		}
+
+		pool->walkThread.join();
+	}
+
+	if(!m_abortFlag) {
+		m_walkComplete = true;
+		Q_EMIT fileCountComplete(m_discoveredFileCount);
+	}
+
+	for(auto & pool : m_pools) {
+		if(m_abortFlag) {
+			pool->queue.abort();
+		}
+		else {
+			pool->queue.close();
+		}
+	}
+
+	stopTuning();
+
+	if(tuner.joinable()) {
+		tuner.join();
+	}
+
+	for(auto & pool : m_pools) {
+		for(auto & worker : pool->workers) {
+			worker.join();
+		}
+
+		if(pool->readAhead) {
+			pool->readAheadThread.join();
+
+			for(const auto & item : pool->readAhead->drain()) {
+				countSkipped(item.riskType, item.size);
+			}
+
+			m_readAheadStats += pool->readAhead->stats();
+		}
+
+		MountLatency latency;
+		latency.mountPoint = pool->mountPoint;
+		latency.storage = pool->storage;
+		latency.statCount = pool->walker.statCount();
+		latency.statTime = pool->walker.statTime();
+		latency.openCount = pool->openCount;
+		latency.openTime = pool->openTime;
+		latency.readCount = pool->readCount;
+		latency.readTime = pool->readTime;
+		latency.readSize = pool->readSize;
+		m_mountLatencies.push_back(std::move(latency));
+
+		if(0 <= pool->firstWorkerFinished) {
+			m_idleTailTime = std::max(m_idleTailTime.load(), pool->lastWorkerFinished - pool->firstWorkerFinished);
+		}
+	}
+
+	if(deadlineWatcher.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(m_deadlineLock);
+			m_deadlineStopped = true;
+		}
+
+		m_deadlineChanged.notify_all();
+		deadlineWatcher.join();
+	}
+
+	if(m_scanCacheActive) {
+		m_scanCache.save();
+		m_scanCache.close();
+	}
+
+	if(m_deltaEngine) {
+		cl_engine_free(m_deltaEngine);
+		m_deltaEngine = nullptr;
+	}
+
+	if(m_manifestActive) {
+		m_manifest.close();
+	}
+
+	m_contentIndex.clear();
+	sortIssues();
+
+	if(m_checkpointActive) {
+		if(m_abortFlag) {
+			m_checkpoint.save();
+		}
+		else {
+			m_checkpoint.discard();
+		}
+
+		m_checkpoint.close();
+		m_checkpointActive = false;
+		m_fileCursorsActive = false;
+	}
+
+	// a slice that stops short of the end leaves the rest of the cycle to the next one
+	if(isScheduled) {
+		scrubSchedule.addSlice(sliceStarted, m_scannedDataSize, !m_abortFlag);
+		scrubSchedule.save();
+		m_scrubCycleScanned = scrubSchedule.cycleSize();
+		m_scrubCycleSize = scrubSchedule.previousCycleSize();
+	}
+
+	// the changes in the journal that was taken would otherwise be lost to the next incremental scan
+	if(!m_changeJournalName.isEmpty() && (m_abortFlag || 0 < m_failedScanCount)) {
+		ChangeJournal::invalidate(m_changeJournalName);
+	}
+
+	// a slice that used up its limits, or a scan that ran out of time, has done what it was asked to
+	if(m_abortFlag && !m_sliceEnded && !m_deadlineReached) {
 		Q_EMIT scanAborted();
 	}
 	else if(0 < m_failedScanCount) {
@@ -287,8 +1614,9 @@ void Scanner::run() {
 		Q_EMIT scanComplete(m_issues.count());
 
 		// we only emit clean scan signal if scan completed successfully and there were no infections found.
-		// if scan fails or is aborted, we don't emit this signal.
-		if(0 == m_issues.count()) {
+		// if scan fails or is aborted, we don't emit this signal. nor for a slice of a scrub that stopped at its
+		// limits, since it hasn't been through all the paths.
+		if(0 == m_issues.count() && !m_sliceEnded) {
 			Q_EMIT scanClean();
 		}
 	}
@@ -297,13 +1625,6 @@ void Scanner::run() {
 		Q_EMIT scanFoundInfections();
 	}
 
-	/* we don't need the tree of scanned dirs any more, it's only to prevent
-	 * recursive scanning of circular symlinks */
-	m_scannedDirs.clear();
-
-	// file counter watches abort flag, so wait for it to resolve
-	m_counter.wait();
-	m_counter = {};
 	m_abortFlag = false;
 
 	Q_EMIT scanFinished();
@@ -314,60 +1635,97 @@ void Scanner::run() {
 
 void Scanner::abort() {
 	m_abortFlag = true;
+
+	{
+		std::lock_guard<std::mutex> lock(m_poolsLock);
+
+		// releases the walks if they're blocked on a full queue and the workers if they're waiting on an empty one
+		for(auto & pool : m_pools) {
+			for(const auto & item : pool->queue.abort()) {
+				countSkipped(item.riskType, item.size);
+			}
+
+			if(pool->readAhead) {
+				pool->readAhead->abort();
+			}
+		}
+	}
+
+	m_walksChanged.notify_all();
+
+	// releases the inactive workers and the tuner
+	{
+		std::lock_guard<std::mutex> lock(m_tuningLock);
+	}
+
+	m_tuningChanged.notify_all();
 }
 
 
 void Scanner::reset() {
-	m_scannedDirs.clear();
-	m_countedDirs.clear();
+	{
+		std::lock_guard<std::mutex> lock(m_poolsLock);
+		m_pools.clear();
+		m_pendingWalkCount = 0;
+		m_activeWalkCount = 0;
+	}
+
+	m_scannedLinks.clear();
+	m_contentIndex.clear();
 	m_issues.clear();
+	m_issueCount = 0;
 	m_scannedFileCount = 0;
+	m_cachedFileCount = 0;
+	m_deltaScannedFileCount = 0;
+	m_stampedFileCount = 0;
+	m_knownGoodFileCount = 0;
+	m_dedupedFileCount = 0;
 	m_failedScanCount = 0;
 	m_scannedDataSize = 0;
+	m_holeDataSize = 0;
+	m_discoveredFileCount = 0;
+	m_walkComplete = false;
+
+	for(auto & counter : m_coverage) {
+		counter.fileCount = 0;
+		counter.skippedFileCount = 0;
+		counter.dataSize = 0;
+		counter.skippedDataSize = 0;
+	}
+
+	m_idleTailTime = 0;
+	m_readAheadStats = {};
+	m_mountLatencies.clear();
+	m_concurrency = 0;
+	m_tuningStopped = false;
+	m_tunedFileCount = 0;
+	m_tunedDataSize = 0;
+	m_scanWallTime = 0;
+	m_scanCpuTime = 0;
 }
 
 
-std::optional<int> Scanner::fileCount() const {
-	return m_fileCount;
+/**
+ * The most workers a scan will use when the worker count is left to the scanner.
+ *
+ * This is the CPU budget of the process - its affinity mask and any cgroup quota - rather than the number of CPUs in
+ * the machine, so that a scan in a container doesn't oversubscribe its share.
+ */
+int Scanner::defaultWorkerCount() {
+	return CpuBudget::available();
 }
 
 
 /**
- * Start the asynchronous task to count the files to scan.
+ * The total number of files to scan.
  *
- * While this method includes code to try to gracefully exit any previous count task, it's not guaranteed. You should
- * try to be sure that any previous count has stopped before calling this.
+ * The files are counted by the same walk that feeds the scan, so the count is only available once the walk is
+ * complete. Until then, discoveredFileCount() gives the number found so far.
  */
-void Scanner::startFileCounter() {
-    if (m_counter.valid() && std::future_status::timeout == m_counter.wait_for(std::chrono::seconds(3))) {
-        qWarning() << "previous asynchronous task to calculate the file count did not exit gracefully.";
-    }
-
-    m_counter = std::async(std::launch::async, [this] () -> int {
-        m_fileCount.reset();
-        int count = 0;
-        m_countedDirs.clear();
-
-        for(const auto & path : scanPaths()) {
-            int countForPath = countFiles(QFileInfo(path));
-
-            if(0 < countForPath) {
-                count += countForPath;
-            }
-
-            if (m_abortFlag) {
-                break;
-            }
-        }
-
-        // these are only required while the count is in progress,  so we can safely clear here
-        m_countedDirs.clear();
-
-        if (!m_abortFlag) {
-            m_fileCount = count;
-            Q_EMIT fileCountComplete(count);
-        }
-
-        return count;
-    });
+std::optional<int> Scanner::fileCount() const {
+	if(!m_walkComplete) {
+		return {};
+	}
+
+	return m_discoveredFileCount.load();
 }
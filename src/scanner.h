@@ -7,9 +7,32 @@
 #include <QtCore/QFileInfo>
 #include <QtCore/QList>
 #include <QtCore/QMap>
-
+#include <QtCore/QElapsedTimer>
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include <sys/types.h>
+
+#include "contentindex.h"
+#include "directorywalker.h"
+#include "fileidentityset.h"
+#include "filerisk.h"
 #include "infectedfile.h"
-#include "treeitem.h"
+#include "manifest.h"
+#include "mounttable.h"
+#include "readahead.h"
+#include "scanorder.h"
+#include "scancache.h"
+#include "scancheckpoint.h"
+#include "scanqueue.h"
+#include "scanstamp.h"
 
 class QProcess;
 struct cl_engine;
@@ -26,6 +49,62 @@ namespace Qlam {
 		public:
 			using IssueList = QList<FileWithIssues>;
 
+			/**
+			 * How much of what the walk found a scan with a deadline got through.
+			 *
+			 * Files the scan cache, scan stamps or manifest vouch for count as verified, as do files whose scan failed,
+			 * which are reported as failures in their own right. Only what the deadline left unscanned is skipped.
+			 */
+			struct Coverage {
+				struct Counts {
+					int fileCount = 0;
+					int skippedFileCount = 0;
+					quint64 dataSize = 0;
+					quint64 skippedDataSize = 0;
+
+					int verifiedFileCount() const {
+						return fileCount - skippedFileCount;
+					}
+
+					quint64 verifiedDataSize() const {
+						return dataSize - skippedDataSize;
+					}
+				};
+
+				Counts total;
+				std::array<Counts, FileRisk::TypeCount> byType;
+
+				// whether the walk found everything before the deadline - if not, there are files that aren't counted
+				bool isWalkComplete = false;
+			};
+
+			/**
+			 * How long the requests to one mount took in the last scan.
+			 *
+			 * Only the requests the scan waits on one at a time are timed: the walk's stat()s, and the opens and
+			 * whole-file reads the workers make themselves. The read-ahead's opens overlap one another, so their latency
+			 * isn't what the scan waits for.
+			 */
+			struct MountLatency {
+				QByteArray mountPoint;
+				MountTable::StorageType storage = MountTable::StorageType::Unknown;
+
+				// the number of each kind of request, and the ns they took in total
+				quint64 statCount = 0;
+				qint64 statTime = 0;
+				quint64 openCount = 0;
+				qint64 openTime = 0;
+				quint64 readCount = 0;
+				qint64 readTime = 0;
+
+				// the data the whole-file reads brought in
+				quint64 readSize = 0;
+
+				static double averageTime(quint64 count, qint64 time) {
+					return (0 == count ? 0.0 : static_cast<double>(time) / static_cast<double>(count));
+				}
+			};
+
 			explicit Scanner( const QString & = QString(), QObject * = nullptr );
 			explicit Scanner( const QStringList &, QObject * = nullptr );
 			~Scanner() override;
@@ -47,16 +126,265 @@ namespace Qlam {
 			void setScanPath( const QString & path ) {
 				m_scanPaths.clear();
 				m_scanPaths.append(path);
-				m_fileCount.reset();
 			}
 
 			void setScanPaths( const QStringList & paths ) {
 				m_scanPaths = paths;
-				m_fileCount.reset();
 			}
 
 			bool isValid() const;
 
+			/* the number of worker threads that scan files in parallel on each device - 0 means the scanner chooses, up
+			 * to one per available CPU. rotating disks get fewer workers and network filesystems more */
+			int workerCount() const {
+				return m_workerCount;
+			}
+
+			void setWorkerCount(int count) {
+				m_workerCount = (0 > count ? 0 : count);
+			}
+
+			static int defaultWorkerCount();
+
+			/* the number of workers currently scanning, across all devices - when the scanner chooses the worker count
+			 * this changes during the scan as it measures what the system can sustain */
+			int concurrency() const {
+				return m_concurrency;
+			}
+
+			/* whether the walk visits the entries in each directory in name order - unordered is faster */
+			bool isOrderedWalk() const {
+				return m_orderedWalk;
+			}
+
+			void setOrderedWalk(bool ordered) {
+				m_orderedWalk = ordered;
+			}
+
+			/* the order in which the files in each directory are scanned */
+			ScanOrder scanOrder() const {
+				return m_scanOrder;
+			}
+
+			void setScanOrder(ScanOrder order) {
+				m_scanOrder = order;
+			}
+
+			/* whether a file with several hard links is scanned only through the first link the walk finds */
+			bool scansHardLinksOnce() const {
+				return m_scanHardLinksOnce;
+			}
+
+			void setScanHardLinksOnce(bool once) {
+				m_scanHardLinksOnce = once;
+			}
+
+			/* whether the workers take the largest queued file first rather than the oldest - only applies to parallel
+			 * scans in discovery order, and not on high-latency filesystems. off by default, since it costs a stat()
+			 * for every file the walk finds */
+			bool scansLargeFilesFirst() const {
+				return m_largeFilesFirst;
+			}
+
+			void setScanLargeFilesFirst(bool largeFirst) {
+				m_largeFilesFirst = largeFirst;
+			}
+
+			/* whether the files at the front of each device's queue are opened and read ahead of the workers with io_uring,
+			 * where it's available */
+			bool usesReadAhead() const {
+				return m_useReadAhead;
+			}
+
+			void setUseReadAhead(bool use) {
+				m_useReadAhead = use;
+			}
+
+			/* whether the scan leaves the page cache and access times as it found them: files are opened with O_NOATIME
+			 * where that's allowed and read sequentially, and the pages of each that weren't resident beforehand are
+			 * dropped once it has been scanned */
+			bool preservesPageCache() const {
+				return m_preservePageCache;
+			}
+
+			void setPreservePageCache(bool preserve) {
+				m_preservePageCache = preserve;
+			}
+
+			/* whether files on network and FUSE filesystems that are small enough are streamed into memory with a few
+			 * large reads before they're scanned, rather than read by libclamav in many small ones */
+			bool stagesRemoteFiles() const {
+				return m_stageRemoteFiles;
+			}
+
+			void setStageRemoteFiles(bool stage) {
+				m_stageRemoteFiles = stage;
+			}
+
+			/* whether files found clean by an earlier scan with the same signatures, and not changed since, are skipped. off
+			 * by default, like the setting that turns it on */
+			bool usesScanCache() const {
+				return m_useScanCache;
+			}
+
+			void setUseScanCache(bool use) {
+				m_useScanCache = use;
+			}
+
+			/* whether clean files are stamped with an extended attribute, and files with a current stamp skipped */
+			bool usesScanStamps() const {
+				return m_useScanStamps;
+			}
+
+			void setUseScanStamps(bool use) {
+				m_useScanStamps = use;
+			}
+
+			/* the file holding the key stamps are authenticated with - empty for ScanStamp::defaultKeyPath() */
+			const QString & scanStampKeyFile() const {
+				return m_scanStampKeyFile;
+			}
+
+			void setScanStampKeyFile(const QString & file) {
+				m_scanStampKeyFile = file;
+			}
+
+			/* whether files in the scan cache from before the last daily update are checked against only the new
+			 * signatures, rather than scanned again in full */
+			bool usesSignatureDelta() const {
+				return m_useSignatureDelta;
+			}
+
+			void setUseSignatureDelta(bool use) {
+				m_useSignatureDelta = use;
+			}
+
+			/* whether files whose content matches the package databases or the manifest files are skipped */
+			bool usesManifest() const {
+				return m_useManifest;
+			}
+
+			void setUseManifest(bool use) {
+				m_useManifest = use;
+			}
+
+			/* the scan profile whose change journal this scan takes - none if empty */
+			const QString & changeJournalName() const {
+				return m_changeJournalName;
+			}
+
+			void setChangeJournalName(const QString & name) {
+				m_changeJournalName = name;
+			}
+
+			/* whether to scan only the files in the change journal, when it's complete */
+			bool isIncremental() const {
+				return m_incremental;
+			}
+
+			void setIncremental(bool incremental) {
+				m_incremental = incremental;
+			}
+
+			/* the scan profile whose checkpoint this scan resumes from and keeps up to date - none if empty */
+			const QString & checkpointName() const {
+				return m_checkpointName;
+			}
+
+			void setCheckpointName(const QString & name) {
+				m_checkpointName = name;
+			}
+
+			/* a scrub scans a slice of the paths each time it's run, carrying on from its checkpoint, so that the whole
+			 * of them is covered within this period, in ms - 0 for an ordinary scan. a scrub's checkpoint carries on
+			 * across signature updates, and its threads run at background priority */
+			qint64 scrubPeriod() const {
+				return m_scrubPeriod;
+			}
+
+			void setScrubPeriod(qint64 period) {
+				m_scrubPeriod = (0 > period ? 0 : period);
+			}
+
+			bool isScrub() const {
+				return 0 < m_scrubPeriod;
+			}
+
+			/* how long, in ms, a scrub's slice may run - 0 for no limit. a slice behind schedule runs on until it has
+			 * caught up */
+			qint64 sliceDuration() const {
+				return m_sliceDuration;
+			}
+
+			void setSliceDuration(qint64 duration) {
+				m_sliceDuration = (0 > duration ? 0 : duration);
+			}
+
+			/* how many bytes a scrub's slice may scan - 0 for no limit. raised to what the schedule needs */
+			quint64 sliceSize() const {
+				return m_sliceSize;
+			}
+
+			void setSliceSize(quint64 size) {
+				m_sliceSize = size;
+			}
+
+			/* whether the last scan was a slice of a scrub that stopped at its limits rather than at the end of the
+			 * paths */
+			bool endedSlice() const {
+				return m_sliceEnded;
+			}
+
+			/* how much of the current cycle of a scrub has been scanned, including the last slice, and how much the last
+			 * complete cycle scanned, in bytes - the latter is 0 before the first cycle is complete */
+			quint64 scrubCycleScanned() const {
+				return m_scrubCycleScanned;
+			}
+
+			quint64 scrubCycleSize() const {
+				return m_scrubCycleSize;
+			}
+
+			/* how long, in ms, the scan may run - 0 for no limit. a scan with a deadline takes the riskiest files it has
+			 * found first, and when time runs out stops as though aborted but reports completion along with its coverage */
+			qint64 deadline() const {
+				return m_deadline;
+			}
+
+			void setDeadline(qint64 deadline) {
+				m_deadline = (0 > deadline ? 0 : deadline);
+			}
+
+			bool hasDeadline() const {
+				return 0 < m_deadline;
+			}
+
+			/* whether the last scan ran out of time before it got through everything it found */
+			bool reachedDeadline() const {
+				return m_deadlineReached;
+			}
+
+			/* what the last scan with a deadline covered */
+			Coverage coverage() const;
+
+			/* plain "digest  path" manifests to trust along with the package databases */
+			const QStringList & manifestFiles() const {
+				return m_manifestFiles;
+			}
+
+			void setManifestFiles(const QStringList & files) {
+				m_manifestFiles = files;
+			}
+
+			/* whether files with the same content as one already scanned in this scan reuse its result */
+			bool deduplicatesContent() const {
+				return m_deduplicateContent;
+			}
+
+			void setDeduplicateContent(bool dedupe) {
+				m_deduplicateContent = dedupe;
+			}
+
 			static std::unique_ptr<Scanner> startScan(const QString & scanPath) {
 				return startScan(QStringList() << scanPath);
 			}
@@ -70,14 +398,49 @@ namespace Qlam {
 			void reset();
 			std::optional<int> fileCount() const;
 
+			/* the number of files the walk has found so far - this is the total once isWalkComplete() is true */
+			int discoveredFileCount() const {
+				return m_discoveredFileCount;
+			}
+
+			bool isWalkComplete() const {
+				return m_walkComplete;
+			}
+
 			int issueCount() const {
-				return m_issues.count();
+				return m_issueCount;
 			}
 
 			int scannedFileCount() const {
 				 return m_scannedFileCount;
 			}
 
+			/* the number of files counted as scanned because the scan cache says they're clean */
+			int cachedFileCount() const {
+				return m_cachedFileCount;
+			}
+
+			/* the number of files from before the last daily update that were checked against only the new signatures */
+			int deltaScannedFileCount() const {
+				return m_deltaScannedFileCount;
+			}
+
+			/* the number of files counted as scanned because their scan stamps say they're clean */
+			int stampedFileCount() const {
+				return m_stampedFileCount;
+			}
+
+			/* the number of files counted as scanned because they match the manifest */
+			int knownGoodFileCount() const {
+				return m_knownGoodFileCount;
+			}
+
+			/* the number of files counted as scanned because another file with the same content was scanned */
+			int dedupedFileCount() const {
+				return m_dedupedFileCount;
+			}
+
+			/* sorted by path once the scan has finished */
 			const IssueList & infectedFiles() const {
 				return m_issues;
 			}
@@ -86,19 +449,47 @@ namespace Qlam {
 				return (long long) m_scannedDataSize;
 			}
 
+			/* the bytes in the holes of sparse files that were served as zeros rather than read */
+			quint64 holeDataSkipped() const {
+				return m_holeDataSize;
+			}
+
+			/* how long, in ms, the last scan ran with at least one worker idle for want of work - the longest time
+			 * between the first and last workers on a device finishing */
+			qint64 idleTailTime() const {
+				return m_idleTailTime;
+			}
+
+			/* how deep the read-ahead kept the devices' queues in the last scan, and how often the workers waited on it */
+			ReadAhead::Stats readAheadStats() const {
+				return m_readAheadStats;
+			}
+
+			/* how long each mount the last scan read from took to answer its requests */
+			std::vector<MountLatency> mountLatencies() const {
+				return m_mountLatencies;
+			}
+
 		Q_SIGNALS:
 			/* emitted when a scan starts */
 			void scanStarted();
 
-			/* emitted when the async task to count the files to be scanned has completed */
+			/* emitted when the walk of the scan paths has completed and the total file count is known */
 			void fileCountComplete(int);
 
+			/* emitted when the number of workers scanning changes */
+			void concurrencyChanged(int);
+
 			/* emitted when a path to scan cannot be found */
 			void pathNotFound(const QString & path);
 
 			/* emitted when a file is scanned */
 			void fileScanned( const QString & path );
 
+			/* emitted by each worker for every batch of files it scans, with the path of the last of them - empty for
+			 * the batch a worker finishes with. cheaper to follow than fileScanned() */
+			void filesScanned(int count, const QString & lastPath);
+
 			/* emitted when a file is scanned and is found to be clean */
 			void fileClean( const QString & path );
 
@@ -140,23 +531,211 @@ namespace Qlam {
 			void run() override;
 
 		private:
-	        void startFileCounter();
-			int countFiles(const QFileInfo &);
-			void scanEntity(const QFileInfo &);
-			void scanFile(const QFileInfo &);
+			/**
+			 * The workers, queue and walk for one device.
+			 *
+			 * Each device is scanned at its own pace, so a slow NAS or USB disk doesn't hold up the rest of the scan.
+			 */
+			struct DevicePool {
+				DevicePool(dev_t, MountTable::StorageType, int, bool, const std::atomic<bool> &);
+
+				dev_t device;
+				MountTable::StorageType storage;
+
+				// empty if the device isn't in the mount table
+				QByteArray mountPoint;
+
+				// the most workers that scan files from the device at once
+				int concurrency;
+
+				// whether the number of active workers follows the tuner
+				bool tuned;
+
+				ScanQueue queue;
+
+				// nothing if the pool's workers read from the queue themselves
+				std::unique_ptr<ReadAhead> readAhead;
+				std::thread readAheadThread;
+
+				DirectoryWalker walker;
+				std::vector<std::thread> workers;
+				std::thread walkThread;
+
+				// directories on the device waiting to be walked - guarded by m_poolsLock
+				QList<QByteArray> pendingDirectories;
+
+				// ms since the start of run() at which the first and last workers ran out of work, -1 until they have
+				std::atomic<qint64> firstWorkerFinished;
+				std::atomic<qint64> lastWorkerFinished;
+
+				// the workers' own opens and whole-file reads, and the ns they took, for the latency report
+				std::atomic<quint64> openCount;
+				std::atomic<qint64> openTime;
+				std::atomic<quint64> readCount;
+				std::atomic<qint64> readTime;
+				std::atomic<quint64> readSize;
+			};
+
+			void scanWorker(DevicePool *, int);
+			bool waitForTurn(const DevicePool &, int);
+			int activeWorkerCount(const DevicePool &) const;
+			void tuneConcurrency(int);
+			void setConcurrency(int);
+			void stopTuning();
+			void walkPool(DevicePool *);
+			DevicePool * poolFor(dev_t);
+			void queueDirectory(const QByteArray &, dev_t);
+			void updateConcurrency();
+			unsigned long scanFile(const ScanQueue::Item &, const ReadAhead::File * = nullptr, DevicePool * = nullptr);
+			void reportResult(const ScanQueue::Item &, int, const QString &, int);
+			void reportIssue(const QString &, const QString &);
+			void checkSlice();
+			void watchDeadline();
+			void countDiscovered(FileRisk::Type, quint64);
+			void countSkipped(FileRisk::Type, quint64);
+			bool isAlreadyScannedLink(int);
+			bool isKnownClean(const struct stat &) const;
+			void rememberClean(int, const struct stat &, bool writeStamp = true);
+			void addIssue(FileWithIssues);
+			void sortIssues();
 
 			QStringList m_scanPaths;
-			TreeItem m_scannedDirs;
-			TreeItem m_countedDirs;
 
+			int m_workerCount;
+			bool m_orderedWalk;
+			ScanOrder m_scanOrder;
+			bool m_scanHardLinksOnce;
+			bool m_largeFilesFirst;
+			bool m_useReadAhead;
+			bool m_preservePageCache;
+			bool m_stageRemoteFiles;
+			bool m_useScanCache;
+			bool m_useScanStamps;
+			QString m_scanStampKeyFile;
+			bool m_useSignatureDelta;
+			bool m_useManifest;
+			QStringList m_manifestFiles;
+			QString m_changeJournalName;
+			bool m_incremental;
+			QString m_checkpointName;
+			qint64 m_scrubPeriod;
+			qint64 m_sliceDuration;
+			quint64 m_sliceSize;
+			qint64 m_deadline;
+			bool m_deduplicateContent;
+
+			// the (device, inode) of each multiply-linked file scanned, when m_scanHardLinksOnce is set
+			FileIdentitySet m_scannedLinks;
+
+			// whether m_scanCache is in use for the current scan - false if the signature versions couldn't be read
+			ScanCache m_scanCache;
+			bool m_scanCacheActive;
+
+			// the signatures added since a provisional m_scanCache was built, loaded for the current scan
+			struct cl_engine * m_deltaEngine;
+
+			// whether m_scanStamp is in use for the current scan - false if the signature versions or the key couldn't be
+			// read
+			ScanStamp m_scanStamp;
+			bool m_scanStampsActive;
+
+			// whether m_checkpoint is in use for the current scan - false if it has no profile
+			ScanCheckpoint m_checkpoint;
+			bool m_checkpointActive;
+
+			// whether the checkpoint tracks how far the scan got through each directory - only for a walk that hands
+			// out each directory's files in name order
+			bool m_fileCursorsActive;
+
+			// the limits on the current slice of a scrub, worked out from the schedule when it starts - 0 for none.
+			// the deadline is on m_scanTimer
+			quint64 m_sliceSizeLimit;
+			quint64 m_sliceRequiredSize;
+			qint64 m_sliceDeadline;
+			std::atomic<bool> m_sliceEnded;
+
+			// where the scrub's cycle stood once the last slice was added to the schedule
+			quint64 m_scrubCycleScanned;
+			quint64 m_scrubCycleSize;
+
+			// the deadline watcher waits on m_deadlineChanged until the deadline passes or the workers are done. the
+			// deadline is on m_scanTimer
+			std::mutex m_deadlineLock;
+			std::condition_variable m_deadlineChanged;
+			bool m_deadlineStopped;
+			std::atomic<bool> m_deadlineReached;
+
+			// what the walk has found and what the deadline left unscanned, by type of file - only kept for scans with
+			// a deadline
+			struct CoverageCounter {
+				std::atomic<int> fileCount;
+				std::atomic<int> skippedFileCount;
+				std::atomic<quint64> dataSize;
+				std::atomic<quint64> skippedDataSize;
+			};
+
+			std::array<CoverageCounter, FileRisk::TypeCount> m_coverage;
+
+			// whether m_manifest is in use for the current scan - false if it has no files
+			Manifest m_manifest;
+			bool m_manifestActive;
+
+			// the result for each distinct file content scanned, when m_deduplicateContent is set
+			ContentIndex m_contentIndex;
+
+			// the workers each device pool has, before any adjustment for the type of storage
+			int m_poolWorkerCount;
+			bool m_autoTune;
+			MountTable m_mounts;
+
+			// pools are only added while the scan is running, and only removed by reset()
+			std::mutex m_poolsLock;
+			std::condition_variable m_walksChanged;
+			std::vector<std::unique_ptr<DevicePool>> m_pools;
+
+			// directories waiting in the pools' pending lists and pools currently walking - the walk is over when both
+			// are 0
+			int m_pendingWalkCount;
+			int m_activeWalkCount;
+
+			// guards m_issues while the workers are running
+			std::mutex m_issuesLock;
 			IssueList m_issues;
-			mutable std::optional<int> m_fileCount;
-			int m_scannedFileCount;
-			int m_failedScanCount;
-			unsigned long m_scannedDataSize;
+			std::atomic<int> m_issueCount;
+
+			std::atomic<int> m_discoveredFileCount;
+			std::atomic<bool> m_walkComplete;
+			std::atomic<int> m_scannedFileCount;
+			std::atomic<int> m_cachedFileCount;
+			std::atomic<int> m_deltaScannedFileCount;
+			std::atomic<int> m_stampedFileCount;
+			std::atomic<int> m_knownGoodFileCount;
+			std::atomic<int> m_dedupedFileCount;
+			std::atomic<int> m_failedScanCount;
+			std::atomic<unsigned long> m_scannedDataSize;
+			std::atomic<quint64> m_holeDataSize;
+
+			QElapsedTimer m_scanTimer;
+			std::atomic<qint64> m_idleTailTime;
+			ReadAhead::Stats m_readAheadStats;
+			std::vector<MountLatency> m_mountLatencies;
+
+			// workers in tuned pools with an index at or beyond m_activeWorkerCount wait on m_tuningChanged until the
+			// tuner lets them in
+			std::atomic<int> m_activeWorkerCount;
+			std::atomic<int> m_concurrency;
+			std::mutex m_tuningLock;
+			std::condition_variable m_tuningChanged;
+			bool m_tuningStopped;
+
+			// what the workers in tuned pools have scanned, and the ns they have spent scanning it by the clock and on
+			// the CPU - the difference is time spent waiting, mostly for I/O
+			std::atomic<int> m_tunedFileCount;
+			std::atomic<unsigned long> m_tunedDataSize;
+			std::atomic<qint64> m_scanWallTime;
+			std::atomic<qint64> m_scanCpuTime;
 			struct cl_engine * m_scanEngine;
-			bool m_abortFlag;
-			std::future<int> m_counter;
+			std::atomic<bool> m_abortFlag;
 	};
 }
 
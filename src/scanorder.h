@@ -0,0 +1,19 @@
+#ifndef QLAM_SCANORDER_H
+#define QLAM_SCANORDER_H
+
+namespace Qlam {
+
+    // the order in which the files in each directory are scanned
+    enum class ScanOrder {
+        // the order the filesystem lists them - costs nothing extra
+        Discovery = 0,
+
+        // by inode number, which on most filesystems roughly follows on-disk location
+        Inode,
+
+        // by the physical offset of the first extent, as reported by FIEMAP, falling back to inode order
+        PhysicalOffset,
+    };
+}
+
+#endif //QLAM_SCANORDER_H
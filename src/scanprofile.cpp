@@ -4,10 +4,49 @@ using namespace Qlam;
 
 ScanProfile::ScanProfile( const QString & name )
 : m_name(),
-  m_paths() {
+  m_paths(),
+  m_scanMode(ScanMode::Full),
+  m_scrubPeriod(DefaultScrubPeriod),
+  m_sliceDuration(DefaultSliceDuration),
+  m_sliceSize(0),
+  m_deadline(DefaultDeadline) {
 	setName(name);
 }
 
+QString ScanProfile::scanModeToString(ScanMode mode) {
+	switch(mode) {
+		case ScanMode::Full:
+			return QStringLiteral("Full");
+
+		case ScanMode::Incremental:
+			return QStringLiteral("Incremental");
+
+		case ScanMode::Scrub:
+			return QStringLiteral("Scrub");
+
+		case ScanMode::Deadline:
+			return QStringLiteral("Deadline");
+	}
+
+	return QStringLiteral("Full");
+}
+
+ScanProfile::ScanMode ScanProfile::stringToScanMode(const QString & mode) {
+	if(QStringLiteral("Incremental") == mode) {
+		return ScanMode::Incremental;
+	}
+
+	if(QStringLiteral("Scrub") == mode) {
+		return ScanMode::Scrub;
+	}
+
+	if(QStringLiteral("Deadline") == mode) {
+		return ScanMode::Deadline;
+	}
+
+	return ScanMode::Full;
+}
+
 void ScanProfile::setPath( int i, const QString & path ) {
 	if(i < 0 || i >= m_paths.count()) {
 		return;
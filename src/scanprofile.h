@@ -7,8 +7,30 @@
 namespace Qlam {
 	class ScanProfile {
 		public:
+			enum class ScanMode {
+				// walk all of the paths
+				Full = 0,
+
+				// scan only what the change journal says has changed since the last scan, if it's complete
+				Incremental,
+
+				// scan a slice of the paths each time, carrying on where the last slice stopped, so that the whole of
+				// them is covered within the scrub period
+				Scrub,
+
+				// scan the riskiest files first and stop when the deadline is reached, reporting how much was covered
+				Deadline,
+			};
+
+			static constexpr const int DefaultScrubPeriod = 7;
+			static constexpr const int DefaultSliceDuration = 60;
+			static constexpr const int DefaultDeadline = 15;
+
 			explicit ScanProfile(const QString & = {});
 
+			static QString scanModeToString(ScanMode);
+			static ScanMode stringToScanMode(const QString &);
+
 			const QStringList & paths() const {
 				return m_paths;
 			}
@@ -25,6 +47,50 @@ namespace Qlam {
 				m_name = name;
 			}
 
+			ScanMode scanMode() const {
+				return m_scanMode;
+			}
+
+			void setScanMode(ScanMode mode) {
+				m_scanMode = mode;
+			}
+
+			/* in scrub mode, the days within which every file is to be scanned */
+			int scrubPeriod() const {
+				return m_scrubPeriod;
+			}
+
+			void setScrubPeriod(int days) {
+				m_scrubPeriod = (1 > days ? 1 : days);
+			}
+
+			/* in scrub mode, the minutes a slice may run for - 0 for no limit */
+			int sliceDuration() const {
+				return m_sliceDuration;
+			}
+
+			void setSliceDuration(int minutes) {
+				m_sliceDuration = (0 > minutes ? 0 : minutes);
+			}
+
+			/* in scrub mode, the MiB a slice may scan - 0 for no limit */
+			int sliceSize() const {
+				return m_sliceSize;
+			}
+
+			void setSliceSize(int mib) {
+				m_sliceSize = (0 > mib ? 0 : mib);
+			}
+
+			/* in deadline mode, the minutes the scan may run for */
+			int deadline() const {
+				return m_deadline;
+			}
+
+			void setDeadline(int minutes) {
+				m_deadline = (1 > minutes ? 1 : minutes);
+			}
+
 			void addPath(const QString & path) {
 				m_paths.append(path);
 			}
@@ -48,6 +114,11 @@ namespace Qlam {
 		private:
 			QString m_name;
 			QStringList m_paths;
+			ScanMode m_scanMode;
+			int m_scrubPeriod;
+			int m_sliceDuration;
+			int m_sliceSize;
+			int m_deadline;
 	};
 }
 
@@ -0,0 +1,139 @@
+#include "scanqueue.h"
+
+#include <algorithm>
+
+using namespace Qlam;
+
+namespace {
+	// heap ordering for largest-first mode
+	bool isSmaller(const ScanQueue::Item & lhs, const ScanQueue::Item & rhs) {
+		return lhs.size < rhs.size;
+	}
+
+	// heap ordering for highest-score-first mode
+	bool isLowerScore(const ScanQueue::Item & lhs, const ScanQueue::Item & rhs) {
+		return lhs.score < rhs.score;
+	}
+}
+
+ScanQueue::ScanQueue(std::size_t capacity)
+: m_capacity(0 < capacity ? capacity : 1),
+  m_items(),
+  m_largestFirst(false),
+  m_highestScoreFirst(false),
+  m_closed(false),
+  m_aborted(false) {
+}
+
+/**
+ * Add a file to the queue.
+ *
+ * Blocks while the queue is full. Returns false if the queue has been closed or aborted, in which case the item has
+ * not been queued.
+ */
+bool ScanQueue::push(Item item) {
+	std::unique_lock<std::mutex> lock(m_lock);
+	m_notFull.wait(lock, [this]() {
+		return m_closed || m_aborted || m_items.size() < m_capacity;
+	});
+
+	if(m_closed || m_aborted) {
+		return false;
+	}
+
+	m_items.push_back(std::move(item));
+
+	if(m_highestScoreFirst) {
+		std::push_heap(m_items.begin(), m_items.end(), isLowerScore);
+	}
+	else if(m_largestFirst) {
+		std::push_heap(m_items.begin(), m_items.end(), isSmaller);
+	}
+
+	lock.unlock();
+	m_notEmpty.notify_one();
+	return true;
+}
+
+/**
+ * Take the next file from the queue.
+ *
+ * Blocks while the queue is empty. An empty return value means there is no more work - the queue has been closed and
+ * drained, or it has been aborted.
+ */
+std::optional<ScanQueue::Item> ScanQueue::pop() {
+	std::unique_lock<std::mutex> lock(m_lock);
+	m_notEmpty.wait(lock, [this]() {
+		return m_closed || m_aborted || !m_items.empty();
+	});
+
+	return take(lock);
+}
+
+std::optional<ScanQueue::Item> ScanQueue::tryPop() {
+	std::unique_lock<std::mutex> lock(m_lock);
+	return take(lock);
+}
+
+bool ScanQueue::isDrained() {
+	std::lock_guard<std::mutex> lock(m_lock);
+	return m_aborted || (m_closed && m_items.empty());
+}
+
+/**
+ * Remove the next item, if there is one, and release a blocked push().
+ *
+ * m_lock must be held by the given lock, which is released if an item is taken.
+ */
+std::optional<ScanQueue::Item> ScanQueue::take(std::unique_lock<std::mutex> & lock) {
+	if(m_aborted || m_items.empty()) {
+		return {};
+	}
+
+	Item item;
+
+	if(m_highestScoreFirst || m_largestFirst) {
+		std::pop_heap(m_items.begin(), m_items.end(), (m_highestScoreFirst ? isLowerScore : isSmaller));
+		item = std::move(m_items.back());
+		m_items.pop_back();
+	}
+	else {
+		item = std::move(m_items.front());
+		m_items.pop_front();
+	}
+
+	lock.unlock();
+	m_notFull.notify_one();
+	return item;
+}
+
+void ScanQueue::close() {
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_closed = true;
+	}
+
+	m_notEmpty.notify_all();
+	m_notFull.notify_all();
+}
+
+std::deque<ScanQueue::Item> ScanQueue::abort() {
+	std::deque<Item> discarded;
+
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_aborted = true;
+		discarded.swap(m_items);
+	}
+
+	m_notEmpty.notify_all();
+	m_notFull.notify_all();
+	return discarded;
+}
+
+void ScanQueue::reset() {
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_items.clear();
+	m_closed = false;
+	m_aborted = false;
+}
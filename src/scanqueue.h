@@ -0,0 +1,132 @@
+#ifndef QLAM_SCANQUEUE_H
+#define QLAM_SCANQUEUE_H
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <optional>
+
+#include <fcntl.h>
+
+#include <QtCore/QByteArray>
+
+#include "filerisk.h"
+#include "opendirectory.h"
+
+namespace Qlam {
+	/**
+	 * A bounded, blocking queue of files waiting to be scanned.
+	 *
+	 * The directory traversal pushes files onto the queue and the scan workers pop them off. When the queue is full
+	 * push() blocks until a worker has taken an item, so the memory used by a scan does not depend on how many files
+	 * the scan paths contain.
+	 *
+	 * In largest-first mode the queue doubles as a look-ahead window: pop() returns the largest file currently queued
+	 * rather than the oldest. Starting the big files as soon as they're seen (longest-processing-time-first) stops one
+	 * huge file found near the end of the walk from leaving a single worker busy while the rest sit idle.
+	 *
+	 * In highest-score-first mode pop() returns the queued file with the highest risk score instead, so a scan that is
+	 * stopped before it finishes has spent its time on the files that matter most. The larger the queue, the more of
+	 * the walk the ordering can see.
+	 */
+	class ScanQueue {
+		public:
+			static constexpr const std::size_t DefaultCapacity = 1024;
+
+			struct Item {
+				// the directory containing the file - the file is opened relative to this
+				OpenDirectory::Pointer directory;
+
+				// the file's name in the local 8-bit encoding
+				QByteArray name;
+
+				// symlinks to files are followed when the file is opened, but nothing else is
+				bool isSymLink;
+
+				// the file's size as seen by the walk, 0 if not known
+				quint64 size;
+
+				// the file is in a provisional scan cache, so only needs checking against the signature delta
+				bool isProvisionallyClean = false;
+
+				// the file's risk, for scans that order files by it
+				FileRisk::Type riskType = FileRisk::Type::Other;
+				quint32 score = 0;
+
+				/* the flags to open the file with, relative to its directory. O_NOATIME keeps the scan from writing
+				 * access times, but fails with EPERM on files the process doesn't own unless it has CAP_FOWNER */
+				int openFlags(bool noAtime = false) const {
+					return openFlags(isSymLink, noAtime);
+				}
+
+				/* the same, for a file that isn't queued (yet) */
+				static int openFlags(bool isSymLink, bool noAtime) {
+					return O_RDONLY | O_CLOEXEC | (isSymLink ? 0 : O_NOFOLLOW) | (noAtime ? O_NOATIME : 0);
+				}
+			};
+
+			explicit ScanQueue(std::size_t capacity = DefaultCapacity);
+
+			ScanQueue(const ScanQueue &) = delete;
+			ScanQueue & operator=(const ScanQueue &) = delete;
+
+			std::size_t capacity() const {
+				return m_capacity;
+			}
+
+			/* must not be changed while items are queued */
+			void setCapacity(std::size_t capacity) {
+				m_capacity = (0 < capacity ? capacity : 1);
+			}
+
+			bool isLargestFirst() const {
+				return m_largestFirst;
+			}
+
+			/* must not be changed while items are queued */
+			void setLargestFirst(bool largestFirst) {
+				m_largestFirst = largestFirst;
+			}
+
+			bool isHighestScoreFirst() const {
+				return m_highestScoreFirst;
+			}
+
+			/* must not be changed while items are queued. takes precedence over largest-first */
+			void setHighestScoreFirst(bool highestScoreFirst) {
+				m_highestScoreFirst = highestScoreFirst;
+			}
+
+			bool push(Item);
+			std::optional<Item> pop();
+
+			/* as pop(), but returns nothing rather than blocking when the queue is empty */
+			std::optional<Item> tryPop();
+
+			/* whether pop() would return nothing from now on - the queue has been closed and drained, or aborted */
+			bool isDrained();
+
+			/* no more items will be pushed - pop() drains what is left then returns nothing */
+			void close();
+
+			/* discard queued items and release everything blocked on the queue. returns the discarded items */
+			std::deque<Item> abort();
+
+			void reset();
+
+		private:
+			std::optional<Item> take(std::unique_lock<std::mutex> &);
+
+			std::size_t m_capacity;
+			std::deque<Item> m_items;
+			bool m_largestFirst;
+			bool m_highestScoreFirst;
+			bool m_closed;
+			bool m_aborted;
+			std::mutex m_lock;
+			std::condition_variable m_notEmpty;
+			std::condition_variable m_notFull;
+	};
+}
+
+#endif // QLAM_SCANQUEUE_H
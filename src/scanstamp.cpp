@@ -0,0 +1,212 @@
+#include "scanstamp.h"
+
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <ctime>
+
+#include <fcntl.h>
+#include <sys/random.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QDebug>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QMessageAuthenticationCode>
+#include <QtCore/QStandardPaths>
+#include <QtCore/QtEndian>
+
+using namespace Qlam;
+
+// identifies a stamp, and the version of its layout
+static constexpr const char StampMagic[8] = {'Q', 'L', 'A', 'M', 'S', 'T', 'P', '2'};
+
+// the size of the key stamps are authenticated with
+static constexpr const std::size_t KeySize = 32;
+
+// how far, in ns, a stamped file's ctime may be from the time the stamp was written. covers the coarse clock the
+// kernel stamps ctime with and filesystems that only keep whole seconds
+static constexpr const qint64 StampTolerance = 1000000000;
+
+namespace {
+	// the attribute's value, all little-endian so that stamps can be read on any host
+	struct Stamp {
+		char magic[8];
+		char databaseDigest[16];
+		quint64 size;
+
+		// ns since the epoch
+		qint64 mtime;
+		qint64 stamped;
+
+		// HMAC-BLAKE2b of everything above
+		char mac[32];
+	};
+
+	static_assert(80 == sizeof(Stamp), "stamps must have the same layout everywhere");
+
+	QByteArray mac(const Stamp & stamp, const QByteArray & key) {
+		return QMessageAuthenticationCode::hash(QByteArray::fromRawData(reinterpret_cast<const char *>(&stamp), offsetof(Stamp, mac)), key, QCryptographicHash::Blake2b_256);
+	}
+
+	/**
+	 * Write a new random key to a file that doesn't exist yet, and open it for reading.
+	 *
+	 * Returns -1 if the key couldn't be made. If another process made the key first, its key is opened instead.
+	 */
+	int createKey(const QByteArray & path) {
+		QDir().mkpath(QFileInfo(QFile::decodeName(path)).absolutePath());
+		char key[KeySize];
+
+		if(static_cast<ssize_t>(sizeof(key)) != ::getrandom(key, sizeof(key), 0)) {
+			return -1;
+		}
+
+		int fd = ::open(path.constData(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, S_IRUSR | S_IWUSR);
+
+		if(-1 == fd) {
+			return (EEXIST == errno ? ::open(path.constData(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW) : -1);
+		}
+
+		const bool isWritten = static_cast<ssize_t>(sizeof(key)) == ::write(fd, key, sizeof(key)) && 0 == ::fsync(fd);
+		::close(fd);
+
+		if(!isWritten) {
+			::unlink(path.constData());
+			return -1;
+		}
+
+		return ::open(path.constData(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+	}
+
+	qint64 nanoseconds(const struct timespec & time) {
+		return static_cast<qint64>(time.tv_sec) * 1000000000 + time.tv_nsec;
+	}
+
+	bool isNear(qint64 ctime, qint64 stamped) {
+		return ctime >= stamped - StampTolerance && ctime <= stamped + StampTolerance;
+	}
+}
+
+ScanStamp::ScanStamp(const QByteArray & databaseVersion)
+: m_databaseDigest() {
+	setDatabaseVersion(databaseVersion);
+}
+
+QString ScanStamp::defaultKeyPath() {
+	return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + QStringLiteral("/stampkey");
+}
+
+/**
+ * Load the key stamps are authenticated with.
+ *
+ * A key that others could read would let them forge stamps, and one that others could write would let them replace
+ * it, so the file is refused unless it belongs to the user running the scan and no one else has access to it.
+ */
+bool ScanStamp::loadKey(const QString & path) {
+	m_key.clear();
+	const QByteArray rawPath = QFile::encodeName(path.isEmpty() ? defaultKeyPath() : path);
+	int fd = ::open(rawPath.constData(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+
+	if(-1 == fd && ENOENT == errno) {
+		fd = createKey(rawPath);
+	}
+
+	if(-1 == fd) {
+qDebug() << "failed to open scan stamp key" << rawPath << ":" << std::strerror(errno);
+		return false;
+	}
+
+	struct stat st{};
+	char key[KeySize];
+	const bool isUsable = 0 == ::fstat(fd, &st) && S_ISREG(st.st_mode) && ::geteuid() == st.st_uid && 0 == (st.st_mode & (S_IRWXG | S_IRWXO))
+		&& static_cast<ssize_t>(sizeof(key)) == ::read(fd, key, sizeof(key));
+	::close(fd);
+
+	if(!isUsable) {
+qDebug() << "scan stamp key" << rawPath << "must hold at least" << KeySize << "bytes and be accessible to its owner only";
+		return false;
+	}
+
+	m_key = QByteArray(key, sizeof(key));
+	return true;
+}
+
+void ScanStamp::setDatabaseVersion(const QByteArray & databaseVersion) {
+	if(databaseVersion.isEmpty()) {
+		m_databaseDigest.clear();
+	}
+	else {
+		m_databaseDigest = QCryptographicHash::hash(databaseVersion, QCryptographicHash::Blake2b_256).left(sizeof(Stamp::databaseDigest));
+	}
+}
+
+/**
+ * Check whether a file carries a stamp saying it's clean with the current signatures.
+ */
+bool ScanStamp::isClean(int fd, const struct stat & st) const {
+	if(!isValid()) {
+		return false;
+	}
+
+	Stamp stamp{};
+
+	if(static_cast<ssize_t>(sizeof(stamp)) != ::fgetxattr(fd, AttributeName, &stamp, sizeof(stamp))) {
+		return false;
+	}
+
+	// compared in full rather than stopping at the first difference, so the time taken says nothing about the MAC
+	const QByteArray expected = mac(stamp, m_key);
+	char difference = 0;
+
+	for(std::size_t idx = 0; idx < sizeof(stamp.mac); ++idx) {
+		difference |= static_cast<char>(stamp.mac[idx] ^ expected[static_cast<int>(idx)]);
+	}
+
+	return 0 == difference
+		&& 0 == std::memcmp(stamp.magic, StampMagic, sizeof(StampMagic))
+		&& 0 == std::memcmp(stamp.databaseDigest, m_databaseDigest.constData(), sizeof(stamp.databaseDigest))
+		&& qFromLittleEndian(stamp.size) == static_cast<quint64>(st.st_size)
+		&& qFromLittleEndian(stamp.mtime) == nanoseconds(st.st_mtim)
+		&& isNear(nanoseconds(st.st_ctim), qFromLittleEndian(stamp.stamped));
+}
+
+/**
+ * Record on a file that it has been scanned clean.
+ *
+ * Fails quietly if the filesystem doesn't support user attributes or the file can't be written to. A stamp that
+ * wouldn't be trusted - because the file changed as it was being stamped, or its filesystem's clock is too far from
+ * ours - is removed again.
+ */
+bool ScanStamp::stamp(int fd, const struct stat & st) const {
+	struct timespec now{};
+
+	if(!isValid() || 0 != ::clock_gettime(CLOCK_REALTIME, &now)) {
+		return false;
+	}
+
+	Stamp stamp{};
+	std::memcpy(stamp.magic, StampMagic, sizeof(StampMagic));
+	std::memcpy(stamp.databaseDigest, m_databaseDigest.constData(), sizeof(stamp.databaseDigest));
+	stamp.size = qToLittleEndian(static_cast<quint64>(st.st_size));
+	stamp.mtime = qToLittleEndian(nanoseconds(st.st_mtim));
+	stamp.stamped = qToLittleEndian(nanoseconds(now));
+	const QByteArray stampMac = mac(stamp, m_key);
+	std::memcpy(stamp.mac, stampMac.constData(), sizeof(stamp.mac));
+
+	if(0 != ::fsetxattr(fd, AttributeName, &stamp, sizeof(stamp), 0)) {
+		return false;
+	}
+
+	struct stat after{};
+
+	if(0 == ::fstat(fd, &after) && isClean(fd, after)) {
+		return true;
+	}
+
+	::fremovexattr(fd, AttributeName);
+	return false;
+}
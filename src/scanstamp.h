@@ -0,0 +1,57 @@
+#ifndef QLAM_SCANSTAMP_H
+#define QLAM_SCANSTAMP_H
+
+#include <sys/stat.h>
+
+#include <QtCore/QByteArray>
+#include <QtCore/QString>
+
+namespace Qlam {
+	/**
+	 * Clean verdicts recorded on the files themselves, in an extended attribute.
+	 *
+	 * A stamp holds a digest of the signature database versions the file was scanned with, and the size, mtime and
+	 * ctime it had once stamped. Unlike the scan cache it doesn't depend on the device or inode, so it survives the
+	 * cache being wiped, device numbers changing between boots and filesystem snapshots and restores that keep ctime.
+	 *
+	 * Setting the attribute itself updates the file's ctime, so the stamp holds the time at which it was written and
+	 * is only trusted while the file's ctime is within StampTolerance of that. Any later change to the file - even one
+	 * that puts its mtime back - moves its ctime on and leaves the stamp untrusted.
+	 *
+	 * Anyone who can write a file can set its attributes, so a stamp is authenticated with an HMAC keyed by a secret
+	 * only the scanner can read. A stamp that doesn't verify - forged, or written with another key - is ignored.
+	 */
+	class ScanStamp {
+		public:
+			static constexpr const char * AttributeName = "user.qlam.stamp";
+
+			explicit ScanStamp(const QByteArray & databaseVersion = {});
+
+			/* where the key is kept unless the settings say otherwise */
+			static QString defaultKeyPath();
+
+			/* stamps can only be read or written once the key and the database version are known */
+			bool isValid() const {
+				return !m_key.isEmpty() && !m_databaseDigest.isEmpty();
+			}
+
+			/* read the key from a file, creating it with a new random key if there isn't one. the file must be
+			 * accessible to its owner only. hosts that share stamped files can share a key by being given copies of the
+			 * same file */
+			bool loadKey(const QString & path = {});
+
+			void setDatabaseVersion(const QByteArray &);
+
+			/* st is the file's current metadata */
+			bool isClean(int fd, const struct stat & st) const;
+
+			/* st is the metadata the clean verdict was reached with */
+			bool stamp(int fd, const struct stat & st) const;
+
+		private:
+			QByteArray m_key;
+			QByteArray m_databaseDigest;
+	};
+}
+
+#endif // QLAM_SCANSTAMP_H
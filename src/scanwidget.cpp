@@ -9,18 +9,24 @@
 
 #include <QtGlobal>
 #include <QtCore/QDebug>
+#include <QtWidgets/QComboBox>
 #include <QtWidgets/QLineEdit>
 #include <QtWidgets/QInputDialog>
 #include <QtWidgets/QFileDialog>
 #include <QtWidgets/QMessageBox>
+#include <QtWidgets/QSpinBox>
 #include <QtGui/QDragEnterEvent>
 #include <QtCore/QMimeData>
 #include <QtCore/QUrl>
+#include <QtCore/QFile>
+#include <algorithm>
+#include <array>
 #include <cmath>
 #include <QtCore/QCoreApplication>
 
 #include "qlam.h"
 #include "application.h"
+#include "changejournal.h"
 #include "scanner.h"
 #include "scanprofile.h"
 #include "scannerheuristicmatch.h"
@@ -34,11 +40,13 @@ ScanWidget::ScanWidget(QWidget *parent)
 	: QWidget(parent),
       m_ui(std::make_unique<Ui::ScanWidget>()),
       m_scanner(QStringLiteral()),
+      m_scanProfile(),
       m_scanDuration(0),
       m_scanDurationTimer(0) {
 	m_ui->setupUi(this);
 	setAcceptDrops(true);
 	hideScanOutput();
+	m_ui->scanSummary->hide();
 	slotScanPathsSelectionChanged();
 
 	QFont f(m_ui->title->font());
@@ -48,6 +56,11 @@ ScanWidget::ScanWidget(QWidget *parent)
 #endif
 	m_ui->title->setFont(f);
 	m_ui->issuesList->setHeaderLabels(QStringList() << tr("File path") << tr("Issue"));
+	m_ui->scanMode->addItem(tr("Everything"), static_cast<int>(ScanProfile::ScanMode::Full));
+	m_ui->scanMode->addItem(tr("Changes since the last scan"), static_cast<int>(ScanProfile::ScanMode::Incremental));
+	m_ui->scanMode->addItem(tr("Scrub a slice at a time"), static_cast<int>(ScanProfile::ScanMode::Scrub));
+	m_ui->scanMode->addItem(tr("Riskiest files until the deadline"), static_cast<int>(ScanProfile::ScanMode::Deadline));
+	syncScanMode();
 
 	connect(m_ui->scanButton, &QPushButton::clicked, this, &ScanWidget::doScan);
 	connect(m_ui->scanButton, &QPushButton::clicked, this, &ScanWidget::scanButtonClicked);
@@ -57,6 +70,11 @@ ScanWidget::ScanWidget(QWidget *parent)
 	connect(m_ui->scanPaths, &QListWidget::itemSelectionChanged, this, &ScanWidget::slotScanPathsSelectionChanged);
 	connect(m_ui->removeScanPath, &QPushButton::clicked, this, &ScanWidget::removeSelectedScanPaths);
 	connect(m_ui->saveScanProfile, &QPushButton::clicked, this, &ScanWidget::saveProfileButtonClicked);
+	connect(m_ui->scanMode, qOverload<int>(&QComboBox::currentIndexChanged), this, &ScanWidget::slotScanModeChanged);
+	connect(m_ui->scrubPeriod, qOverload<int>(&QSpinBox::valueChanged), this, &ScanWidget::slotScanModeChanged);
+	connect(m_ui->sliceDuration, qOverload<int>(&QSpinBox::valueChanged), this, &ScanWidget::slotScanModeChanged);
+	connect(m_ui->sliceSize, qOverload<int>(&QSpinBox::valueChanged), this, &ScanWidget::slotScanModeChanged);
+	connect(m_ui->deadline, qOverload<int>(&QSpinBox::valueChanged), this, &ScanWidget::slotScanModeChanged);
 
 	// we use a blocking queued connection because all signals originate in the scanner thread (all are emitted after
 	// Scanner::run() has been called and before it exits) and we need the slots to be called immediately otherwise they
@@ -71,11 +89,14 @@ ScanWidget::ScanWidget(QWidget *parent)
 	connect(&m_scanner, &Scanner::scanFinished, this, &ScanWidget::slotScanFinished, Qt::BlockingQueuedConnection);
 	connect(&m_scanner, &Scanner::scanFinished, this, &ScanWidget::scanFinished, Qt::BlockingQueuedConnection);
 	connect(&m_scanner, &Scanner::pathNotFound, this, &ScanWidget::addPathNotFound, Qt::BlockingQueuedConnection);
-	connect(&m_scanner, &Scanner::fileScanned, this, &ScanWidget::setScanStatus, Qt::BlockingQueuedConnection);
-	connect(&m_scanner, &Scanner::fileScanned, this, &ScanWidget::slotScannerScannedFile, Qt::BlockingQueuedConnection);
+	connect(&m_scanner, &Scanner::filesScanned, this, &ScanWidget::slotScannerScannedFiles, Qt::BlockingQueuedConnection);
 	connect(&m_scanner, &Scanner::fileInfected, this, &ScanWidget::addIssue, Qt::BlockingQueuedConnection);
 	connect(&m_scanner, &Scanner::fileMatchedHeuristic, this, &ScanWidget::addMatchedHeuristic, Qt::BlockingQueuedConnection);
 	connect(&m_scanner, &Scanner::fileScanFailed, this, &ScanWidget::addFailedFileScan, Qt::BlockingQueuedConnection);
+
+	// emitted from the scanner's tuning thread as well as the scanner thread, and only ever updates the concurrency
+	// display, so a plain queued connection is enough
+	connect(&m_scanner, &Scanner::concurrencyChanged, this, &ScanWidget::slotScannerConcurrencyChanged, Qt::QueuedConnection);
 }
 
 ScanWidget::~ScanWidget() = default;
@@ -109,16 +130,60 @@ void ScanWidget::setScanProfile( const ScanProfile & profile ) {
 	clearScanOutput();
 	hideScanOutput();
 	clearScanPaths();
+	m_scanProfile = profile;
 
 	for(const auto & path : profile.paths()) {
 		addScanPath(path);
 	}
 
 	m_ui->title->setText(tr("Scan: %1").arg(profile.name()));
+	syncScanMode();
 	blockSignals(block);
 	Q_EMIT scanPathsChanged();
 }
 
+/**
+ * Show the profile's scan mode and the parameters that apply to it.
+ */
+void ScanWidget::syncScanMode() {
+	const ScanProfile::ScanMode mode = m_scanProfile.scanMode();
+
+	// each of them updates the whole of the mode from what they all show
+	const std::array<QWidget *, 5> widgets = {m_ui->scanMode, m_ui->scrubPeriod, m_ui->sliceDuration, m_ui->sliceSize, m_ui->deadline};
+
+	for(auto * widget : widgets) {
+		widget->blockSignals(true);
+	}
+
+	m_ui->scanMode->setCurrentIndex(m_ui->scanMode->findData(static_cast<int>(mode)));
+	m_ui->scrubPeriod->setValue(m_scanProfile.scrubPeriod());
+	m_ui->sliceDuration->setValue(m_scanProfile.sliceDuration());
+	m_ui->sliceSize->setValue(m_scanProfile.sliceSize());
+	m_ui->deadline->setValue(m_scanProfile.deadline());
+
+	for(auto * widget : widgets) {
+		widget->blockSignals(false);
+	}
+
+	const bool isScrub = (ScanProfile::ScanMode::Scrub == mode);
+	m_ui->scrubPeriod->setVisible(isScrub);
+	m_ui->sliceDuration->setVisible(isScrub);
+	m_ui->sliceSize->setVisible(isScrub);
+	m_ui->deadline->setVisible(ScanProfile::ScanMode::Deadline == mode);
+}
+
+/**
+ * The scan mode has been edited - the next scan uses it, and saving the profile keeps it.
+ */
+void ScanWidget::slotScanModeChanged() {
+	m_scanProfile.setScanMode(static_cast<ScanProfile::ScanMode>(m_ui->scanMode->currentData().toInt()));
+	m_scanProfile.setScrubPeriod(m_ui->scrubPeriod->value());
+	m_scanProfile.setSliceDuration(m_ui->sliceDuration->value());
+	m_scanProfile.setSliceSize(m_ui->sliceSize->value());
+	m_scanProfile.setDeadline(m_ui->deadline->value());
+	syncScanMode();
+}
+
 void ScanWidget::dragEnterEvent( QDragEnterEvent * event ) {
 	if(event->mimeData()->hasUrls()) {
 		QList<QUrl> urls = event->mimeData()->urls();
@@ -212,11 +277,66 @@ void ScanWidget::removeSelectedScanPaths() {
 
 void ScanWidget::doScan() {
 	m_scanner.setScanPaths(scanPaths());
+	m_scanner.setWorkerCount(qlamApp->settings()->scanWorkerCount());
+	m_scanner.setOrderedWalk(qlamApp->settings()->orderedScan());
+	m_scanner.setScanOrder(qlamApp->settings()->scanOrder());
+	m_scanner.setScanHardLinksOnce(qlamApp->settings()->scanHardLinksOnce());
+	m_scanner.setScanLargeFilesFirst(qlamApp->settings()->scanLargeFilesFirst());
+	m_scanner.setUseReadAhead(qlamApp->settings()->useReadAhead());
+	m_scanner.setPreservePageCache(qlamApp->settings()->preservePageCache());
+	m_scanner.setStageRemoteFiles(qlamApp->settings()->stageRemoteFiles());
+	m_scanner.setUseScanCache(qlamApp->settings()->useScanCache());
+	m_scanner.setUseScanStamps(qlamApp->settings()->useScanStamps());
+	m_scanner.setScanStampKeyFile(qlamApp->settings()->scanStampKeyFile());
+	m_scanner.setUseSignatureDelta(qlamApp->settings()->useSignatureDelta());
+	m_scanner.setUseManifest(qlamApp->settings()->useManifest());
+	m_scanner.setManifestFiles(qlamApp->settings()->manifestFiles());
+	m_scanner.setDeduplicateContent(qlamApp->settings()->deduplicateScans());
+
+	// the profile's journal and checkpoint only describe the profile's own paths. a scan of paths that have been
+	// edited since the profile was loaded mustn't take the journal, but the changes it makes aren't recorded in it
+	// either, so the profile's next scan walks everything
+	QStringList paths = scanPaths();
+	QStringList profilePaths = m_scanProfile.paths();
+	paths.sort();
+	paths.removeDuplicates();
+	profilePaths.sort();
+	profilePaths.removeDuplicates();
+	const bool isProfileScan = !m_scanProfile.name().isEmpty() && paths == profilePaths;
+
+	if(isProfileScan) {
+		m_scanner.setChangeJournalName(m_scanProfile.name());
+	}
+	else {
+		m_scanner.setChangeJournalName(QString());
+
+		if(!m_scanProfile.name().isEmpty()) {
+			ChangeJournal::invalidate(m_scanProfile.name());
+		}
+	}
+
+	m_scanner.setIncremental(isProfileScan && ScanProfile::ScanMode::Incremental == m_scanProfile.scanMode());
+
+	// a scrub's checkpoint is what it carries on from, so it's kept whatever the setting
+	const bool isScrub = (ScanProfile::ScanMode::Scrub == m_scanProfile.scanMode());
+	m_scanner.setCheckpointName(isProfileScan && (isScrub || qlamApp->settings()->resumeScans()) ? m_scanProfile.name() : QString());
+	m_scanner.setScrubPeriod(isScrub ? static_cast<qint64>(m_scanProfile.scrubPeriod()) * 24 * 60 * 60 * 1000 : 0);
+	m_scanner.setSliceDuration(static_cast<qint64>(m_scanProfile.sliceDuration()) * 60 * 1000);
+	m_scanner.setSliceSize(static_cast<quint64>(m_scanProfile.sliceSize()) * 1024 * 1024);
+
+	// walking in the same order every time means the subtrees left for each slice are the least recently scanned
+	if(isScrub) {
+		m_scanner.setOrderedWalk(true);
+	}
+
+	m_scanner.setDeadline(ScanProfile::ScanMode::Deadline == m_scanProfile.scanMode() ? static_cast<qint64>(m_scanProfile.deadline()) * 60 * 1000 : 0);
+
 	clearScanOutput();
 	showScanOutput();
 	setScanProgress(ScanWidget::IndeterminateProgress);
 	setScanStatus(tr("Initialising scan"));
 	m_ui->timer->setText("--");
+	m_ui->concurrency->clear();
 	m_scanDuration = 0;
 	m_scanDurationTimer = startTimer(1000);
 
@@ -253,9 +373,20 @@ void ScanWidget::setScanStatus( const QString & text ) {
 	m_ui->scanStatus->setText(text);
 }
 
+/**
+ * Add a line to the figures shown under the status at the end of a scan.
+ */
+void ScanWidget::addScanSummary(const QString & text) {
+	const QString summary = m_ui->scanSummary->text();
+	m_ui->scanSummary->setText(summary.isEmpty() ? text : summary + '\n' + text);
+	m_ui->scanSummary->show();
+}
+
 void ScanWidget::clearScanOutput() {
 	m_ui->scanProgress->setValue(0);
 	m_ui->scanStatus->clear();
+	m_ui->scanSummary->clear();
+	m_ui->scanSummary->hide();
 	m_ui->issuesList->clear();
 	m_ui->issuesList->setHeaderHidden(true);
 }
@@ -370,7 +501,11 @@ void ScanWidget::addFailedFileScan( const QString & path ) {
 	m_ui->issuesList->resizeColumnToContents(1);
 }
 
-void ScanWidget::slotScannerScannedFile() {
+void ScanWidget::slotScannerScannedFiles(int, const QString & lastPath) {
+	if(!lastPath.isEmpty()) {
+		setScanStatus(lastPath);
+	}
+
 	std::optional<int> fileCount = m_scanner.fileCount();
 
 	if (!fileCount) {
@@ -382,6 +517,11 @@ void ScanWidget::slotScannerScannedFile() {
 	setScanProgress(pc);
 }
 
+void ScanWidget::slotScannerConcurrencyChanged(int workers) {
+	m_ui->concurrency->setText(tr("%n thread(s)", "", workers));
+	m_ui->concurrency->setToolTip(tr("Scanning with %1 threads across all devices, with up to %2 for each local disk.").arg(workers).arg(Scanner::defaultWorkerCount()));
+}
+
 void ScanWidget::slotScanSucceeded() {
 	long long kb = m_scanner.dataScanned();
     QLocale currentLocale;
@@ -400,14 +540,48 @@ void ScanWidget::slotScanSucceeded() {
 		sizeDisplay = tr("%1 Gb").arg(currentLocale.toString(static_cast<double>(kb) / 1048576, 'f', 2));
 	}
 
-	setScanStatus(tr("Scan finished in %4 (%1 issues found in %2 of data in %3 files)")
+	if(m_scanner.endedSlice()) {
+		showSliceProgress(sizeDisplay);
+		return;
+	}
+
+	setScanStatus(tr("Scan finished in %4 (%1 issues found in %2 of data in %3 files using %5 threads)")
         .arg(currentLocale.toString(m_scanner.issueCount()))
         .arg(sizeDisplay)
         .arg(currentLocale.toString(m_scanner.scannedFileCount()))
-        .arg(currentDurationString()));
+        .arg(currentDurationString())
+        .arg(currentLocale.toString(m_scanner.concurrency())));
     setScanProgress(100);
 
-    if (m_ui->quitOnClean->isChecked() && 0 == m_scanner.issueCount()) {
+	if(m_scanner.reachedDeadline()) {
+		showCoverage();
+	}
+
+	showMountLatencies();
+
+	// how evenly the work was spread - the time the first workers to finish spent waiting for the last
+	if(0 < m_scanner.idleTailTime()) {
+		addScanSummary(tr("Some workers were idle for the last %1 s of the scan while the others finished.")
+			.arg(currentLocale.toString(static_cast<double>(m_scanner.idleTailTime()) / 1000.0, 'f', 1)));
+	}
+
+	if(0 < m_scanner.holeDataSkipped()) {
+		addScanSummary(tr("%1 MiB of holes in sparse files were skipped rather than read.")
+			.arg(currentLocale.toString(static_cast<double>(m_scanner.holeDataSkipped()) / 1048576.0, 'f', 1)));
+	}
+
+	// how well the read-ahead kept the workers fed - stalls are where a worker waited on a read it had already asked for
+	const ReadAhead::Stats readAheadStats = m_scanner.readAheadStats();
+
+	if(0 < readAheadStats.submissionCount) {
+		addScanSummary(tr("Reads ahead kept %1 operations in flight on average; workers waited on them %2 times for %3 s.")
+			.arg(currentLocale.toString(readAheadStats.averageDepth(), 'f', 1))
+			.arg(currentLocale.toString(readAheadStats.stallCount))
+			.arg(currentLocale.toString(static_cast<double>(readAheadStats.stallTime) / 1000000000.0, 'f', 1)));
+	}
+
+	// a scan that ran out of time hasn't shown that everything is clean
+    if (m_ui->quitOnClean->isChecked() && 0 == m_scanner.issueCount() && !m_scanner.reachedDeadline()) {
         TimedActionDialogue::Action action = [this]() {
             if (m_scanner.isRunning()) {
                 connect(&m_scanner, &QThread::finished, Application::instance(), &Application::quit);
@@ -427,6 +601,114 @@ void ScanWidget::slotScanSucceeded() {
     }
 }
 
+/**
+ * Report a slice of a scrub that stopped at its limits. It hasn't finished the paths, so it's neither a finished nor a
+ * clean scan - the progress is how far the scrub's cycle has got, as far as the size of the last cycle tells.
+ */
+void ScanWidget::showSliceProgress(const QString & sizeDisplay) {
+	QLocale currentLocale;
+	const quint64 cycleSize = m_scanner.scrubCycleSize();
+
+	setScanStatus(tr("Scrub slice ended after %4 (%1 issues found in %2 of data in %3 files using %5 threads) - the next slice carries on from here")
+		.arg(currentLocale.toString(m_scanner.issueCount()))
+		.arg(sizeDisplay)
+		.arg(currentLocale.toString(m_scanner.scannedFileCount()))
+		.arg(currentDurationString())
+		.arg(currentLocale.toString(m_scanner.concurrency())));
+
+	if(0 < cycleSize) {
+		// the cycle isn't done until a slice reaches the end of the paths, whatever the last cycle's size says
+		setScanProgress(static_cast<int>(std::min<quint64>(99, 100 * m_scanner.scrubCycleScanned() / cycleSize)));
+		addScanSummary(tr("This cycle of the scrub has scanned %1 MiB of the %2 MiB the last cycle covered.")
+			.arg(currentLocale.toString(static_cast<double>(m_scanner.scrubCycleScanned()) / 1048576.0, 'f', 1))
+			.arg(currentLocale.toString(static_cast<double>(cycleSize) / 1048576.0, 'f', 1)));
+	}
+	else {
+		setScanProgress(0);
+		addScanSummary(tr("This cycle of the scrub has scanned %1 MiB so far.")
+			.arg(currentLocale.toString(static_cast<double>(m_scanner.scrubCycleScanned()) / 1048576.0, 'f', 1)));
+	}
+
+	showMountLatencies();
+}
+
+/**
+ * Report how much of what it found a scan that ran out of time got through, and what it left.
+ */
+void ScanWidget::showCoverage() {
+	const Scanner::Coverage coverage = m_scanner.coverage();
+	QLocale currentLocale;
+
+	const auto percent = [](quint64 part, quint64 whole) -> double {
+		return (0 == whole ? 100.0 : 100.0 * static_cast<double>(part) / static_cast<double>(whole));
+	};
+
+	setScanStatus(tr("Scan reached its deadline after %1: %2% of files and %3% of data verified (%4 of %5 files)%6")
+		.arg(currentDurationString())
+		.arg(currentLocale.toString(percent(coverage.total.verifiedFileCount(), coverage.total.fileCount), 'f', 1))
+		.arg(currentLocale.toString(percent(coverage.total.verifiedDataSize(), coverage.total.dataSize), 'f', 1))
+		.arg(currentLocale.toString(coverage.total.verifiedFileCount()))
+		.arg(currentLocale.toString(coverage.total.fileCount))
+		.arg(coverage.isWalkComplete ? QString() : tr(" - not all files were found"))
+	);
+
+	static const std::array<const char *, FileRisk::TypeCount> typeNames = {
+		QT_TR_NOOP("other files"),
+		QT_TR_NOOP("archives"),
+		QT_TR_NOOP("documents"),
+		QT_TR_NOOP("scripts"),
+		QT_TR_NOOP("executables"),
+	};
+
+	// riskiest first, as they were scanned
+	for(std::size_t idx = coverage.byType.size(); 0 < idx; --idx) {
+		const auto & counts = coverage.byType[idx - 1];
+
+		if(0 == counts.skippedFileCount) {
+			continue;
+		}
+
+		addScanSummary(tr("Not scanned before the deadline: %1 of %2 %3 (%4 Kb).")
+			.arg(currentLocale.toString(counts.skippedFileCount))
+			.arg(currentLocale.toString(counts.fileCount))
+			.arg(tr(typeNames[idx - 1]))
+			.arg(currentLocale.toString(counts.skippedDataSize / 1024)));
+	}
+}
+
+/**
+ * Report how long the network and FUSE filesystems the scan read from took to answer, since with them it's usually the
+ * round trips rather than the scanning that decide how long a scan takes.
+ */
+void ScanWidget::showMountLatencies() {
+	QLocale currentLocale;
+
+	const auto ms = [&currentLocale](quint64 count, qint64 time) {
+		return currentLocale.toString(Scanner::MountLatency::averageTime(count, time) / 1000000.0, 'f', 2);
+	};
+
+	for(const auto & latency : m_scanner.mountLatencies()) {
+		if(!MountTable::isHighLatency(latency.storage)) {
+			continue;
+		}
+
+		const double readSeconds = static_cast<double>(latency.readTime) / 1000000000.0;
+		const double readRate = (0.0 < readSeconds ? static_cast<double>(latency.readSize) / 1048576.0 / readSeconds : 0.0);
+
+		// the mount point goes in last, so that nothing in it is taken for a placeholder
+		addScanSummary(tr("%9 (%1 filesystem): %2 lookups averaging %3 ms, %4 opens averaging %5 ms, %6 whole-file reads averaging %7 ms (%8 MiB/s).")
+			.arg(MountTable::StorageType::Fuse == latency.storage ? tr("FUSE") : tr("network"))
+			.arg(currentLocale.toString(latency.statCount))
+			.arg(ms(latency.statCount, latency.statTime))
+			.arg(currentLocale.toString(latency.openCount))
+			.arg(ms(latency.openCount, latency.openTime))
+			.arg(currentLocale.toString(latency.readCount))
+			.arg(ms(latency.readCount, latency.readTime))
+			.arg(currentLocale.toString(readRate, 'f', 1))
+			.arg(QFile::decodeName(latency.mountPoint)));
+	}
+}
+
 void ScanWidget::slotScanFailed() {
 	setScanStatus(tr("Scan failed"));
 	addIssue("", tr("Scan failed."));
@@ -7,6 +7,7 @@
 #include <QtWidgets/QWidget>
 
 #include "scanner.h"
+#include "scanprofile.h"
 
 class QDragEnterEvent;
 class QDropEvent;
@@ -51,6 +52,17 @@ namespace Qlam {
 
 			void setScanProfile(const ScanProfile &);
 
+			/* the profile most recently chosen, with the scan mode as it has been edited since */
+			const ScanProfile & scanProfile() const {
+				return m_scanProfile;
+			}
+
+			/* the chosen profile has been saved with the paths and mode edited here - unlike setScanProfile(), this
+			 * leaves the scan output alone */
+			void setSavedScanProfile(const ScanProfile & profile) {
+				m_scanProfile = profile;
+			}
+
 		Q_SIGNALS:
 			void scanPathsChanged();
 			void scanButtonClicked();
@@ -61,6 +73,10 @@ namespace Qlam {
 		protected:
             void updateScanDuration();
             [[nodiscard]] QString currentDurationString() const;
+			void showSliceProgress(const QString & sizeDisplay);
+			void showCoverage();
+			void showMountLatencies();
+			void syncScanMode();
 			void dragEnterEvent(QDragEnterEvent *) override;
 			void dropEvent(QDropEvent *) override;
 			void timerEvent(QTimerEvent *) override;
@@ -83,6 +99,7 @@ namespace Qlam {
 			void setScanOutputVisible(bool vis);
 
 			void setScanStatus(const QString &);
+			void addScanSummary(const QString &);
 			void clearScanOutput();
 			void setScanProgress(int);
 			void addIssue(const QString &path, const QString &virus);
@@ -91,16 +108,21 @@ namespace Qlam {
 
 		private Q_SLOTS:
 			void addFailedFileScan(const QString &);
-			void slotScannerScannedFile();
+			void slotScannerScannedFiles(int, const QString &);
+			void slotScannerConcurrencyChanged(int);
 			void slotScanSucceeded();
 			void slotScanFailed();
 			void slotScanAborted();
 			void slotScanFinished();
 			void slotScanPathsSelectionChanged();
+			void slotScanModeChanged();
 
 		private:
 			std::unique_ptr<Ui::ScanWidget> m_ui;
 			Scanner m_scanner;
+
+			// the profile most recently chosen, whose change journal the scans take
+			ScanProfile m_scanProfile;
 			int m_scanDuration;
 			int m_scanDurationTimer;
     };
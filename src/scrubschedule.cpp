@@ -0,0 +1,108 @@
+#include "scrubschedule.h"
+
+#include <algorithm>
+
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QDateTime>
+#include <QtCore/QDebug>
+#include <QtCore/QDir>
+#include <QtCore/QSettings>
+
+using namespace Qlam;
+
+// how often slices are assumed to run until there have been enough of them to tell, in ms
+static constexpr const qint64 DefaultSliceInterval = 24 * 60 * 60 * 1000;
+
+ScrubSchedule::ScrubSchedule(QString directory)
+: m_directory(std::move(directory)),
+  m_fileName(),
+  m_cycleStarted(0),
+  m_cycleSize(0),
+  m_previousCycleSize(0),
+  m_lastSliceStarted(0),
+  m_sliceInterval(0) {
+}
+
+/**
+ * Read a profile's schedule, starting a new cycle if it doesn't have one.
+ */
+bool ScrubSchedule::load(const QString & profileName) {
+	if(profileName.isEmpty()) {
+		return false;
+	}
+
+	m_fileName = m_directory + '/' + QString::fromLatin1(QCryptographicHash::hash(profileName.toUtf8(), QCryptographicHash::Sha256).toHex().left(32)) + QStringLiteral(".scrub");
+	QSettings settings(m_fileName, QSettings::IniFormat);
+	m_cycleStarted = settings.value("cycle.started", QDateTime::currentMSecsSinceEpoch()).toLongLong();
+	m_cycleSize = settings.value("cycle.size", 0).toULongLong();
+	m_previousCycleSize = settings.value("previouscycle.size", 0).toULongLong();
+	m_lastSliceStarted = settings.value("slice.started", 0).toLongLong();
+	m_sliceInterval = settings.value("slice.interval", 0).toLongLong();
+	return true;
+}
+
+bool ScrubSchedule::save() const {
+	if(m_fileName.isEmpty()) {
+		return false;
+	}
+
+	QDir().mkpath(m_directory);
+	QSettings settings(m_fileName, QSettings::IniFormat);
+	settings.setValue("cycle.started", m_cycleStarted);
+	settings.setValue("cycle.size", m_cycleSize);
+	settings.setValue("previouscycle.size", m_previousCycleSize);
+	settings.setValue("slice.started", m_lastSliceStarted);
+	settings.setValue("slice.interval", m_sliceInterval);
+	settings.sync();
+	return QSettings::NoError == settings.status();
+}
+
+bool ScrubSchedule::isOverdue(qint64 period, qint64 now) const {
+	return m_cycleStarted + period <= now;
+}
+
+/**
+ * Work out how much the next slice must scan to keep the cycle on schedule.
+ *
+ * What is left of the cycle is taken to be what the last complete cycle scanned less what this one has scanned so
+ * far, and is shared between the slices expected before the period runs out.
+ */
+quint64 ScrubSchedule::requiredSliceSize(qint64 period, qint64 now) const {
+	if(0 == m_previousCycleSize || m_cycleSize >= m_previousCycleSize) {
+		return 0;
+	}
+
+	const quint64 remaining = m_previousCycleSize - m_cycleSize;
+	const qint64 timeLeft = m_cycleStarted + period - now;
+
+	if(0 >= timeLeft) {
+		return remaining;
+	}
+
+	const qint64 slicesLeft = std::max<qint64>(1, timeLeft / (0 < m_sliceInterval ? m_sliceInterval : DefaultSliceInterval));
+	return remaining / static_cast<quint64>(slicesLeft);
+}
+
+/**
+ * Record a slice that has been run.
+ *
+ * If the slice reached the end of the paths, a new cycle starts with the next slice.
+ */
+void ScrubSchedule::addSlice(qint64 started, quint64 size, bool completesCycle) {
+	if(0 < m_lastSliceStarted && m_lastSliceStarted < started) {
+		const qint64 interval = started - m_lastSliceStarted;
+
+		// a moving average, so that a change in how often slices are run is picked up within a few of them
+		m_sliceInterval = (0 < m_sliceInterval ? (3 * m_sliceInterval + interval) / 4 : interval);
+	}
+
+	m_lastSliceStarted = started;
+	m_cycleSize += size;
+
+	if(completesCycle) {
+qDebug() << "scrub cycle covered" << m_cycleSize << "bytes in" << (QDateTime::currentMSecsSinceEpoch() - m_cycleStarted) / 1000 << "s";
+		m_previousCycleSize = m_cycleSize;
+		m_cycleSize = 0;
+		m_cycleStarted = QDateTime::currentMSecsSinceEpoch();
+	}
+}
@@ -0,0 +1,57 @@
+#ifndef QLAM_SCRUBSCHEDULE_H
+#define QLAM_SCRUBSCHEDULE_H
+
+#include <QtCore/QString>
+
+#include "scancheckpoint.h"
+
+namespace Qlam {
+	/**
+	 * Keeps a profile's scrub on course to cover all of its paths within the scrub period.
+	 *
+	 * A scrub works through its paths in cycles, a slice per run, with the profile's checkpoint recording how far the
+	 * current cycle has got. The schedule records when the cycle started, how much it has scanned so far and how much
+	 * the last complete cycle scanned, along with how often slices have been run. From these it works out the least
+	 * the next slice must scan for the cycle to finish in time.
+	 *
+	 * All times are ms since the epoch.
+	 */
+	class ScrubSchedule {
+		public:
+			explicit ScrubSchedule(QString directory = ScanCheckpoint::defaultDirectory());
+
+			bool load(const QString & profileName);
+			bool save() const;
+
+			/* whether the current cycle has run past the period without finishing */
+			bool isOverdue(qint64 period, qint64 now) const;
+
+			/* the least the next slice must scan, in bytes - 0 before the first cycle is complete */
+			quint64 requiredSliceSize(qint64 period, qint64 now) const;
+
+			void addSlice(qint64 started, quint64 size, bool completesCycle);
+
+			/* how much the current cycle has scanned so far, in bytes */
+			quint64 cycleSize() const {
+				return m_cycleSize;
+			}
+
+			/* how much the last complete cycle scanned, in bytes - 0 before the first cycle is complete */
+			quint64 previousCycleSize() const {
+				return m_previousCycleSize;
+			}
+
+		private:
+			QString m_directory;
+			QString m_fileName;
+			qint64 m_cycleStarted;
+			quint64 m_cycleSize;
+			quint64 m_previousCycleSize;
+			qint64 m_lastSliceStarted;
+
+			// the average time between slices - 0 if not yet known
+			qint64 m_sliceInterval;
+	};
+}
+
+#endif // QLAM_SCRUBSCHEDULE_H
@@ -20,12 +20,50 @@ Settings::Settings(QString filePath, QObject * parent)
   m_updateServerType(OfficialMirror),
   m_updateMirror(),
   m_customUpdateServer(),
+  m_scanWorkerCount(0),
+  m_orderedScan(false),
+  m_scanOrder(ScanOrder::Discovery),
+  m_scanHardLinksOnce(false),
+  m_scanLargeFilesFirst(false),
+  m_useReadAhead(true),
+  m_preservePageCache(false),
+  m_stageRemoteFiles(true),
+  m_useScanCache(false),
+  m_useScanStamps(false),
+  m_scanStampKeyFile(),
+  m_useSignatureDelta(false),
+  m_useManifest(false),
+  m_manifestFiles(),
+  m_watchChanges(false),
+  m_resumeScans(true),
+  m_onAccessScanning(false),
+  m_onAccessPaths(),
+  m_deduplicateScans(false),
   m_modified(false) {
     load();
     connect(this, &Settings::databasePathChanged, this, &Settings::changed);
     connect(this, &Settings::updateServerTypeChanged, this, &Settings::changed);
     connect(this, &Settings::updateMirrorChanged, this, &Settings::changed);
     connect(this, qOverload<const QString &>(&Settings::customUpdateServerChanged), this, &Settings::changed);
+    connect(this, &Settings::scanWorkerCountChanged, this, &Settings::changed);
+    connect(this, &Settings::orderedScanChanged, this, &Settings::changed);
+    connect(this, &Settings::scanOrderChanged, this, &Settings::changed);
+    connect(this, &Settings::scanHardLinksOnceChanged, this, &Settings::changed);
+    connect(this, &Settings::scanLargeFilesFirstChanged, this, &Settings::changed);
+    connect(this, &Settings::useReadAheadChanged, this, &Settings::changed);
+    connect(this, &Settings::preservePageCacheChanged, this, &Settings::changed);
+    connect(this, &Settings::stageRemoteFilesChanged, this, &Settings::changed);
+    connect(this, &Settings::useScanCacheChanged, this, &Settings::changed);
+    connect(this, &Settings::useScanStampsChanged, this, &Settings::changed);
+    connect(this, &Settings::scanStampKeyFileChanged, this, &Settings::changed);
+    connect(this, &Settings::useSignatureDeltaChanged, this, &Settings::changed);
+    connect(this, &Settings::useManifestChanged, this, &Settings::changed);
+    connect(this, &Settings::manifestFilesChanged, this, &Settings::changed);
+    connect(this, &Settings::watchChangesChanged, this, &Settings::changed);
+    connect(this, &Settings::resumeScansChanged, this, &Settings::changed);
+    connect(this, &Settings::onAccessScanningChanged, this, &Settings::changed);
+    connect(this, &Settings::onAccessPathsChanged, this, &Settings::changed);
+    connect(this, &Settings::deduplicateScansChanged, this, &Settings::changed);
 }
 
 bool Settings::setUpdateMirror( const QString & mirror ) {
@@ -52,6 +90,25 @@ void Settings::fillSettings(QSettings & settings) const {
 	settings.setValue("updateserver.type", updateServerTypeToString(updateServerType()));
 	settings.setValue("updateserver.mirror", updateMirror());
 	settings.setValue("updateserver.customserver.url", customUpdateServer().toString());
+	settings.setValue("scanner.workers", scanWorkerCount());
+	settings.setValue("scanner.ordered", orderedScan());
+	settings.setValue("scanner.order", scanOrderToString(scanOrder()));
+	settings.setValue("scanner.hardlinksonce", scanHardLinksOnce());
+	settings.setValue("scanner.largefilesfirst", scanLargeFilesFirst());
+	settings.setValue("scanner.readahead", useReadAhead());
+	settings.setValue("scanner.preservepagecache", preservePageCache());
+	settings.setValue("scanner.stageremotefiles", stageRemoteFiles());
+	settings.setValue("scanner.cache", useScanCache());
+	settings.setValue("scanner.stamps", useScanStamps());
+	settings.setValue("scanner.stampkeyfile", scanStampKeyFile());
+	settings.setValue("scanner.signaturedelta", useSignatureDelta());
+	settings.setValue("scanner.manifest", useManifest());
+	settings.setValue("scanner.manifestfiles", manifestFiles());
+	settings.setValue("scanner.journal", watchChanges());
+	settings.setValue("scanner.resume", resumeScans());
+	settings.setValue("scanner.dedupe", deduplicateScans());
+	settings.setValue("onaccess.enabled", onAccessScanning());
+	settings.setValue("onaccess.paths", onAccessPaths());
 }
 
 void Settings::readSettings(const QSettings & settings) {
@@ -59,6 +116,25 @@ void Settings::readSettings(const QSettings & settings) {
 	setUpdateServerType(stringToUpdateServerType(settings.value("updateserver.type", "OfficialMirror").toString()));
 	setUpdateMirror(settings.value("updateserver.mirror", "").toString());
 	setCustomUpdateServer(settings.value("updateserver.customserver.url", "").toString());
+	setScanWorkerCount(settings.value("scanner.workers", 0).toInt());
+	setOrderedScan(settings.value("scanner.ordered", false).toBool());
+	setScanOrder(stringToScanOrder(settings.value("scanner.order", "Discovery").toString()));
+	setScanHardLinksOnce(settings.value("scanner.hardlinksonce", false).toBool());
+	setScanLargeFilesFirst(settings.value("scanner.largefilesfirst", false).toBool());
+	setUseReadAhead(settings.value("scanner.readahead", true).toBool());
+	setPreservePageCache(settings.value("scanner.preservepagecache", false).toBool());
+	setStageRemoteFiles(settings.value("scanner.stageremotefiles", true).toBool());
+	setUseScanCache(settings.value("scanner.cache", false).toBool());
+	setUseScanStamps(settings.value("scanner.stamps", false).toBool());
+	setScanStampKeyFile(settings.value("scanner.stampkeyfile", QString()).toString());
+	setUseSignatureDelta(settings.value("scanner.signaturedelta", false).toBool());
+	setUseManifest(settings.value("scanner.manifest", false).toBool());
+	setManifestFiles(settings.value("scanner.manifestfiles", QStringList()).toStringList());
+	setWatchChanges(settings.value("scanner.journal", false).toBool());
+	setResumeScans(settings.value("scanner.resume", true).toBool());
+	setDeduplicateScans(settings.value("scanner.dedupe", false).toBool());
+	setOnAccessScanning(settings.value("onaccess.enabled", false).toBool());
+	setOnAccessPaths(settings.value("onaccess.paths", QStringList()).toStringList());
 }
 
 void Settings::load() {
@@ -110,3 +186,29 @@ Settings::UpdateServerType Settings::stringToUpdateServerType( const QString & t
 
 	return UpdateServerType(-1);
 }
+
+QString Settings::scanOrderToString(ScanOrder order) {
+	switch(order) {
+		case ScanOrder::Discovery:
+			return QString::fromUtf8("Discovery");
+
+		case ScanOrder::Inode:
+			return QString::fromUtf8("Inode");
+
+		case ScanOrder::PhysicalOffset:
+			return QString::fromUtf8("PhysicalOffset");
+	}
+
+	return QString();
+}
+
+ScanOrder Settings::stringToScanOrder(const QString & order) {
+	if("Inode" == order) {
+		return ScanOrder::Inode;
+	}
+	else if("PhysicalOffset" == order) {
+		return ScanOrder::PhysicalOffset;
+	}
+
+	return ScanOrder::Discovery;
+}
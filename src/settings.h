@@ -3,8 +3,11 @@
 
 #include <QtCore/QObject>
 #include <QtCore/QString>
+#include <QtCore/QStringList>
 #include <QtCore/QUrl>
 
+#include "scanorder.h"
+
 class QSettings;
 
 namespace Qlam {
@@ -44,6 +47,101 @@ namespace Qlam {
 
 			QUrl updateServer() const;
 
+			/* the number of files to scan in parallel - 0 means one per available CPU */
+			inline int scanWorkerCount() const {
+				return m_scanWorkerCount;
+			}
+
+			/* whether to scan the entries in each directory in name order rather than the order the filesystem lists them */
+			inline bool orderedScan() const {
+				return m_orderedScan;
+			}
+
+			/* the order in which the files in each directory are scanned */
+			inline ScanOrder scanOrder() const {
+				return m_scanOrder;
+			}
+
+			/* whether a file with several hard links is scanned only once per scan */
+			inline bool scanHardLinksOnce() const {
+				return m_scanHardLinksOnce;
+			}
+
+			/* whether parallel scans start the largest files found so far first */
+			inline bool scanLargeFilesFirst() const {
+				return m_scanLargeFilesFirst;
+			}
+
+			/* whether files are opened and read ahead of the scan workers with io_uring, where it's available */
+			inline bool useReadAhead() const {
+				return m_useReadAhead;
+			}
+
+			/* whether scans leave the page cache and access times as they found them */
+			inline bool preservePageCache() const {
+				return m_preservePageCache;
+			}
+
+			/* whether files on network and FUSE filesystems are streamed into memory before they're scanned */
+			inline bool stageRemoteFiles() const {
+				return m_stageRemoteFiles;
+			}
+
+			/* whether files found clean by an earlier scan, and unchanged since, are skipped */
+			inline bool useScanCache() const {
+				return m_useScanCache;
+			}
+
+			/* whether clean files are stamped with an extended attribute so that later scans can skip them */
+			inline bool useScanStamps() const {
+				return m_useScanStamps;
+			}
+
+			/* the file holding the key scan stamps are authenticated with - empty for the default */
+			inline const QString & scanStampKeyFile() const {
+				return m_scanStampKeyFile;
+			}
+
+			/* whether daily updates keep the new signatures apart, so files the scan cache has cleared need checking against
+			 * only those */
+			inline bool useSignatureDelta() const {
+				return m_useSignatureDelta;
+			}
+
+			/* whether files matching the package databases or the manifest files are skipped */
+			inline bool useManifest() const {
+				return m_useManifest;
+			}
+
+			inline const QStringList & manifestFiles() const {
+				return m_manifestFiles;
+			}
+
+			/* whether an interrupted profile scan carries on from its last checkpoint the next time it's run */
+			inline bool resumeScans() const {
+				return m_resumeScans;
+			}
+
+			/* whether to keep a journal of the changes to the scan profiles' paths, for incremental scans */
+			inline bool watchChanges() const {
+				return m_watchChanges;
+			}
+
+			/* whether files are scanned as they are opened */
+			inline bool onAccessScanning() const {
+				return m_onAccessScanning;
+			}
+
+			/* the paths scanned on access - the home directory if empty */
+			inline const QStringList & onAccessPaths() const {
+				return m_onAccessPaths;
+			}
+
+			/* whether identical copies of a file are only scanned once in each scan */
+			inline bool deduplicateScans() const {
+				return m_deduplicateScans;
+			}
+
 			bool areModified() const {
 				return m_modified;
 			}
@@ -75,6 +173,162 @@ namespace Qlam {
 
 			bool setUpdateMirror(const QString &);
 
+			inline void setScanWorkerCount(int count) {
+				if(0 > count) {
+					count = 0;
+				}
+
+				if(count != m_scanWorkerCount) {
+					m_scanWorkerCount = count;
+					m_modified = true;
+					Q_EMIT scanWorkerCountChanged(count);
+				}
+			}
+
+			inline void setOrderedScan(bool ordered) {
+				if(ordered != m_orderedScan) {
+					m_orderedScan = ordered;
+					m_modified = true;
+					Q_EMIT orderedScanChanged(ordered);
+				}
+			}
+
+			inline void setScanOrder(ScanOrder order) {
+				if(order != m_scanOrder) {
+					m_scanOrder = order;
+					m_modified = true;
+					Q_EMIT scanOrderChanged(order);
+				}
+			}
+
+			inline void setScanHardLinksOnce(bool once) {
+				if(once != m_scanHardLinksOnce) {
+					m_scanHardLinksOnce = once;
+					m_modified = true;
+					Q_EMIT scanHardLinksOnceChanged(once);
+				}
+			}
+
+			inline void setScanLargeFilesFirst(bool largeFirst) {
+				if(largeFirst != m_scanLargeFilesFirst) {
+					m_scanLargeFilesFirst = largeFirst;
+					m_modified = true;
+					Q_EMIT scanLargeFilesFirstChanged(largeFirst);
+				}
+			}
+
+			inline void setUseReadAhead(bool use) {
+				if(use != m_useReadAhead) {
+					m_useReadAhead = use;
+					m_modified = true;
+					Q_EMIT useReadAheadChanged(use);
+				}
+			}
+
+			inline void setPreservePageCache(bool preserve) {
+				if(preserve != m_preservePageCache) {
+					m_preservePageCache = preserve;
+					m_modified = true;
+					Q_EMIT preservePageCacheChanged(preserve);
+				}
+			}
+
+			inline void setStageRemoteFiles(bool stage) {
+				if(stage != m_stageRemoteFiles) {
+					m_stageRemoteFiles = stage;
+					m_modified = true;
+					Q_EMIT stageRemoteFilesChanged(stage);
+				}
+			}
+
+			inline void setUseScanCache(bool use) {
+				if(use != m_useScanCache) {
+					m_useScanCache = use;
+					m_modified = true;
+					Q_EMIT useScanCacheChanged(use);
+				}
+			}
+
+			inline void setUseScanStamps(bool use) {
+				if(use != m_useScanStamps) {
+					m_useScanStamps = use;
+					m_modified = true;
+					Q_EMIT useScanStampsChanged(use);
+				}
+			}
+
+			inline void setScanStampKeyFile(const QString & file) {
+				if(file != m_scanStampKeyFile) {
+					m_scanStampKeyFile = file;
+					m_modified = true;
+					Q_EMIT scanStampKeyFileChanged(file);
+				}
+			}
+
+			inline void setResumeScans(bool resume) {
+				if(resume != m_resumeScans) {
+					m_resumeScans = resume;
+					m_modified = true;
+					Q_EMIT resumeScansChanged(resume);
+				}
+			}
+
+			inline void setUseSignatureDelta(bool use) {
+				if(use != m_useSignatureDelta) {
+					m_useSignatureDelta = use;
+					m_modified = true;
+					Q_EMIT useSignatureDeltaChanged(use);
+				}
+			}
+
+			inline void setUseManifest(bool use) {
+				if(use != m_useManifest) {
+					m_useManifest = use;
+					m_modified = true;
+					Q_EMIT useManifestChanged(use);
+				}
+			}
+
+			inline void setManifestFiles(const QStringList & files) {
+				if(files != m_manifestFiles) {
+					m_manifestFiles = files;
+					m_modified = true;
+					Q_EMIT manifestFilesChanged(files);
+				}
+			}
+
+			inline void setWatchChanges(bool watch) {
+				if(watch != m_watchChanges) {
+					m_watchChanges = watch;
+					m_modified = true;
+					Q_EMIT watchChangesChanged(watch);
+				}
+			}
+
+			inline void setOnAccessScanning(bool scan) {
+				if(scan != m_onAccessScanning) {
+					m_onAccessScanning = scan;
+					m_modified = true;
+					Q_EMIT onAccessScanningChanged(scan);
+				}
+			}
+
+			inline void setOnAccessPaths(const QStringList & paths) {
+				if(paths != m_onAccessPaths) {
+					m_onAccessPaths = paths;
+					m_modified = true;
+					Q_EMIT onAccessPathsChanged(paths);
+				}
+			}
+
+			inline void setDeduplicateScans(bool dedupe) {
+				if(dedupe != m_deduplicateScans) {
+					m_deduplicateScans = dedupe;
+					m_modified = true;
+					Q_EMIT deduplicateScansChanged(dedupe);
+				}
+			}
+
 			inline void setCustomUpdateServer(const QString & server) {
 				setCustomUpdateServer(QUrl(server));
 			}
@@ -110,18 +364,58 @@ namespace Qlam {
 			void updateMirrorChanged(const QString &);
 			void customUpdateServerChanged(const QString &);
 			void customUpdateServerChanged(const QUrl &);
+			void scanWorkerCountChanged(int);
+			void orderedScanChanged(bool);
+			void scanOrderChanged(ScanOrder);
+			void scanHardLinksOnceChanged(bool);
+			void scanLargeFilesFirstChanged(bool);
+			void useReadAheadChanged(bool);
+			void preservePageCacheChanged(bool);
+			void stageRemoteFilesChanged(bool);
+			void useScanCacheChanged(bool);
+			void useScanStampsChanged(bool);
+			void scanStampKeyFileChanged(const QString &);
+			void useSignatureDeltaChanged(bool);
+			void useManifestChanged(bool);
+			void manifestFilesChanged(const QStringList &);
+			void watchChangesChanged(bool);
+			void resumeScansChanged(bool);
+			void onAccessScanningChanged(bool);
+			void onAccessPathsChanged(const QStringList &);
+			void deduplicateScansChanged(bool);
 
 		private:
 			void fillSettings(QSettings &) const;
 			void readSettings(const QSettings &);
 			static QString updateServerTypeToString(const UpdateServerType &);
 			static UpdateServerType stringToUpdateServerType(const QString &);
+			static QString scanOrderToString(ScanOrder);
+			static ScanOrder stringToScanOrder(const QString &);
 
 			QString m_filePath;
 			QString m_dbPath;
 			UpdateServerType m_updateServerType;
 			QString m_updateMirror;
 			QUrl m_customUpdateServer;
+			int m_scanWorkerCount;
+			bool m_orderedScan;
+			ScanOrder m_scanOrder;
+			bool m_scanHardLinksOnce;
+			bool m_scanLargeFilesFirst;
+			bool m_useReadAhead;
+			bool m_preservePageCache;
+			bool m_stageRemoteFiles;
+			bool m_useScanCache;
+			bool m_useScanStamps;
+			QString m_scanStampKeyFile;
+			bool m_useSignatureDelta;
+			bool m_useManifest;
+			QStringList m_manifestFiles;
+			bool m_watchChanges;
+			bool m_resumeScans;
+			bool m_onAccessScanning;
+			QStringList m_onAccessPaths;
+			bool m_deduplicateScans;
 
 		protected:
 			mutable bool m_modified;
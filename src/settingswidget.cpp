@@ -4,9 +4,14 @@
 #include <QtGlobal>
 
 #include <QtCore/QDir>
+#include <QtCore/QFileInfo>
 #include <QtCore/QStringList>
+#include <QtCore/QTimerEvent>
+#include <QtCore/QLocale>
 #include <QtWidgets/QFileDialog>
+#include <QtWidgets/QMessageBox>
 #include "application.h"
+#include "scancache.h"
 #include "settings.h"
 
 using namespace Qlam;
@@ -21,7 +26,8 @@ SettingsWidget::SettingsWidget( Settings * settings, QWidget * parent )
 SettingsWidget::SettingsWidget( QWidget * parent )
 : QWidget(parent),
   m_ui(std::make_unique<Ui::SettingsWidget>()),
-  m_settings(nullptr) {
+  m_settings(nullptr),
+  m_onAccessStatusTimer(0) {
 	m_ui->setupUi(this);
 
 	connect(m_ui->chooseDatabasePathButton, &QToolButton::clicked, this, &SettingsWidget::chooseDatabasePath);
@@ -30,6 +36,10 @@ SettingsWidget::SettingsWidget( QWidget * parent )
 	connect(m_ui->mirrorCombo, qOverload<int>(&QComboBox::currentIndexChanged), this, &SettingsWidget::slotMirrorChanged);
 	connect(m_ui->databasePath, &QLineEdit::editingFinished, this, &SettingsWidget::slotDatabasePathChanged);
 	connect(m_ui->customServer, &QLineEdit::textEdited, this, &SettingsWidget::slotCustomServerChanged);
+	connect(m_ui->onAccessScanning, &QCheckBox::toggled, this, &SettingsWidget::slotOnAccessScanningChanged);
+	connect(m_ui->onAccessPaths, &QLineEdit::editingFinished, this, &SettingsWidget::slotOnAccessPathsChanged);
+	connect(m_ui->scanCache, &QCheckBox::toggled, this, &SettingsWidget::slotScanCacheChanged);
+	connect(m_ui->clearScanCache, &QPushButton::clicked, this, &SettingsWidget::slotClearScanCache);
 	setupMirrors();
 }
 
@@ -89,6 +99,100 @@ void SettingsWidget::slotCustomServerChanged() {
 	connectSettings();
 }
 
+void SettingsWidget::slotOnAccessScanningChanged() {
+	if(!m_settings) {
+		return;
+	}
+
+	disconnectSettings();
+	m_settings->setOnAccessScanning(m_ui->onAccessScanning->isChecked());
+	connectSettings();
+	showOnAccessStatus();
+}
+
+void SettingsWidget::slotOnAccessPathsChanged() {
+	if(!m_settings) {
+		return;
+	}
+
+	// each change restarts the on-access scanner, so they're only taken once editing is finished
+	QStringList paths = m_ui->onAccessPaths->text().split(QDir::listSeparator());
+	paths.removeAll(QString());
+	disconnectSettings();
+	m_settings->setOnAccessPaths(paths);
+	connectSettings();
+	showOnAccessStatus();
+}
+
+void SettingsWidget::slotScanCacheChanged() {
+	if(!m_settings) {
+		return;
+	}
+
+	disconnectSettings();
+	m_settings->setUseScanCache(m_ui->scanCache->isChecked());
+	connectSettings();
+}
+
+void SettingsWidget::slotClearScanCache() {
+	if(!ScanCache::clear()) {
+		QMessageBox::warning(this, tr("Clear cache"), tr("The scan cache could not be cleared."));
+		return;
+	}
+
+	m_ui->clearScanCache->setEnabled(false);
+}
+
+void SettingsWidget::showEvent(QShowEvent * event) {
+	QWidget::showEvent(event);
+	showOnAccessStatus();
+	m_ui->clearScanCache->setEnabled(QFileInfo::exists(ScanCache::defaultPath()));
+
+	if(0 == m_onAccessStatusTimer) {
+		m_onAccessStatusTimer = startTimer(2000);
+	}
+}
+
+void SettingsWidget::hideEvent(QHideEvent * event) {
+	if(0 != m_onAccessStatusTimer) {
+		killTimer(m_onAccessStatusTimer);
+		m_onAccessStatusTimer = 0;
+	}
+
+	QWidget::hideEvent(event);
+}
+
+void SettingsWidget::timerEvent(QTimerEvent * event) {
+	if(event->timerId() == m_onAccessStatusTimer) {
+		showOnAccessStatus();
+	}
+}
+
+/**
+ * Show how many opens the on-access scanner has answered and how quickly.
+ */
+void SettingsWidget::showOnAccessStatus() {
+	const OnAccessScanner * scanner = qlamApp->onAccessScanner();
+
+	if(!scanner->isRunning()) {
+		m_ui->onAccessStatus->setText(m_ui->onAccessScanning->isChecked() ? tr("On-access scanning could not be started.") : QString());
+		return;
+	}
+
+	QLocale currentLocale;
+	const OnAccessScanner::Latency latency = scanner->latency();
+
+	m_ui->onAccessStatus->setText(tr("%1 opens answered: %2 files scanned, %3 answered from the cache, %4 timed out. Time to answer: %5 µs for half of them, %6 µs for 90%, %7 µs for 99% and %8 µs for 99.9%.")
+		.arg(currentLocale.toString(static_cast<qulonglong>(latency.count)))
+		.arg(currentLocale.toString(scanner->scannedFileCount()))
+		.arg(currentLocale.toString(scanner->cachedVerdictCount()))
+		.arg(currentLocale.toString(scanner->timedOutCount()))
+		.arg(currentLocale.toString(static_cast<qulonglong>(latency.p50)))
+		.arg(currentLocale.toString(static_cast<qulonglong>(latency.p90)))
+		.arg(currentLocale.toString(static_cast<qulonglong>(latency.p99)))
+		.arg(currentLocale.toString(static_cast<qulonglong>(latency.p999))));
+}
+
 void SettingsWidget::connectSettings() {
 	if(m_settings) {
 		connect(m_settings, &Settings::changed, this, &SettingsWidget::syncWithSettings);
@@ -126,6 +230,13 @@ void SettingsWidget::syncWithSettings() {
 		m_ui->mirrorCombo->setCurrentIndex(m_ui->mirrorCombo->findText(m_settings->updateMirror()));
 		m_ui->mirrorCombo->blockSignals(block);
 		m_ui->customServer->setText(m_settings->customUpdateServer().toString());
+		block = m_ui->onAccessScanning->blockSignals(true);
+		m_ui->onAccessScanning->setChecked(m_settings->onAccessScanning());
+		m_ui->onAccessScanning->blockSignals(block);
+		m_ui->onAccessPaths->setText(m_settings->onAccessPaths().join(QDir::listSeparator()));
+		block = m_ui->scanCache->blockSignals(true);
+		m_ui->scanCache->setChecked(m_settings->useScanCache());
+		m_ui->scanCache->blockSignals(block);
 		listDatabases();
 
 		if(m_settings->areModified()) {
@@ -31,20 +31,33 @@ namespace Qlam {
 			void syncWithSettings();
 			void chooseDatabasePath();
 
+		protected:
+			void showEvent(QShowEvent *) override;
+			void hideEvent(QHideEvent *) override;
+			void timerEvent(QTimerEvent *) override;
+
 		private Q_SLOTS:
 			void slotDatabasePathChanged();
 			void slotServerTypeChanged();
 			void slotMirrorChanged();
 			void slotCustomServerChanged();
+			void slotOnAccessScanningChanged();
+			void slotOnAccessPathsChanged();
+			void slotScanCacheChanged();
+			void slotClearScanCache();
 
 		private:
 			void connectSettings();
 			void disconnectSettings();
 			void listDatabases();
 			void setupMirrors();
+			void showOnAccessStatus();
 
 			std::unique_ptr<Ui::SettingsWidget> m_ui;
 			Settings * m_settings;
+
+			// refreshes the on-access scanner's figures while the widget is showing
+			int m_onAccessStatusTimer;
 	};
 }
 
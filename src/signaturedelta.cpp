@@ -0,0 +1,408 @@
+#include "signaturedelta.h"
+
+#include <QtCore/QDebug>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QProcess>
+#include <QtCore/QSaveFile>
+#include <QtCore/QSet>
+#include <QtCore/QStandardPaths>
+#include <QtCore/QTemporaryDir>
+
+#include <clamav.h>
+
+using namespace Qlam;
+
+// database file types with one signature per line
+static constexpr const char * LineSignatureTypes[] = {
+	"hdb", "hdu", "hsb", "hsu", "mdb", "mdu", "msb", "msu", "imp", "ndb", "ndu", "ldb", "ldu", "idb", "cdb", "pdb", "gdb", "wdb",
+};
+
+// database file types that only make sense whole
+static constexpr const char * WholeFileSignatureTypes[] = {
+	"cbc", "yar", "yara",
+};
+
+// database file types that suppress detections, block certificates or configure the parsers and file typing - the
+// delta takes the latest of each so that it reports what the full engine would
+static constexpr const char * CarriedTypes[] = {
+	"fp", "sfp", "ign", "ign2", "crb", "cfg", "ftm",
+};
+
+// files in a database that describe it rather than change what it detects
+static constexpr const char * MetadataTypes[] = {
+	"info", "",
+};
+
+// how long sigtool may take to unpack a database, in ms
+static constexpr const int UnpackTimeout = 120000;
+
+// past this many signatures a delta is rebuilt from the latest update alone rather than added to
+static constexpr const int MaxMergedSignatures = 200000;
+
+namespace {
+	enum class SignatureType {
+		None,
+		Line,
+		WholeFile,
+		Carried,
+		Metadata,
+	};
+
+	SignatureType signatureType(const QString & fileName) {
+		const QString suffix = QFileInfo(fileName).suffix().toLower();
+
+		for(const char * type : LineSignatureTypes) {
+			if(suffix == QLatin1String(type)) {
+				return SignatureType::Line;
+			}
+		}
+
+		for(const char * type : WholeFileSignatureTypes) {
+			if(suffix == QLatin1String(type)) {
+				return SignatureType::WholeFile;
+			}
+		}
+
+		for(const char * type : CarriedTypes) {
+			if(suffix == QLatin1String(type)) {
+				return SignatureType::Carried;
+			}
+		}
+
+		for(const char * type : MetadataTypes) {
+			if(suffix == QLatin1String(type)) {
+				return SignatureType::Metadata;
+			}
+		}
+
+		return SignatureType::None;
+	}
+
+	bool unpack(const QString & databaseFile, const QString & directory) {
+		QProcess sigtool;
+		sigtool.setWorkingDirectory(directory);
+		sigtool.start(QStringLiteral("sigtool"), QStringList() << (QStringLiteral("--unpack=") + QDir::toNativeSeparators(databaseFile)));
+
+		if(!sigtool.waitForFinished(UnpackTimeout) || QProcess::NormalExit != sigtool.exitStatus() || 0 != sigtool.exitCode()) {
+qDebug() << "sigtool failed to unpack" << databaseFile;
+			sigtool.kill();
+			return false;
+		}
+
+		return true;
+	}
+
+	QSet<QByteArray> readLines(const QString & path) {
+		QSet<QByteArray> lines;
+		QFile file(path);
+
+		if(file.open(QIODevice::ReadOnly)) {
+			for(const auto & line : file.readAll().split('\n')) {
+				if(!line.isEmpty()) {
+					lines.insert(line);
+				}
+			}
+		}
+
+		return lines;
+	}
+
+	int countLines(const QString & directory) {
+		int count = 0;
+
+		for(const auto & info : QDir(directory).entryInfoList(QDir::Files)) {
+			switch(signatureType(info.fileName())) {
+				case SignatureType::Line:
+					count += readLines(info.absoluteFilePath()).size();
+					break;
+
+				case SignatureType::WholeFile:
+					++count;
+					break;
+
+				default:
+					break;
+			}
+		}
+
+		return count;
+	}
+}
+
+SignatureDelta::SignatureDelta(QString directory)
+: m_directory(std::move(directory)) {
+}
+
+QString SignatureDelta::defaultDirectory() {
+	return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + QStringLiteral("/signaturedelta");
+}
+
+QString SignatureDelta::snapshotDirectory() const {
+	return m_directory + QStringLiteral("/previous");
+}
+
+QString SignatureDelta::signatureDirectory() const {
+	return m_directory + QStringLiteral("/signatures");
+}
+
+QString SignatureDelta::infoPath() const {
+	return m_directory + QStringLiteral("/delta.info");
+}
+
+/**
+ * Copy a database that is about to be replaced, so that the delta can be built once the new one is in place.
+ */
+bool SignatureDelta::snapshot(const QString & databaseFile) {
+	QDir snapshots(snapshotDirectory());
+	snapshots.removeRecursively();
+
+	if(!QDir().mkpath(snapshots.absolutePath()) || !QFile::copy(databaseFile, snapshots.absoluteFilePath(QFileInfo(databaseFile).fileName()))) {
+qDebug() << "failed to take a snapshot of" << databaseFile;
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Build the delta from the snapshot to databaseFile, which has replaced it.
+ *
+ * fromVersion and toVersion are the application's database versions from before and after the update. The snapshot
+ * is consumed whether or not the delta can be built; if it can't, any existing delta is discarded.
+ */
+bool SignatureDelta::build(const QByteArray & fromVersion, const QByteArray & toVersion, const QString & databaseFile) {
+	const QFileInfoList snapshots = QDir(snapshotDirectory()).entryInfoList(QStringList() << "*.cvd" << "*.cld", QDir::Files);
+	QTemporaryDir oldSignatures;
+	QTemporaryDir newSignatures;
+
+	if(fromVersion.isEmpty() || toVersion.isEmpty() || 1 != snapshots.size() || !oldSignatures.isValid() || !newSignatures.isValid()
+	   || !unpack(snapshots.first().absoluteFilePath(), oldSignatures.path()) || !unpack(databaseFile, newSignatures.path())) {
+qDebug() << "can't build a signature delta for" << databaseFile;
+		discard();
+		return false;
+	}
+
+	QDir(snapshotDirectory()).removeRecursively();
+
+	QByteArray existingToVersion;
+	QList<QByteArray> fromVersions;
+	const QString stagingDirectory = m_directory + QStringLiteral("/signatures.new");
+	QDir(stagingDirectory).removeRecursively();
+	QDir().mkpath(stagingDirectory);
+
+	// a delta nothing has caught up with yet is added to, so that caches from before it can still use the result
+	if(readInfo(existingToVersion, fromVersions) && existingToVersion == fromVersion && MaxMergedSignatures > countLines(signatureDirectory())) {
+		for(const auto & info : QDir(signatureDirectory()).entryInfoList(QDir::Files)) {
+			QFile::copy(info.absoluteFilePath(), stagingDirectory + '/' + info.fileName());
+		}
+	}
+	else {
+		fromVersions.clear();
+	}
+
+	fromVersions.append(fromVersion);
+	int addedCount = 0;
+
+	// whatever the update removed mustn't be carried over from the delta being added to
+	for(const auto & info : QDir(stagingDirectory).entryInfoList(QDir::Files)) {
+		if(!QFileInfo::exists(newSignatures.path() + '/' + info.fileName())) {
+			QFile::remove(info.absoluteFilePath());
+		}
+	}
+
+	for(const auto & info : QDir(newSignatures.path()).entryInfoList(QDir::Files)) {
+		const QString oldPath = oldSignatures.path() + '/' + info.fileName();
+		const QString stagedPath = stagingDirectory + '/' + info.fileName();
+
+		switch(signatureType(info.fileName())) {
+			case SignatureType::Metadata:
+				break;
+
+			case SignatureType::None: {
+				// a type this doesn't know might change what the full engine reports in a way the delta can't follow
+				QFile oldFile(oldPath);
+				QFile newFile(info.absoluteFilePath());
+
+				if(oldFile.open(QIODevice::ReadOnly) && newFile.open(QIODevice::ReadOnly) && oldFile.readAll() == newFile.readAll()) {
+					break;
+				}
+
+qDebug() << "can't build a signature delta - the update changed" << info.fileName();
+				discard();
+				return false;
+			}
+
+			case SignatureType::Line: {
+				const QSet<QByteArray> oldLines = readLines(oldPath);
+				const QSet<QByteArray> newLines = readLines(info.absoluteFilePath());
+
+				// signatures carried over from the delta being added to that this update removed
+				QSet<QByteArray> stagedLines = readLines(stagedPath);
+				const int carriedCount = stagedLines.size();
+				stagedLines.intersect(newLines);
+				bool isChanged = (carriedCount != stagedLines.size());
+
+				for(const auto & line : newLines) {
+					if(!oldLines.contains(line) && !stagedLines.contains(line)) {
+						stagedLines.insert(line);
+						isChanged = true;
+						++addedCount;
+					}
+				}
+
+				if(!isChanged) {
+					break;
+				}
+
+				if(stagedLines.isEmpty()) {
+					QFile::remove(stagedPath);
+					break;
+				}
+
+				QByteArray lines;
+
+				for(const auto & line : stagedLines) {
+					lines.append(line).append('\n');
+				}
+
+				QFile staged(stagedPath);
+
+				if(!staged.open(QIODevice::WriteOnly | QIODevice::Truncate) || lines.size() != staged.write(lines)) {
+qDebug() << "failed to write signature delta file" << stagedPath;
+					discard();
+					return false;
+				}
+				break;
+			}
+
+			case SignatureType::WholeFile: {
+				QFile oldFile(oldPath);
+				QFile newFile(info.absoluteFilePath());
+
+				if(oldFile.open(QIODevice::ReadOnly) && newFile.open(QIODevice::ReadOnly) && oldFile.readAll() == newFile.readAll()) {
+					break;
+				}
+
+				QFile::remove(stagedPath);
+
+				if(!QFile::copy(info.absoluteFilePath(), stagedPath)) {
+qDebug() << "failed to write signature delta file" << stagedPath;
+					discard();
+					return false;
+				}
+
+				++addedCount;
+				break;
+			}
+
+			case SignatureType::Carried:
+				QFile::remove(stagedPath);
+
+				if(!QFile::copy(info.absoluteFilePath(), stagedPath)) {
+qDebug() << "failed to write signature delta file" << stagedPath;
+					discard();
+					return false;
+				}
+				break;
+		}
+	}
+
+	QDir(signatureDirectory()).removeRecursively();
+
+	if(!QDir().rename(stagingDirectory, signatureDirectory())) {
+qDebug() << "failed to install signature delta in" << signatureDirectory();
+		discard();
+		return false;
+	}
+
+	QSaveFile file(infoPath());
+
+	if(!file.open(QIODevice::WriteOnly)) {
+		discard();
+		return false;
+	}
+
+	file.write(toVersion + '\n');
+
+	for(const auto & version : fromVersions) {
+		file.write(version + '\n');
+	}
+
+	if(!file.commit()) {
+		discard();
+		return false;
+	}
+
+qDebug() << "signature delta has" << addedCount << "new signatures for" << fromVersions.size() << "previous versions";
+	return true;
+}
+
+void SignatureDelta::discard() {
+	QDir(m_directory).removeRecursively();
+}
+
+bool SignatureDelta::readInfo(QByteArray & toVersion, QList<QByteArray> & fromVersions) const {
+	QFile file(infoPath());
+
+	if(!file.open(QIODevice::ReadOnly)) {
+		return false;
+	}
+
+	QList<QByteArray> versions = file.readAll().split('\n');
+
+	while(!versions.isEmpty() && versions.last().isEmpty()) {
+		versions.removeLast();
+	}
+
+	if(2 > versions.size()) {
+		return false;
+	}
+
+	toVersion = versions.takeFirst();
+	fromVersions = versions;
+	return true;
+}
+
+QList<QByteArray> SignatureDelta::baseVersions(const QByteArray & toVersion) const {
+	QByteArray deltaToVersion;
+	QList<QByteArray> fromVersions;
+
+	if(toVersion.isEmpty() || !readInfo(deltaToVersion, fromVersions) || deltaToVersion != toVersion || !QFileInfo(signatureDirectory()).isDir()) {
+		return {};
+	}
+
+	return fromVersions;
+}
+
+/**
+ * Load the delta's signatures into an engine of their own.
+ *
+ * The engine is loaded with the same options as the application's, so that it matches whatever the full engine
+ * would have matched with the same signatures.
+ */
+struct cl_engine * SignatureDelta::loadEngine() const {
+	struct cl_engine * engine = cl_engine_new();
+
+	if(!engine) {
+		return nullptr;
+	}
+
+	unsigned int sigs = 0;
+	QByteArray path = QFile::encodeName(QDir::toNativeSeparators(signatureDirectory()));
+	int ret = cl_load(path.constData(), engine, &sigs, CL_DB_STDOPT); // NOLINT(hicpp-signed-bitwise)
+
+	if(CL_SUCCESS == ret) {
+		ret = cl_engine_compile(engine);
+	}
+
+	if(CL_SUCCESS != ret) {
+qDebug() << "failed to load signature delta:" << cl_strerror(ret);
+		cl_engine_free(engine);
+		return nullptr;
+	}
+
+qDebug() << "loaded signature delta with" << sigs << "signatures";
+	return engine;
+}
@@ -0,0 +1,61 @@
+#ifndef QLAM_SIGNATUREDELTA_H
+#define QLAM_SIGNATUREDELTA_H
+
+#include <QtCore/QByteArray>
+#include <QtCore/QList>
+#include <QtCore/QString>
+
+struct cl_engine;
+
+namespace Qlam {
+	/**
+	 * The signatures added by the most recent daily database updates.
+	 *
+	 * A file that was clean under the old signatures can only be detected by the new ones, so checking it against
+	 * just those is enough to bring its verdict up to date. Before the updater replaces the daily database it takes a
+	 * snapshot of it; once the new one is in place both are unpacked with sigtool and every signature in the new one
+	 * that isn't in the old one is written to a directory of its own, which loads into a small engine.
+	 *
+	 * Signatures that were removed don't matter - they can only make a clean file cleaner - but the lists that
+	 * suppress detections or block certificates, and the parser and file type configuration, are copied whole from
+	 * the new database, so that the delta doesn't report what the full engine wouldn't. An update that changes a file
+	 * of any other type leaves no delta. Bytecode and YARA rules can't be split into single signatures, so new or
+	 * changed files of them are taken whole.
+	 *
+	 * The delta records the database version it brings verdicts up to and each version it brings them up from. When
+	 * an update follows one that no scan has caught up with yet, the new signatures are added to the existing delta
+	 * so that it serves caches from either of the older versions, and the signatures this update removed are dropped
+	 * from it.
+	 */
+	class SignatureDelta {
+		public:
+			explicit SignatureDelta(QString directory = defaultDirectory());
+
+			static QString defaultDirectory();
+
+			const QString & directory() const {
+				return m_directory;
+			}
+
+			/* keep a copy of a database that is about to be replaced */
+			bool snapshot(const QString & databaseFile);
+			bool build(const QByteArray & fromVersion, const QByteArray & toVersion, const QString & databaseFile);
+			void discard();
+
+			/* the versions whose verdicts the delta can bring up to toVersion - empty if there is no such delta */
+			QList<QByteArray> baseVersions(const QByteArray & toVersion) const;
+
+			/* the caller owns the engine, and must free it with cl_engine_free() */
+			struct cl_engine * loadEngine() const;
+
+		private:
+			QString snapshotDirectory() const;
+			QString signatureDirectory() const;
+			QString infoPath() const;
+			bool readInfo(QByteArray & toVersion, QList<QByteArray> & fromVersions) const;
+
+			QString m_directory;
+	};
+}
+
+#endif // QLAM_SIGNATUREDELTA_H
@@ -0,0 +1,119 @@
+#include "sparsefile.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <unistd.h>
+
+using namespace Qlam;
+
+// smaller files aren't worth the extra seeks, however sparse they are
+static constexpr const quint64 MinimumSparseSize = 16 * 1024 * 1024;
+
+// a file counts as sparse when less than this fraction of its apparent size is allocated
+static constexpr const double MaximumSparseAllocation = 0.75;
+
+SparseFile::SparseFile(int fd, quint64 size)
+: m_fd(fd),
+  m_size(size),
+  m_dataStart(0),
+  m_dataEnd(0),
+  m_skippedSize(0) {
+}
+
+bool SparseFile::isSparse(const struct stat & st) {
+	if(!S_ISREG(st.st_mode) || MinimumSparseSize > static_cast<quint64>(st.st_size)) {
+		return false;
+	}
+
+	// st_blocks is always in 512-byte units
+	return static_cast<double>(st.st_blocks) * 512.0 < static_cast<double>(st.st_size) * MaximumSparseAllocation;
+}
+
+/**
+ * Find where the data is from an offset on.
+ *
+ * A filesystem without SEEK_DATA support reports the whole file as data, and so does a seek that fails for any other
+ * reason, so the worst that happens is that holes are read.
+ */
+bool SparseFile::findData(quint64 offset, quint64 & start, quint64 & end) {
+	if(offset >= m_size) {
+		return false;
+	}
+
+	if(offset < m_dataStart || offset >= m_dataEnd) {
+		off_t data = ::lseek(m_fd, static_cast<off_t>(offset), SEEK_DATA);
+
+		if(-1 == data) {
+			if(ENXIO == errno) {
+				return false;
+			}
+
+			data = static_cast<off_t>(offset);
+		}
+
+		off_t hole = ::lseek(m_fd, data, SEEK_HOLE);
+		m_dataStart = static_cast<quint64>(data);
+		m_dataEnd = (-1 == hole ? m_size : std::min(m_size, static_cast<quint64>(hole)));
+
+		if(m_dataStart >= m_dataEnd) {
+			return false;
+		}
+	}
+
+	start = std::max(offset, m_dataStart);
+	end = m_dataEnd;
+	return true;
+}
+
+/**
+ * Fill a buffer from the file, reading the data and zeroing the holes.
+ *
+ * Returns the number of bytes filled, which is short only at the end of the file, or -1 if nothing could be read.
+ */
+off_t SparseFile::read(void * handle, void * buffer, size_t count, off_t offset) {
+	auto * file = static_cast<SparseFile *>(handle);
+	auto * out = static_cast<char *>(buffer);
+	const auto first = static_cast<quint64>(offset);
+	const quint64 last = std::min(file->m_size, first + count);
+	quint64 pos = first;
+
+	while(pos < last) {
+		quint64 dataStart = last;
+		quint64 dataEnd = last;
+
+		if(!file->findData(pos, dataStart, dataEnd)) {
+			dataStart = last;
+		}
+
+		if(dataStart > pos) {
+			const quint64 length = std::min(dataStart, last) - pos;
+			std::memset(out, 0, length);
+			file->m_skippedSize += length;
+			out += length;
+			pos += length;
+			continue;
+		}
+
+		const ssize_t bytesRead = ::pread(file->m_fd, out, std::min(dataEnd, last) - pos, static_cast<off_t>(pos));
+
+		if(0 > bytesRead) {
+			if(EINTR == errno) {
+				continue;
+			}
+
+			return (pos == first ? -1 : static_cast<off_t>(pos - first));
+		}
+
+		// the file has been truncated since it was opened
+		if(0 == bytesRead) {
+			break;
+		}
+
+		out += bytesRead;
+		pos += static_cast<quint64>(bytesRead);
+	}
+
+	return static_cast<off_t>(pos - first);
+}
@@ -0,0 +1,51 @@
+#ifndef QLAM_SPARSEFILE_H
+#define QLAM_SPARSEFILE_H
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <QtGlobal>
+
+namespace Qlam {
+	/**
+	 * Reads a sparse file without reading its holes.
+	 *
+	 * VM images and database files can be hundreds of GB in size with only a fraction of that allocated. Read
+	 * through the kernel, every byte of a hole comes back as a zero, which costs as much as reading data. The reader
+	 * finds the file's data with SEEK_DATA and SEEK_HOLE and serves the holes as zeros itself, so the cost of scanning
+	 * the file follows its allocated size rather than its apparent size.
+	 *
+	 * read() fits libclamav's pread callback, so the file can be scanned through cl_fmap_open_handle(). A reader is
+	 * only used from one thread at a time.
+	 */
+	class SparseFile {
+		public:
+			SparseFile(int fd, quint64 size);
+
+			/* whether a file has enough of its apparent size in holes to be worth reading this way */
+			static bool isSparse(const struct stat &);
+
+			/* the first run of data at or after offset, as [start, end) - false if there is only hole from offset on */
+			bool findData(quint64 offset, quint64 & start, quint64 & end);
+
+			/* a clcb_pread for cl_fmap_open_handle(), with the SparseFile as the handle */
+			static off_t read(void * handle, void * buffer, size_t count, off_t offset);
+
+			/* the bytes served as zeros from holes rather than read */
+			quint64 skippedSize() const {
+				return m_skippedSize;
+			}
+
+		private:
+			int m_fd;
+			quint64 m_size;
+
+			// the run of data found last - libclamav reads a file in order, so the next read is usually in it
+			quint64 m_dataStart;
+			quint64 m_dataEnd;
+
+			quint64 m_skippedSize;
+	};
+}
+
+#endif // QLAM_SPARSEFILE_H
@@ -13,6 +13,7 @@
 #include "application.h"
 #include "settings.h"
 #include "databaseinfo.h"
+#include "signaturedelta.h"
 #include "virusdatabasedownloader.h"
 
 using namespace Qlam;
@@ -36,12 +37,14 @@ void Updater::run() {
     int currentBytecodeVersion = -1;
     int currentDailyVersion = -1;
     int currentMainVersion = -1;
+    QString currentDailyPath;
 
     for (const auto &db: dbs) {
         if ("main.cvd" == db.fileName()) {
             currentMainVersion = db.version().toInt();
         } else if ("daily.cld" == db.fileName() || "daily.cvd" == db.fileName()) {
             currentDailyVersion = db.version().toInt();
+            currentDailyPath = db.path();
         } else if ("bytecode.cvd" == db.fileName()) {
             currentBytecodeVersion = db.version().toInt();
         }
@@ -162,6 +165,11 @@ void Updater::run() {
 		return;
 	}
 
+	// the delta only covers the daily database, so any other update means scanning everything again anyway
+	SignatureDelta signatureDelta;
+	const QByteArray previousVersion = (s->useSignatureDelta() ? qlamApp->databaseVersion() : QByteArray());
+	bool buildDelta = doDailyUpdate && !doMainUpdate && !doBytecodeUpdate && !previousVersion.isEmpty() && !currentDailyPath.isEmpty();
+
 	if(doMainUpdate) {
 		Q_EMIT updatingMainDatabase(latestMainVersion);
 
@@ -204,6 +212,10 @@ qDebug() << "update URL:" << u;
 	if(doDailyUpdate) {
 		Q_EMIT updatingDailyDatabase(latestDailyVersion);
 
+		if(buildDelta) {
+			buildDelta = signatureDelta.snapshot(currentDailyPath);
+		}
+
 		QFile f(qlamApp->settings()->databasePath() + "/daily.cvd");
 
 		if(!f.open(QIODevice::WriteOnly)) {
@@ -275,6 +287,13 @@ qDebug() << "update URL:" << u;
 		}
 	}
 
+	if(buildDelta) {
+		signatureDelta.build(previousVersion, qlamApp->databaseVersion(), qlamApp->settings()->databasePath() + "/daily.cvd");
+	}
+	else {
+		signatureDelta.discard();
+	}
+
 	Q_EMIT updateSucceeded();
 	Q_EMIT updateComplete();
 }
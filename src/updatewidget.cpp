@@ -48,6 +48,7 @@ void UpdateWidget::doUpdate() {
 		connect(m_updater, &Updater::updatingBytecodeDatabase, this, &UpdateWidget::slotUpdatingBytecodeDatabase);
 		connect(m_updater, &Updater::updateFailed, this, &UpdateWidget::slotUpdateFailed);
 		connect(m_updater, &Updater::updateSucceeded, this, &UpdateWidget::slotUpdateSucceeded);
+		connect(m_updater, &Updater::updateSucceeded, qlamApp, &Application::databasesUpdated);
 		connect(m_updater, &Updater::finished, this, &UpdateWidget::slotUpdaterFinished);
 		connect(m_updater, &Updater::upToDate, this, &UpdateWidget::slotAlreadyUpToDate);
 		connect(m_updater, &Updater::updatesFound, this, &UpdateWidget::slotUpdatesFound);